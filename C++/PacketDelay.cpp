@@ -24,84 +24,17 @@
 
 #include <mil.h>
 #include <vector>
-#if M_MIL_USE_WINDOWS
-#include <conio.h>
-#include <windows.h>
-#endif
+#include <stdio.h>
+#include "PacketDelay.h"
+#include "PacketDelayConfig.h"
 
 using namespace std;
 
-/* Number of images in the buffering grab queue.
-Generally, increasing this number gives better real-time grab.
-*/
-#define BUFFERING_SIZE_MAX 20
-
-/* Set this define to 1 to print additional details performed by this example. */
-#define PRINT_DETAILS      0
-
-/* User's processing function prototype. */
-MIL_INT MFTYPE ProcessingFunction(MIL_INT HookType,
-                                  MIL_ID HookId,
-                                  void* HookDataPtr);
-
-/* Struct and variable definitions/declarations. */
-MIL_ID MilGrabBufferList[BUFFERING_SIZE_MAX] = { 0 };
-MIL_INT MilGrabBufferListSize;
-
-struct PacketDelayInfo
-   {
-   PacketDelayInfo()
-      {
-      BaseFrameRate = 0;
-      ProcessFrameRate = 0;
-      DelayInSeconds = 0;
-      TickFreq = 0;
-      DelayTickVal = 0;
-      ProcessFrameCount = 0;
-      EqualityCounter = 0;
-      Error = false;
-      }
-   MIL_DOUBLE BaseFrameRate;
-   MIL_DOUBLE ProcessFrameRate;
-   MIL_DOUBLE DelayInSeconds;
-   MIL_UINT64 TickFreq;
-   MIL_INT DelayTickVal;
-   MIL_INT ProcessFrameCount;
-   MIL_INT EqualityCounter;
-   bool Error;
-   };
-
-struct PacketDelayResults
-   {
-   PacketDelayResults()
-      {
-      Selection = 0;
-      }
+/* Selection functions. */
+vector<MIL_STRING> SelectPixelFormats(const vector<MIL_STRING>& PixelFormats);
 
-   vector<MIL_STRING> PixelFormats;
-   vector<MIL_INT> InterPacketDelayInTicks;
-   vector<MIL_DOUBLE> InterPacketDelayInSec;
-   vector<MIL_DOUBLE> ReferenceFrameRate;
-   vector<MIL_DOUBLE> ObtainedFrameRate;
-   unsigned long Selection;
-   };
-
-/* Utility functions. */
-void EnumeratePixelFormats(MIL_ID MilDigitizer, MIL_INT BoardType, PacketDelayResults& Results);
-void ApplyPixelFormat(MIL_ID MilDigitizer, PacketDelayResults& Results);
-void AllocateAcquisitionBuffers(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType);
-void AcquireReferenceFrameRate(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results);
-void FindInterPacketDelay(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results);
-void PrintResults(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results);
-void GetMilBufferInfoFromPixelFormat(MIL_ID MilDigitizer, MIL_INT& SizeBand,
-                                     MIL_INT& BufType, MIL_INT64& Attribute);
-bool IsEqual(MIL_DOUBLE A, MIL_DOUBLE B)
-   {
-   if(((A+0.1) >= B) && ((A-0.1) <= B))
-      return true;
-   else
-      return false;
-   }
+/* Configuration functions. */
+PacketDelaySettings GetConfiguredSettings();
 
 /* Main function. */
 /* -------------- */
@@ -111,33 +44,34 @@ int MosMain(void)
    MIL_ID MilApplication;
    MIL_ID MilSystem     ;
    MIL_ID MilDigitizer  ;
-   MIL_INT BoardType = 0;
-   MIL_UINT NbIterations = 0, i = 0;
-   PacketDelayInfo PktInfo;
-   PacketDelayResults Results;
+   PacketDelaySettings Settings = GetConfiguredSettings();
+
+   /* Replaying a timing trace or reading a frame log does not use a camera. */
+   if(TRACE_MODE == TRACE_MODE_REPLAY)
+      return ReplayTrace(GetTunerFileName(TRACE_FILE, RECORDING_SERIAL_NUMBER).c_str(), Settings);
+   if(FRAME_LOG_MODE == FRAME_LOG_MODE_READ)
+      return ReadFrameLog(GetTunerFileName(FRAME_LOG_FILE, RECORDING_SERIAL_NUMBER).c_str());
 
    /* Allocate defaults. */
    MappAllocDefault(M_DEFAULT, &MilApplication, &MilSystem, M_NULL,
       &MilDigitizer, M_NULL);
    
-   /* Inquire board type. */
-   MsysInquire(MilSystem, M_BOARD_TYPE, &BoardType);
-
-   /* This example only runs on gige vision systems. */
-   if((BoardType != M_GIGE_VISION))
+   /* The tuner checks the camera and holds the state of its calibration. */
+   Tuner PktTuner(MilSystem, MilDigitizer);
+   PktTuner.SetSettings(Settings);
+   if(!PktTuner.Open())
       {
-      MosPrintf(MIL_TEXT("This example only runs on GigE Vision systems.\n"));   
+      /* Release defaults. */
       MappFreeDefault(MilApplication, MilSystem, M_NULL, MilDigitizer, M_NULL);
       return 0;
       }
 
-   /* Inquire the camera's clock tick frequency. */
-   MdigInquire(MilDigitizer, M_GC_COUNTER_TICK_FREQUENCY, &PktInfo.TickFreq);
-   if(PktInfo.TickFreq == 0)
+   /* Optionally, answer the delay queries of other processes instead. */
+   if(CALIBRATION_SERVICE)
       {
-      MosPrintf(MIL_TEXT("Error, camera does not support inter-packet delay.\n"));
-      
-      /* Release defaults. */
+      PktTuner.RunCalibrationService();
+
+      PktTuner.Close();
       MappFreeDefault(MilApplication, MilSystem, M_NULL, MilDigitizer, M_NULL);
       return 0;
       }
@@ -151,380 +85,165 @@ int MosMain(void)
    MosPrintf(MIL_TEXT("Press <Enter> to continue.\n\n\n"));
    MosGetch();
 
-   /* Print the camera's pixel formats and wait for user selections. */
-   EnumeratePixelFormats(MilDigitizer, BoardType, Results);
-   if(Results.Selection == Results.PixelFormats.size())
-      {
-      NbIterations = Results.PixelFormats.size();
-      Results.Selection = 0;
-      }
-   else
-      NbIterations = 1;
-   
-   /* Iterate through the user's selected pixel formats. */
-   while(NbIterations--)
+   /* Optionally, stress all the cameras of the system at once instead. */
+   if(CONTENTION_TEST)
       {
-      memset(&PktInfo, 0, sizeof(PacketDelayInfo));
-      
-      /* Inquire the camera's clock frequency so we can convert clock ticks to seconds. */
-      MdigInquire(MilDigitizer, M_GC_COUNTER_TICK_FREQUENCY, &PktInfo.TickFreq);
-
-      /* Apply the next pixel format for calculation. */
-      ApplyPixelFormat(MilDigitizer, Results);
-      
-      /* Allocate grab buffers matching the camera's pixel format. */
-      AllocateAcquisitionBuffers(MilSystem, MilDigitizer, BoardType);
-
-      /* Print a message. */
-      MosPrintf(MIL_TEXT("\n\nCalculating inter-packet delay for %s.\n\n"), Results.PixelFormats[Results.Selection].c_str());
-      
-      /* Get the reference frame rate. */
-      AcquireReferenceFrameRate(MilDigitizer, PktInfo, Results);
-
-      /* With the reference frame rate found, find the optimal inter-packet delay. */
-      FindInterPacketDelay(MilDigitizer, PktInfo, Results);
-
-      /* Free the grab buffers. */
-      while(MilGrabBufferListSize > 0)
-         MbufFree(MilGrabBufferList[--MilGrabBufferListSize]);
-      
-      Results.Selection++;
-      }
-
-   /* Print results. */
-   PrintResults(MilDigitizer, PktInfo, Results);
-   MosPrintf(MIL_TEXT("Press <Enter> to quit.\n\n\n"));
-   MosGetch();
-   
-   /* Reset inter-packet delay to zero. */
-   MdigControl(MilDigitizer, M_GC_INTER_PACKET_DELAY, 0);
-
-   /* Release defaults. */
-   MappFreeDefault(MilApplication, MilSystem, M_NULL, MilDigitizer, M_NULL);
-
-   return 0;
-   }
+      PktTuner.RunContentionTest();
+      MosPrintf(MIL_TEXT("Press <Enter> to quit.\n\n\n"));
+      MosGetch();
 
-/* Enumerate the camera's pixel formats. Only MIL compatible formats are printed. */
-/* ------------------------------------------------------------------------------ */
-void EnumeratePixelFormats(MIL_ID MilDigitizer, MIL_INT BoardType, PacketDelayResults& Results)
-   {
-   long SpreadFactor = 0;
-   MIL_INT64 PixFmt = 0;
-   Results.Selection = -1;
-   MIL_INT Count = 0;
-   
-   /* Inquire the number of pixel formats supported by the camera. */
-   MdigInquireFeature(MilDigitizer, M_FEATURE_ENUM_ENTRY_COUNT, MIL_TEXT("PixelFormat"), M_TYPE_MIL_INT, &Count);
-   if(Count)
-      {
-      bool Done = false;
-      Results.InterPacketDelayInTicks.assign(Count, 0);
-      Results.InterPacketDelayInSec.assign(Count, 0.0);
-      Results.ReferenceFrameRate.assign(Count, 0.0);
-      Results.ObtainedFrameRate.assign(Count, 0.0);
-
-      MosPrintf(MIL_TEXT("Your camera supports the following pixel formats:\n"));
-      for (MIL_INT i = 0; i < Count; i++)
-         {
-         MIL_INT64 AccessMode = 0;
-         /* Get the nth pixel format's string length. . */
-         /* Get the nth pixel format's name and numerical value. */
-         MIL_STRING PixelFormat;
-         MdigInquireFeature(MilDigitizer, M_FEATURE_ENUM_ENTRY_NAME + i, MIL_TEXT("PixelFormat"), M_TYPE_STRING, PixelFormat);
-         MdigInquireFeature(MilDigitizer, M_FEATURE_ENUM_ENTRY_VALUE + i, MIL_TEXT("PixelFormat"), M_TYPE_INT64, &PixFmt);
-         MdigInquireFeature(MilDigitizer, M_FEATURE_ENUM_ENTRY_ACCESS_MODE + i, MIL_TEXT("PixelFormat"), M_TYPE_INT64, &AccessMode);
-
-         /* Validate that the pixel format is compatible with MIL. */
-         if (M_FEATURE_IS_AVAILABLE(AccessMode) && (PixFmt & PFNC_CUSTOM) != PFNC_CUSTOM)
-            {
-            MIL_INT SizeBand = 0, BufType = 0;
-            MIL_INT64 Attribute = 0;
-            
-            MappControl(M_ERROR, M_PRINT_DISABLE);
-            MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("PixelFormat"), M_TYPE_STRING, PixelFormat);
-            GetMilBufferInfoFromPixelFormat(MilDigitizer, SizeBand, BufType, Attribute);
-
-            if(SizeBand && BufType && Attribute)
-               {
-               Results.PixelFormats.push_back(PixelFormat);
-               MosPrintf(MIL_TEXT("%d %s\n"), (int)(Results.PixelFormats.size() - 1), PixelFormat.c_str());
-               }
-            MappControl(M_ERROR, M_PRINT_ENABLE);
-            }
-         }
-
-      /* Add an entry so the user can perform calculations on All pixel formats. */
-      if(Results.PixelFormats.size() > 1)
-         MosPrintf(MIL_TEXT("%d All\n"), (int)Results.PixelFormats.size());
-      
-      /* Wait for user selection. */
-      if(Results.PixelFormats.size() > 1)
-         {
-         do
-            {
-            MosPrintf(MIL_TEXT("\nPlease select the pixel format that you want use for inter-packet delay\n"));
-            MosPrintf(MIL_TEXT("calculation (0-%d): "), (int)Results.PixelFormats.size());
-#if M_MIL_USE_WINDOWS
-            scanf_s("%d-", &(Results.Selection));
-#else
-            scanf("%ld-", &(Results.Selection));
-#endif
-            if(Results.Selection >= 0 && Results.Selection <= Results.PixelFormats.size())
-               Done = true;
-            else
-               MosPrintf(MIL_TEXT("Invalid selection, please try again\n."));
-            }
-         while(!Done);
-
-         MosPrintf(MIL_TEXT("\n%s selected\n\n"),
-            Results.Selection < Results.PixelFormats.size() ? Results.PixelFormats[Results.Selection].c_str() : MIL_TEXT("All"));
-         }
-      else
-         Results.Selection = 0;
-      }
-   }
-
-/* Set the camera's pixel format to the next value. */
-/* ------------------------------------------------ */
-void ApplyPixelFormat(MIL_ID MilDigitizer, PacketDelayResults& Results)
-   {
-   MIL_INT64 AccessMode = 0;
-
-   /* Wait for PixelFormat to become writable before writing. */
-   MdigInquireFeature(MilDigitizer, M_FEATURE_ACCESS_MODE, MIL_TEXT("PixelFormat"), M_TYPE_INT64, &AccessMode);
-   while (M_FEATURE_IS_WRITABLE(AccessMode) == M_FALSE)
-      {
-      MdigInquireFeature(MilDigitizer, M_FEATURE_ACCESS_MODE, MIL_TEXT("PixelFormat"), M_TYPE_INT64, &AccessMode);
-      MosSleep(250);
+      PktTuner.Close();
+      MappFreeDefault(MilApplication, MilSystem, M_NULL, MilDigitizer, M_NULL);
+      return 0;
       }
 
-   MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("PixelFormat"), M_TYPE_STRING, Results.PixelFormats[Results.Selection]);
-   }
+   /* Optionally, record the timing of every acquisition sequence and log every frame. */
+   PktTuner.OpenRecordings();
 
-/* Allocate acquisition buffers compatible with the camera's pixel format. */
-/* ----------------------------------------------------------------------- */
-void AllocateAcquisitionBuffers(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType)
-   {
-   MIL_INT SizeBand = 1;
-   MIL_INT BufType = 8+M_UNSIGNED;
-   MIL_INT64 AdditionalAttributes = 0;
-
-   /* On the M_GIGE_VISION system, turn off the pixel-format switching feature. */
-   /* Also turn off the automatic Bayer conversion feature. */
-   /* We must also allocate grab buffers that are of the same format as the camera. */
-   if(BoardType == M_GIGE_VISION)
+   /* Print the camera's pixel formats and wait for user selections. */
+   vector<MIL_STRING> PixelFormats = PktTuner.GetPixelFormats();
+   if(PixelFormats.empty())
       {
-      MdigControl(MilDigitizer, M_GC_PIXEL_FORMAT_SWITCHING, M_DISABLE);
-      MdigControl(MilDigitizer, M_BAYER_CONVERSION, M_DISABLE);
-      GetMilBufferInfoFromPixelFormat(MilDigitizer, SizeBand, BufType, AdditionalAttributes);
-      }
+      MosPrintf(MIL_TEXT("Error, camera has no pixel format supported by MIL.\n"));
 
-   /* Allocate the grab buffers and clear them. */
-   MappControl(M_DEFAULT, M_ERROR, M_PRINT_DISABLE);
-   for(MilGrabBufferListSize = 0; 
-      MilGrabBufferListSize<BUFFERING_SIZE_MAX; MilGrabBufferListSize++)
-      {
-      MbufAllocColor(MilSystem,
-         SizeBand,
-         MdigInquire(MilDigitizer, M_SIZE_X, M_NULL),
-         MdigInquire(MilDigitizer, M_SIZE_Y, M_NULL),
-         BufType,
-         M_IMAGE+M_GRAB+M_PROC+AdditionalAttributes,
-         &MilGrabBufferList[MilGrabBufferListSize]);
-
-      if (MilGrabBufferList[MilGrabBufferListSize])
-         {
-         MbufClear(MilGrabBufferList[MilGrabBufferListSize], 0xFF);
-         }
-      else
-         break;
+      PktTuner.Close();
+      MappFreeDefault(MilApplication, MilSystem, M_NULL, MilDigitizer, M_NULL);
+      return 0;
       }
-   MappControl(M_DEFAULT, M_ERROR, M_PRINT_ENABLE);
-   }
-
-/* Use MdigProcess to acquire a reference frame rate with the inter-packet delay to zero. */
-/* -------------------------------------------------------------------------------------- */
-void AcquireReferenceFrameRate(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results)
-   {
-   /* Set initial inter-packet delay to zero; this is to measure the base frame rate of the
-      camera. */
-   MdigControl(MilDigitizer, M_GC_INTER_PACKET_DELAY, 0);
+   PktTuner.SelectPixelFormats(SelectPixelFormats(PixelFormats));
 
-   /* Start the MdigProcess; here we want to record a base frame rate that
-      will be used for our calculations later. */
-   MdigProcess(MilDigitizer, MilGrabBufferList, MilGrabBufferListSize,
-      M_SEQUENCE+M_COUNT(BUFFERING_SIZE_MAX), M_DEFAULT, ProcessingFunction, M_NULL);
+   /* Calculate the inter-packet delay of the selected pixel formats. */
+   PktTuner.Calibrate();
 
-   MdigProcess(MilDigitizer, MilGrabBufferList, MilGrabBufferListSize,
-      M_STOP, M_DEFAULT, ProcessingFunction, M_NULL);
+   /* Print results. */
+   PktTuner.PrintResults();
+   MosPrintf(MIL_TEXT("Press <Enter> to quit.\n\n\n"));
+   MosGetch();
 
-   /* Inquire the reference frame rate. */
-   MdigInquire(MilDigitizer, M_PROCESS_FRAME_RATE, &Info.BaseFrameRate);
-   Results.ReferenceFrameRate[Results.Selection] = Info.BaseFrameRate;
+   /* Reset inter-packet delay to zero and restore the camera's test pattern. */
+   PktTuner.Close();
 
-   /* With the frame-rate estimated, inquire the theoretical inter-packet delay to use. */
-   MdigInquire(MilDigitizer, M_GC_THEORETICAL_INTER_PACKET_DELAY, &Info.DelayInSeconds);
+   /* Release defaults. */
+   MappFreeDefault(MilApplication, MilSystem, M_NULL, MilDigitizer, M_NULL);
 
-   /* Convert the delay from seconds to camera ticks. */
-   Info.DelayTickVal = (MIL_UINT32)(Info.DelayInSeconds * Info.TickFreq);
+   return 0;
    }
 
-/* Iteratively find a solution that maximizes the inter-packet delay without      */
-/* disturbing the frame-rate of the camera.                                       */
-/* ------------------------------------------------------------------------------ */
-void FindInterPacketDelay(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results)
+/* Print the camera's pixel formats and wait for the user's selection, either one of */
+/* them or all of them.                                                              */
+/* --------------------------------------------------------------------------------- */
+vector<MIL_STRING> SelectPixelFormats(const vector<MIL_STRING>& PixelFormats)
    {
+   unsigned long Selection = 0;
    bool Done = false;
 
-#if PRINT_DETAILS
-   MosPrintf(MIL_TEXT("Reference frame-rate used: %.2f\n\n"), Info.BaseFrameRate);
-#endif
+   MosPrintf(MIL_TEXT("Your camera supports the following pixel formats:\n"));
+   for(size_t i = 0; i < PixelFormats.size(); i++)
+      MosPrintf(MIL_TEXT("%d %s\n"), (int)i, PixelFormats[i].c_str());
 
-   while(!Done)
+   /* Add an entry so the user can perform calculations on All pixel formats. */
+   if(PixelFormats.size() <= 1)
+      return PixelFormats;
+   MosPrintf(MIL_TEXT("%d All\n"), (int)PixelFormats.size());
+   
+   /* Wait for user selection. */
+   do
       {
-      /* Set the delay in the camera. Initially this delay corresponds to the value
-         returned by MdigInquire with M_GC_THEORETICAL_INTER_PACKET_DELAY. */
-      MdigControl(MilDigitizer, M_GC_INTER_PACKET_DELAY, Info.DelayTickVal);
-
-      /* Start acquisition. */
-      MdigProcess(MilDigitizer, MilGrabBufferList, MilGrabBufferListSize,
-         M_SEQUENCE+M_COUNT(BUFFERING_SIZE_MAX), M_DEFAULT, ProcessingFunction, M_NULL);
-
-      /* Inquire the obtained frame rate with the current inter-packet delay. */
-      MdigInquire(MilDigitizer, M_PROCESS_FRAME_RATE,  &Info.ProcessFrameRate);
-
-      /* Stop acquisition. */
-      MdigProcess(MilDigitizer, MilGrabBufferList, MilGrabBufferListSize,
-         M_STOP, M_DEFAULT, ProcessingFunction, M_NULL);
-
-#if PRINT_DETAILS
-      MosPrintf(MIL_TEXT("%Programming delay of %d ticks; frame-rate obtained: %.2f\r"),
-         (int)Info.DelayTickVal, Info.ProcessFrameRate);
+      MosPrintf(MIL_TEXT("\nPlease select the pixel format that you want use for inter-packet delay\n"));
+      MosPrintf(MIL_TEXT("calculation (0-%d): "), (int)PixelFormats.size());
+#if M_MIL_USE_WINDOWS
+      scanf_s("%d-", &Selection);
 #else
-      MosPrintf(MIL_TEXT("."));
+      scanf("%ld-", &Selection);
 #endif
-
-      /* Validate if obtained frame rate matches reference frame rate. If it does not,
-         reduce the inter packet delay and try another iteration. */
-      if(IsEqual(Info.BaseFrameRate, Info.ProcessFrameRate))
-         {
-         /* Frame rate inquired is equal to the base frame rate; we are converging on
-            the solution. */
-         Info.EqualityCounter++;
-
-         if(Info.DelayTickVal == 0)
-            {
-            Info.DelayInSeconds = 0.0;
-            Info.Error = true;
-            Done = true;
-            }
-         else if(Info.EqualityCounter == 3)
-            {
-            Done = true;
-            /* Found optimal solution, remove an additional 15%. */
-            Info.DelayInSeconds -= (Info.DelayInSeconds * 15.0 / 100.0);
-            if(Info.DelayInSeconds <= 0.0)
-               Info.DelayInSeconds = 0.0;
-
-            Info.DelayTickVal = (MIL_UINT32)(Info.DelayInSeconds * Info.TickFreq);
-            MdigControl(MilDigitizer, M_GC_INTER_PACKET_DELAY, Info.DelayTickVal);
-            }
-         else
-            {
-            /* Reduce delay for next iteration. */
-            Info.DelayInSeconds -= (Info.DelayInSeconds / 50.0);
-            Info.DelayTickVal = (MIL_UINT32)(Info.DelayInSeconds * Info.TickFreq);
-            }
-         }
+      if(Selection <= PixelFormats.size())
+         Done = true;
       else
-         {
-         /* We are still far from the reference frame rate, reduce delay for next
-            iteration. */
-         Info.EqualityCounter = 0;
-         Info.DelayInSeconds -= (Info.DelayInSeconds / 10.0);
-         Info.DelayTickVal = (MIL_UINT32)(Info.DelayInSeconds * Info.TickFreq);
-         if(Info.DelayTickVal == 0)
-            {
-            Info.DelayInSeconds = 0.0;
-            Info.Error = true;
-            Done = true;
-            }
-         else if(Info.DelayInSeconds <= 0.0)
-            {
-            Info.DelayInSeconds = 0.0;
-            Done = true;
-            }
-         }
-      
-      MosSleep(500);
+         MosPrintf(MIL_TEXT("Invalid selection, please try again\n."));
       }
+   while(!Done);
 
-   /* Store solution in Results struct. This will get printed at the end of the example. */
-   if(Info.Error == false)
-      {
-      Results.InterPacketDelayInTicks[Results.Selection] = Info.DelayTickVal;
-      Results.InterPacketDelayInSec[Results.Selection] = Info.DelayInSeconds;
-      Results.ObtainedFrameRate[Results.Selection] = Info.ProcessFrameRate;
-      }
-   }
-
-/* Print the results for each pixel format. */
-/* ---------------------------------------- */
-void PrintResults(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results)
-   {
-   MIL_STRING Model, Vendor;
-   MIL_INT PacketSize = 0;
-
-   /* Found optimal solution, print results. */
-   MdigInquire(MilDigitizer, M_CAMERA_VENDOR, Vendor);
-   MdigInquire(MilDigitizer, M_CAMERA_MODEL, Model);
-   MdigInquire(MilDigitizer, M_GC_PACKET_SIZE, &PacketSize);
+   MosPrintf(MIL_TEXT("\n%s selected\n\n"),
+      Selection < PixelFormats.size() ? PixelFormats[Selection].c_str() : MIL_TEXT("All"));
 
-#if M_MIL_USE_WINDOWS
-   system("cls");
-#endif
-   MosPrintf(MIL_TEXT("Inter-packet delay report summary for %s %s:\n\n"), Vendor.c_str(), Model.c_str());
-   MosPrintf(MIL_TEXT("Camera parameters:\n"));
-   MosPrintf(MIL_TEXT("Camera SizeX:         %lld\n"), (long long)(MdigInquire(MilDigitizer, M_SIZE_X, M_NULL)));
-   MosPrintf(MIL_TEXT("Camera SizeY:         %lld\n"), (long long)(MdigInquire(MilDigitizer, M_SIZE_Y, M_NULL)));
-   MosPrintf(MIL_TEXT("Camera Packet size:   %d\n\n"), (int)PacketSize);
-
-   for (size_t i = 0; i < Results.PixelFormats.size(); i++)
-      {
-      MosPrintf(MIL_TEXT("Camera Pixel format:  %s\n"), Results.PixelFormats[i].c_str());
-      MosPrintf(MIL_TEXT("Inter-packet delay of %d ticks (%.3f usec) calculated.\n"),
-         (int)Results.InterPacketDelayInTicks[i], Results.InterPacketDelayInSec[i]*1e6);
-      MosPrintf(MIL_TEXT("Reference frame rate: %.1f\n"), Results.ReferenceFrameRate[i]);
-      MosPrintf(MIL_TEXT("Obtained frame rate:  %.1f\n"), Results.ObtainedFrameRate[i]);
-      MosPrintf(MIL_TEXT("----------------------------------------------------------\n"));
-      }
-
-   MosPrintf(MIL_TEXT("\nPrinted inter-packet delay results are valid only for ")
-      MIL_TEXT("the above parameters\n"));
+   if(Selection < PixelFormats.size())
+      return vector<MIL_STRING>(1, PixelFormats[Selection]);
+   return PixelFormats;
    }
 
-/* User's processing function called every time a grab buffer is modified. */
-/* ----------------------------------------------------------------------- */
-MIL_INT MFTYPE ProcessingFunction(MIL_INT HookType,
-                                  MIL_ID HookId,
-                                  void* HookDataPtr)
-   {
-   MIL_ID ModifiedBufferId;
-
-   /* Retrieve the MIL_ID of the grabbed buffer. */
-   MdigGetHookInfo(HookId, M_MODIFIED_BUFFER+M_BUFFER_ID, &ModifiedBufferId);
-
-   return 0;
-   }
- 
-/* Get the MIL buffer attributes that matches the camera's pixel format. */
-/* --------------------------------------------------------------------- */
-void GetMilBufferInfoFromPixelFormat(MIL_ID MilDigitizer, MIL_INT& SizeBand,
-                                     MIL_INT& BufType, MIL_INT64& Attribute)
+/* Fill the tuner's options from the defines of PacketDelayConfig.h. */
+/* ----------------------------------------------------------------- */
+PacketDelaySettings GetConfiguredSettings()
    {
-   MdigInquire(MilDigitizer, M_SIZE_BAND, &SizeBand);
-   MdigInquire(MilDigitizer, M_TYPE, &BufType);
-   MdigInquire(MilDigitizer, M_SOURCE_DATA_FORMAT, &Attribute);
+   PacketDelaySettings Settings;
+
+   Settings.BufferingSizeMin = BUFFERING_SIZE_MIN;
+   Settings.BufferingSizeMax = BUFFERING_SIZE_MAX;
+   Settings.BufferingMemoryBudgetMB = BUFFERING_MEMORY_BUDGET_MB;
+   Settings.HookLatencyAllowanceMs = HOOK_LATENCY_ALLOWANCE_MS;
+
+   Settings.SequenceFrameCount = SEQUENCE_FRAME_COUNT;
+   Settings.TailIntervalLimit = TAIL_INTERVAL_LIMIT;
+   Settings.DelaySweep = (DELAY_SWEEP_MODE != 0);
+   Settings.DelaySweepMaxPoints = DELAY_SWEEP_MAX_POINTS;
+   Settings.DelaySweepCollapseRatio = DELAY_SWEEP_COLLAPSE_RATIO;
+   Settings.DelayCurveFilePrefix = DELAY_CURVE_FILE_PREFIX;
+
+   Settings.MissingPacketScan = (MISSING_PACKET_SCAN != 0);
+   Settings.PayloadVerification = PAYLOAD_VERIFICATION;
+
+   Settings.LinkSpeedMbps = LINK_SPEED_MBPS;
+   Settings.DefaultLinkSpeedMbps = DEFAULT_LINK_SPEED_MBPS;
+   Settings.NetworkInterfaceName = NETWORK_INTERFACE_NAME;
+
+   Settings.CalibrationMode = CALIBRATION_MODE;
+   Settings.BurstFrameCount = BURST_FRAME_COUNT;
+   Settings.BurstCount = BURST_COUNT;
+   Settings.BurstSoftwareTrigger = (BURST_SOFTWARE_TRIGGER != 0);
+   Settings.BurstIdleMs = BURST_IDLE_MS;
+   Settings.BurstTimeoutMs = BURST_TIMEOUT_MS;
+   Settings.CameraTimestampAtExposureStart = (CAMERA_TIMESTAMP_AT_EXPOSURE_START != 0);
+   Settings.TargetFrameRates = TARGET_FRAME_RATES;
+
+   Settings.BayesianSearch = (BAYESIAN_SEARCH != 0);
+   Settings.BayesianPriorFile = BAYESIAN_PRIOR_FILE;
+   Settings.BayesianPriorMinPoints = BAYESIAN_PRIOR_MIN_POINTS;
+   Settings.BayesianPriorMaxPoints = BAYESIAN_PRIOR_MAX_POINTS;
+   Settings.BayesianMaxAcquisitions = BAYESIAN_MAX_ACQUISITIONS;
+
+   Settings.Checkpoint = (CHECKPOINT != 0);
+   Settings.CheckpointFile = CHECKPOINT_FILE;
+   Settings.TimeBudgetSec = TIME_BUDGET_SEC;
+
+   Settings.RecordTrace = (TRACE_MODE == TRACE_MODE_RECORD);
+   Settings.TraceFile = TRACE_FILE;
+   Settings.TraceReplayRuns = TRACE_REPLAY_RUNS;
+   Settings.WriteFrameLog = (FRAME_LOG_MODE == FRAME_LOG_MODE_WRITE);
+   Settings.FrameLogFile = FRAME_LOG_FILE;
+   Settings.FrameLogCapacity = FRAME_LOG_CAPACITY;
+
+   Settings.ValidationDurationSec = VALIDATION_DURATION_SEC;
+   Settings.ValidationSnapshotSec = VALIDATION_SNAPSHOT_SEC;
+   Settings.ValidationSnapshotFile = VALIDATION_SNAPSHOT_FILE;
+   Settings.ValidationMaxLossRatio = VALIDATION_MAX_LOSS_RATIO;
+   Settings.ValidationMaxRateDrop = VALIDATION_MAX_RATE_DROP;
+   Settings.ValidationMaxJitterRatio = VALIDATION_MAX_JITTER_RATIO;
+
+   Settings.ContentionDurationSec = CONTENTION_DURATION_SEC;
+   Settings.SwitchTopology = SWITCH_TOPOLOGY;
+
+   Settings.StreamChannelCalibration = (STREAM_CHANNEL_CALIBRATION != 0);
+   Settings.StreamChannelValidationSec = STREAM_CHANNEL_VALIDATION_SEC;
+
+   Settings.HookThreadCpuList = HOOK_THREAD_CPU_LIST;
+   Settings.HookThreadRtPriority = HOOK_THREAD_RT_PRIORITY;
+
+   Settings.CalibrationServiceDir = CALIBRATION_SERVICE_DIR;
+   Settings.CalibrationServiceSocket = CALIBRATION_SERVICE_SOCKET;
+   Settings.CalibrationServiceGroup = CALIBRATION_SERVICE_GROUP;
+   Settings.CalibrationCacheFile = CALIBRATION_CACHE_FILE;
+   Settings.CalibrationServiceClients = CALIBRATION_SERVICE_CLIENTS;
+
+   Settings.PrintDetails = (PRINT_DETAILS != 0);
+   return Settings;
    }
- 
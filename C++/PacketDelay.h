@@ -0,0 +1,326 @@
+﻿/*************************************************************************************/
+/*
+* File name: PacketDelay.h
+*
+* Synopsis:  Interface of the packet delay library. A tuner calculates the
+*            inter-packet delays of one GigE Vision® camera, in the same process as
+*            the application that streams from it. Tuners of different digitizers
+*            can run in parallel threads of the same MIL application.
+*
+*      Note: The library is built as libpacketdelay.a and libpacketdelay.so; only
+*            the declarations of this file are exported. The tuner's state is
+*            private to the library, so its layout can change without breaking the
+*            applications built on this interface.
+*
+*            A calibration can run in a thread of its own with CalibrateAsync; the
+*            progress function then reports each acquisition, and Cancel stops the
+*            calibration before its next acquisition.
+*
+*            The tuner's options are given as PacketDelaySettings before it is opened;
+*            the PacketDelay example fills them from its PacketDelayConfig.h.
+*
+*            On Windows, the Visual Studio projects compile the library's sources into
+*            the example, so PACKET_DELAY_API exports nothing there.
+*
+* Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+* All Rights Reserved
+*/
+
+#ifndef PACKET_DELAY_H
+#define PACKET_DELAY_H
+
+#include <mil.h>
+#include <vector>
+#include <string>
+#include <future>
+
+/* Version of this interface. It is incremented when the interface changes in a way
+that requires the applications to be rebuilt.
+*/
+#define PACKET_DELAY_API_VERSION 3
+
+/* Symbols exported by the shared library. */
+#if M_MIL_USE_WINDOWS
+#define PACKET_DELAY_API
+#else
+#define PACKET_DELAY_API __attribute__((visibility("default")))
+#endif
+
+/* Calibration modes. CALIBRATION_MODE_FREE_RUN finds the largest delay that keeps the
+frame rate of the free-running camera, CALIBRATION_MODE_BURST the smallest delay at
+which triggered bursts are delivered without loss, and CALIBRATION_MODE_LATENCY the
+smallest delay at which the free-running camera delivers its frames without loss.
+*/
+#define CALIBRATION_MODE_FREE_RUN 0
+#define CALIBRATION_MODE_BURST    1
+#define CALIBRATION_MODE_LATENCY  2
+
+/* Verification of the payloads while the delays are searched: none, against the
+camera's first test pattern frame, or against a simulated ramp. */
+#define PAYLOAD_VERIFICATION_NONE      0
+#define PAYLOAD_VERIFICATION_CAMERA    1
+#define PAYLOAD_VERIFICATION_SIMULATED 2
+
+/* Options of a tuner. The defaults are those of the PacketDelay example, whose
+PacketDelayConfig.h describes each option under the name of its define. */
+struct PacketDelaySettings
+   {
+   PacketDelaySettings()
+      {
+      BufferingSizeMin = 4;
+      BufferingSizeMax = 512;
+      BufferingMemoryBudgetMB = 1024;
+      HookLatencyAllowanceMs = 20;
+      SequenceFrameCount = 20;
+      TailIntervalLimit = 0.0;
+      DelaySweep = false;
+      DelaySweepMaxPoints = 48;
+      DelaySweepCollapseRatio = 0.5;
+      DelayCurveFilePrefix = "PacketDelayCurve_";
+      MissingPacketScan = true;
+      LinkSpeedMbps = 0;
+      DefaultLinkSpeedMbps = 1000;
+      PayloadVerification = PAYLOAD_VERIFICATION_NONE;
+      CalibrationMode = CALIBRATION_MODE_FREE_RUN;
+      BurstFrameCount = 10;
+      BurstCount = 5;
+      BurstSoftwareTrigger = true;
+      BurstIdleMs = 100;
+      BurstTimeoutMs = 2000;
+      CameraTimestampAtExposureStart = true;
+      BayesianSearch = false;
+      BayesianPriorFile = "PacketDelayPrior.txt";
+      BayesianPriorMinPoints = 8;
+      BayesianPriorMaxPoints = 200;
+      BayesianMaxAcquisitions = 8;
+      Checkpoint = false;
+      CheckpointFile = "PacketDelayCheckpoint.txt";
+      TimeBudgetSec = 0;
+      RecordTrace = false;
+      TraceFile = "PacketDelayTrace.bin";
+      TraceReplayRuns = 100;
+      WriteFrameLog = false;
+      FrameLogFile = "PacketDelayFrames.log";
+      FrameLogCapacity = 16*1024*1024;
+      ValidationDurationSec = 0;
+      ValidationSnapshotSec = 60;
+      ValidationSnapshotFile = "PacketDelayValidation.csv";
+      ValidationMaxLossRatio = 0.0;
+      ValidationMaxRateDrop = 0.01;
+      ValidationMaxJitterRatio = 1.5;
+      ContentionDurationSec = 30;
+      PrintDetails = false;
+      HookThreadRtPriority = 0;
+      CalibrationServiceDir = "/tmp/PacketDelay";
+      CalibrationServiceSocket = "PacketDelay.sock";
+      CalibrationCacheFile = "PacketDelayCache.txt";
+      CalibrationServiceClients = 16;
+      StreamChannelCalibration = false;
+      StreamChannelValidationSec = 10;
+      }
+
+   /* Grab queue. */
+   MIL_INT BufferingSizeMin;
+   MIL_INT BufferingSizeMax;
+   MIL_INT BufferingMemoryBudgetMB;
+   MIL_INT HookLatencyAllowanceMs;
+
+   /* Frame rate measurements and the delay sweep. */
+   MIL_INT SequenceFrameCount;
+   MIL_DOUBLE TailIntervalLimit;
+   bool DelaySweep;
+   MIL_INT DelaySweepMaxPoints;
+   MIL_DOUBLE DelaySweepCollapseRatio;
+   std::string DelayCurveFilePrefix;
+
+   /* Frame checks; PayloadVerification is one of PAYLOAD_VERIFICATION_*. */
+   bool MissingPacketScan;
+   int PayloadVerification;
+
+   /* Link speed in Mbit/s; 0 reads it from the camera or the network interface. */
+   MIL_INT LinkSpeedMbps;
+   MIL_INT DefaultLinkSpeedMbps;
+   std::string NetworkInterfaceName;
+
+   /* Calibration mode, one of CALIBRATION_MODE_*, and the bursts of the burst mode. */
+   int CalibrationMode;
+   MIL_INT BurstFrameCount;
+   MIL_INT BurstCount;
+   bool BurstSoftwareTrigger;
+   MIL_INT BurstIdleMs;
+   MIL_INT BurstTimeoutMs;
+   bool CameraTimestampAtExposureStart;
+
+   /* Frame rates calibrated instead of the free-running one, e.g. "10,25". */
+   std::string TargetFrameRates;
+
+   /* Bayesian search. Its prior file is shared by the tuners of every camera. */
+   bool BayesianSearch;
+   std::string BayesianPriorFile;
+   MIL_INT BayesianPriorMinPoints;
+   MIL_INT BayesianPriorMaxPoints;
+   MIL_INT BayesianMaxAcquisitions;
+
+   /* Checkpoint and time budget; a budget of 0 leaves the run unbounded. */
+   bool Checkpoint;
+   std::string CheckpointFile;
+   MIL_INT TimeBudgetSec;
+
+   /* Recordings opened by OpenRecordings, and the replays of ReplayTrace. */
+   bool RecordTrace;
+   std::string TraceFile;
+   MIL_INT TraceReplayRuns;
+   bool WriteFrameLog;
+   std::string FrameLogFile;
+   MIL_UINT64 FrameLogCapacity;
+
+   /* Validation of the delays over a long run; a duration of 0 skips it. */
+   MIL_INT ValidationDurationSec;
+   MIL_INT ValidationSnapshotSec;
+   std::string ValidationSnapshotFile;
+   MIL_DOUBLE ValidationMaxLossRatio;
+   MIL_DOUBLE ValidationMaxRateDrop;
+   MIL_DOUBLE ValidationMaxJitterRatio;
+
+   /* Contention test and the switches between the cameras and the host. */
+   MIL_INT ContentionDurationSec;
+   std::string SwitchTopology;
+
+   /* Stream channels; a validation of 0 seconds skips it. */
+   bool StreamChannelCalibration;
+   MIL_INT StreamChannelValidationSec;
+
+   /* Placement of the MdigProcess hook thread, e.g. "2,3" or "4-7". */
+   std::string HookThreadCpuList;
+   int HookThreadRtPriority;
+
+   /* Calibration service (Linux only). */
+   std::string CalibrationServiceDir;
+   std::string CalibrationServiceSocket;
+   std::string CalibrationServiceGroup;
+   std::string CalibrationCacheFile;
+   MIL_INT CalibrationServiceClients;
+
+   bool PrintDetails;
+   };
+
+/* Calibration result of one pixel format. */
+struct PacketDelayFormatResult
+   {
+   PacketDelayFormatResult()
+      {
+      DelayTickVal = 0;
+      DelayInSeconds = 0;
+      ReferenceFrameRate = 0;
+      ObtainedFrameRate = 0;
+      ThroughputLimit = 0;
+      Calibrated = false;
+      }
+
+   MIL_STRING PixelFormat;
+   MIL_INT DelayTickVal;
+   MIL_DOUBLE DelayInSeconds;
+   MIL_DOUBLE ReferenceFrameRate;
+   MIL_DOUBLE ObtainedFrameRate;
+
+   /* DeviceLinkThroughputLimit equivalent to the delay, in bytes per second, for the
+      cameras without an inter-packet delay; 0 otherwise. */
+   MIL_INT64 ThroughputLimit;
+
+   /* False when the calibration was cancelled before the pixel format completed. */
+   bool Calibrated;
+   };
+
+/* Progress of a calibration, reported after each acquisition. The iteration counts
+the acquisitions of the pixel format, including the reference one. */
+struct PacketDelayProgress
+   {
+   PacketDelayProgress()
+      {
+      FormatIndex = 0;
+      NbFormats = 0;
+      Iteration = 0;
+      DelayTickVal = 0;
+      FrameRate = 0;
+      }
+
+   MIL_STRING PixelFormat;
+   MIL_INT FormatIndex;
+   MIL_INT NbFormats;
+   MIL_INT Iteration;
+   MIL_INT DelayTickVal;
+   MIL_DOUBLE FrameRate;
+   };
+
+/* Progress function, called from the calibrating thread. */
+typedef void (*PacketDelayProgressFunction)(const PacketDelayProgress& Progress, void* UserDataPtr);
+
+struct TunerState;
+
+/* Calibration of one camera. The tuner owns everything a calibration changes: the
+grab queue, the hook data, the search state and the results. */
+class PACKET_DELAY_API Tuner
+   {
+   public:
+      Tuner(MIL_ID MilSystem, MIL_ID MilDigitizer);
+      ~Tuner();
+
+      /* Options of the tuner; they are set before it is opened. */
+      void SetSettings(const PacketDelaySettings& Settings);
+      const PacketDelaySettings& GetSettings() const;
+
+      /* Check the camera and prepare its bandwidth control and hook placement. */
+      bool Open();
+
+      /* Open the timing trace and the frame log, when configured. */
+      void OpenRecordings();
+
+      /* Enumerate the camera's pixel formats supported by MIL. */
+      std::vector<MIL_STRING> GetPixelFormats();
+
+      /* Select the pixel formats to calibrate; none selects the current one. */
+      void SelectPixelFormats(const std::vector<MIL_STRING>& PixelFormats);
+
+      /* Report the progress of the calibrations to the function. */
+      void SetProgressFunction(PacketDelayProgressFunction ProgressFunction, void* UserDataPtr);
+
+      /* Calibrate the selected pixel formats; false when cancelled. */
+      bool Calibrate();
+
+      /* Calibrate in a thread of its own. The tuner must not be used, except to
+         cancel, until the future holds the value of Calibrate. */
+      std::future<bool> CalibrateAsync();
+
+      /* Stop the calibration before its next acquisition; from any thread. */
+      void Cancel();
+
+      /* Results of the selected pixel formats, and their printed report. */
+      std::vector<PacketDelayFormatResult> GetResults() const;
+      void PrintResults();
+
+      /* Other modes of the camera instead of the calibration. */
+      void RunCalibrationService();
+      void RunContentionTest();
+
+      /* Restore the camera's bandwidth control, test pattern and frame rate. */
+      void Close();
+
+   private:
+      /* Not copyable; the state is owned by the tuner. */
+      Tuner(const Tuner&);
+      Tuner& operator=(const Tuner&);
+
+      TunerState* State;
+   };
+
+/* Analysis of the files recorded by a tuner; they do not use a camera. ReplayTrace
+replays the iterative search only, with the given settings. */
+PACKET_DELAY_API int ReplayTrace(const char* FileName, const PacketDelaySettings& Settings);
+PACKET_DELAY_API int ReadFrameLog(const char* FileName);
+
+/* Name of the file a tuner records to: the configured name with the camera's serial
+number inserted before the extension, so the tuners of several cameras do not write to
+the same file. */
+PACKET_DELAY_API std::string GetTunerFileName(const char* FileName, const char* SerialNumber);
+
+#endif
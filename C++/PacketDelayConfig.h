@@ -0,0 +1,277 @@
+﻿/*************************************************************************************/
+/*
+* File name: PacketDelayConfig.h
+*
+* Synopsis:  Configuration of the PacketDelay example. It selects the example's mode,
+*            and the example passes the other options to the tuner as
+*            PacketDelaySettings. The packet delay library does not include it.
+*
+* Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+* All Rights Reserved
+*/
+
+#ifndef PACKET_DELAY_CONFIG_H
+#define PACKET_DELAY_CONFIG_H
+
+/* Bounds of the number of images in the buffering grab queue. The actual number is
+sized for each pixel format from the measured frame period, the worst-case hook latency
+and the memory budget below.
+*/
+#define BUFFERING_SIZE_MIN 4
+#define BUFFERING_SIZE_MAX 512
+
+/* Memory budget of the buffering grab queue, in MB. */
+#define BUFFERING_MEMORY_BUDGET_MB 1024
+
+/* Hook latency to absorb on top of the measured worst case, in msec. Increase it to
+cover the processing time of the production application's own hook.
+*/
+#define HOOK_LATENCY_ALLOWANCE_MS 20
+
+/* Number of frames grabbed by each MdigProcess sequence used to measure a frame rate. */
+#define SEQUENCE_FRAME_COUNT 20
+
+/* Maximum ratio between the p99.9 inter-frame interval obtained with a delay and the
+median interval of the reference acquisition for the delay to be accepted. Set to 0 to
+only compare the average frame rates. Note that p99.9 is only meaningful when
+SEQUENCE_FRAME_COUNT is large enough; with short sequences it is the maximum interval.
+*/
+#define TAIL_INTERVAL_LIMIT 0.0
+
+/* Set this define to 1 to sample the whole delay versus throughput curve of each pixel
+format, from zero to the delay at which the frame rate collapses. Samples are denser
+near the knees of the curve. Each curve is exported in a columnar text file named
+DELAY_CURVE_FILE_PREFIX followed by the pixel format.
+*/
+#define DELAY_SWEEP_MODE           0
+#define DELAY_SWEEP_MAX_POINTS     48
+#define DELAY_SWEEP_COLLAPSE_RATIO 0.5
+#define DELAY_CURVE_FILE_PREFIX    "PacketDelayCurve_"
+
+/* Set this define to 1 to scan each grabbed buffer for packets that were not written.
+Grab buffers are filled with the 0xFF sentinel; a packet-sized run of sentinel bytes
+aligned on a packet boundary is reported as a missing packet, and the received packets
+are filled again before the buffer is returned to the grab queue. Note that saturated
+image regions of a whole packet also read as sentinel. */
+#define MISSING_PACKET_SCAN  1
+
+/* Line rate of the camera's link, in Mbit/s. It gives the wire time of the packets,
+used to correct the theoretical delay for multi-gigabit links, to size the smallest
+useful delay step and in the bandwidth computations. Set it to 0 to read it from the
+camera's GevLinkSpeed or DeviceLinkSpeed feature, or on Linux from
+NETWORK_INTERFACE_NAME; DEFAULT_LINK_SPEED_MBPS is used if both are unknown.
+*/
+#define LINK_SPEED_MBPS         0
+#define DEFAULT_LINK_SPEED_MBPS 1000
+
+/* Verification of the payload of every grabbed frame while the delays are searched.
+With PAYLOAD_VERIFICATION_CAMERA, the camera's GenICam TestPattern is enabled and the
+first frame of the reference acquisition becomes the expected frame. With
+PAYLOAD_VERIFICATION_SIMULATED, the camera's (or simulated device's)
+GreyHorizontalRamp pattern is enabled and compared with a ramp incrementing by one
+per pixel. A delay is only accepted if all its frames are bit-exact.
+*/
+#define PAYLOAD_VERIFICATION PAYLOAD_VERIFICATION_NONE
+
+/* Calibration mode. CALIBRATION_MODE_FREE_RUN finds the largest delay that keeps the
+frame rate of the free-running camera. CALIBRATION_MODE_BURST triggers bursts of
+BURST_FRAME_COUNT frames and finds the smallest delay, i.e. the shortest burst delivery,
+at which BURST_COUNT bursts are delivered without loss. With BURST_SOFTWARE_TRIGGER set
+to 0, the camera's trigger configuration is left untouched and the bursts are expected
+from an external trigger; the delivery time is then measured from the first frame.
+CALIBRATION_MODE_LATENCY finds the smallest delay at which the free-running camera
+delivers its frames without loss, and reports the distribution of the latency from the
+end of exposure to the completion of the buffer, using the camera's timestamps. The
+percentiles of each delay are computed from the SEQUENCE_FRAME_COUNT frames of its
+sequence, so the p99 of a sequence of 100 frames is close to its maximum.
+*/
+#define CALIBRATION_MODE CALIBRATION_MODE_FREE_RUN
+
+#define BURST_FRAME_COUNT      10
+#define BURST_COUNT            5
+#define BURST_SOFTWARE_TRIGGER 1
+#define BURST_IDLE_MS          100
+#define BURST_TIMEOUT_MS       2000
+
+/* Frame rates, in frames per second and separated by commas (e.g. "10,25"), at which
+the delay is calibrated instead of the camera's free-running frame rate. Each rate is
+applied through the camera's AcquisitionFrameRate feature, and the delay found is the
+largest that keeps that rate. Leave empty to calibrate at the free-running frame rate.
+Target frame rates are calibrated on the first stream channel only.
+*/
+#define TARGET_FRAME_RATES ""
+
+/* Set this define to 1 if the camera timestamps the start of exposure, 0 if it
+timestamps the end of exposure. It is used to compute the latencies.
+*/
+#define CAMERA_TIMESTAMP_AT_EXPOSURE_START 1
+
+/* Set this define to 1 to search the delay with Bayesian optimization. A Gaussian
+process models the frame rate (relative to the reference, minus lost frames) as a
+function of the delay (relative to the theoretical delay), and each acquisition is
+made at the delay of highest feasibility-weighted gain: the gain over the largest delay
+found to keep the frame rate, times the probability that the frame rate is kept. The
+process is seeded with the observations stored in BAYESIAN_PRIOR_FILE for the same
+camera model, so calibrating another unit of a known model takes only a few
+acquisitions. Without enough prior observations, the iterative search is used and its
+observations are stored for the next units. The file keeps the most recent
+BAYESIAN_PRIOR_MAX_POINTS observations of each model, one per configuration and delay.
+It is shared by the tuners of every camera, which lock it while they update it.
+*/
+#define BAYESIAN_SEARCH              0
+#define BAYESIAN_PRIOR_FILE          "PacketDelayPrior.txt"
+#define BAYESIAN_PRIOR_MIN_POINTS    8
+#define BAYESIAN_PRIOR_MAX_POINTS    200
+#define BAYESIAN_MAX_ACQUISITIONS    8
+
+/* Set this define to 1 to checkpoint the calibration in CHECKPOINT_FILE after every
+pixel format, every iteration of the delay search and every point of the delay sweep.
+A run interrupted by e.g. a camera disconnect resumes from the checkpoint of the same
+camera: finished pixel formats are skipped, the iterative free-running search continues
+from its last iteration and the sweep reuses the points already measured. Other
+searches of an unfinished pixel format restart. The checkpoint is removed when the run
+completes.
+*/
+#define CHECKPOINT      0
+#define CHECKPOINT_FILE "PacketDelayCheckpoint.txt"
+
+/* Wall-clock budget, in seconds, of a run calibrating all the pixel formats; 0 leaves
+the run unbounded. With a budget, a scheduler first makes a coarse pass on every pixel
+format (reference, theoretical delay and one bracketing delay), then spends the rest
+of the budget bisecting the delay of the format with the widest uncertainty. When the
+budget runs out, each format reports its best delay so far with the bounds of the
+optimal delay. Only the free-running search is scheduled, and no checkpoint is written.
+*/
+#define TIME_BUDGET_SEC 0
+
+/* Timing traces. In record mode, every acquisition sequence (delay, frame rate, loss
+counters and per-frame host and camera times) is appended to TRACE_FILE. In replay
+mode, no camera is used: the iterative search runs TRACE_REPLAY_RUNS times on each
+pixel format of the trace, each sequence being replaced by a recorded one at the
+nearest delay. Successive requests for the same delay cycle through its recorded
+sequences, so the replay is deterministic. Each sequence is recorded with its pixel
+format, so a trace recorded with a time budget, whose formats are measured in turn,
+replays each format from its own sequences. Only the iterative search is replayed: the
+Bayesian search, the latency and burst modes and the time budget are not, and a trace
+recorded with them is replayed with the iterative search.
+*/
+#define TRACE_MODE_NONE    0
+#define TRACE_MODE_RECORD  1
+#define TRACE_MODE_REPLAY  2
+#define TRACE_MODE         TRACE_MODE_NONE
+#define TRACE_FILE         "PacketDelayTrace.bin"
+#define TRACE_REPLAY_RUNS  100
+
+/* Frame log for long measurements. In write mode, the hook appends a fixed-size record
+per frame (host and camera times, delay in effect, missing packets, digitizer and
+status) to FRAME_LOG_FILE, a memory-mapped file holding up to FRAME_LOG_CAPACITY
+records; an existing log is appended to unless it is truncated, and frames beyond its
+capacity are counted but not logged. In read mode, no camera is used: the log is
+scanned and summarized per delay, the intervals being taken per digitizer.
+*/
+#define FRAME_LOG_MODE_NONE  0
+#define FRAME_LOG_MODE_WRITE 1
+#define FRAME_LOG_MODE_READ  2
+#define FRAME_LOG_MODE       FRAME_LOG_MODE_NONE
+#define FRAME_LOG_FILE       "PacketDelayFrames.log"
+#define FRAME_LOG_CAPACITY   (16*1024*1024)
+
+/* The files written for one camera (CHECKPOINT_FILE, TRACE_FILE, FRAME_LOG_FILE and
+VALIDATION_SNAPSHOT_FILE) are named with the camera's serial number before their
+extension, e.g. PacketDelayTrace_<serial>.bin, so tuners calibrating several cameras
+at once do not write to the same files. Set RECORDING_SERIAL_NUMBER to the serial
+number of the camera whose trace is replayed or whose frame log is read.
+*/
+#define RECORDING_SERIAL_NUMBER ""
+
+/* Validation of the calculated delay over a long run. With a duration, MdigProcess
+streams at the delay of each pixel format for VALIDATION_DURATION_SEC after it is
+calculated, keeping its statistics online in constant memory. Every
+VALIDATION_SNAPSHOT_SEC, a snapshot of the period is printed and appended to
+VALIDATION_SNAPSHOT_FILE. The delay passes if at most VALIDATION_MAX_LOSS_RATIO of
+the frames are lost or damaged, the frame rate of every full period after the first
+is within VALIDATION_MAX_RATE_DROP of the reference (the whole run's rate without such
+a period), and the 99.9th percentile of the inter-frame intervals is within
+VALIDATION_MAX_JITTER_RATIO of the frame period.
+*/
+#define VALIDATION_DURATION_SEC     0
+#define VALIDATION_SNAPSHOT_SEC     60
+#define VALIDATION_SNAPSHOT_FILE    "PacketDelayValidation.csv"
+#define VALIDATION_MAX_LOSS_RATIO   0.0
+#define VALIDATION_MAX_RATE_DROP    0.01
+#define VALIDATION_MAX_JITTER_RATIO 1.5
+
+/* Aggregate contention test. Instead of calibrating the selected pixel formats, every
+camera of the system is calibrated alone at its current pixel format, then all of them
+stream at their delay at the same time for CONTENTION_DURATION_SEC. A camera degrades
+under contention if it loses frames or if its frame rate drops by more than
+VALIDATION_MAX_RATE_DROP from the one obtained alone.
+*/
+#define CONTENTION_TEST         0
+#define CONTENTION_DURATION_SEC 30
+
+/* Switches between the cameras and the host, used by the contention test. Each switch
+is given as cameras:buffer_bytes:uplink_mbps, separated by ';' (for example
+"4:131072:1000;2:262144:10000"); the cameras are assigned to the switches in device
+order. The cameras of a switch then stream at least at the delay that keeps the
+worst-case occupancy of the uplink port's buffer under its size, and the predicted
+occupancy is compared with the losses measured.
+*/
+#define SWITCH_TOPOLOGY ""
+
+/* Set this define to 1 to print additional details performed by this example. */
+#define PRINT_DETAILS      0
+
+/* Comma-separated list of CPU cores (e.g. "2,3" or "4-7") on which the MdigProcess
+hook thread is pinned. Leave empty to keep the operating system's placement.
+*/
+#define HOOK_THREAD_CPU_LIST     ""
+
+/* Real-time priority of the MdigProcess hook thread. On Linux, a value from 1 to 99
+selects the SCHED_FIFO policy with that priority (requires CAP_SYS_NICE). On Windows,
+any non-zero value selects THREAD_PRIORITY_TIME_CRITICAL. Set to 0 to keep the default
+scheduling.
+*/
+#define HOOK_THREAD_RT_PRIORITY  0
+
+/* Name of the host network interface connected to the camera (e.g. "eth1"). On Linux,
+it is used to report the NUMA node that services the NIC. Leave empty if unknown.
+*/
+#define NETWORK_INTERFACE_NAME   ""
+
+/* Set this define to 1 to run the example as a local calibration service (Linux only).
+Client processes connect to the Unix domain socket below and send one query per line:
+   QUERY <serial number> <pixel format> <offset x> <offset y> <width> <height> <packet size>
+The service answers from its cache with
+   DELAY <ticks> <usec> <frame rate>
+or, on a cache miss, queues a calibration of the attached camera and answers
+   QUEUED <position in queue>
+so the client can use its own delay and query again later. STATUS returns the number
+of cached entries and queued calibrations. Successful calibrations are appended to
+CALIBRATION_CACHE_FILE, which is read back when the service starts; a failed one is
+attempted again on the next query. The camera's configuration is restored after each
+calibration.
+The socket is created in CALIBRATION_SERVICE_DIR, a directory private to the service's
+user. Set CALIBRATION_SERVICE_GROUP to the name of a group to also let its members
+connect; otherwise only the service's user can.
+*/
+#define CALIBRATION_SERVICE         0
+#define CALIBRATION_SERVICE_DIR     "/tmp/PacketDelay"
+#define CALIBRATION_SERVICE_SOCKET  "PacketDelay.sock"
+#define CALIBRATION_SERVICE_GROUP   ""
+#define CALIBRATION_CACHE_FILE      "PacketDelayCache.txt"
+#define CALIBRATION_SERVICE_CLIENTS 16
+
+/* Set to 1 to calibrate each stream channel of a multi-channel device (e.g. a
+multi-sensor head, or a 3D camera streaming range and intensity). Each channel is
+calibrated alone on its own digitizer, then the delays are raised where needed so the
+channels' combined peak rate stays within the link speed while each channel keeps its
+frame rate. A channel whose share of the link would need a delay longer than its frame
+period allows is reported infeasible and keeps its calibrated delay. The combined
+delays are then validated by streaming all the channels at once for
+STREAM_CHANNEL_VALIDATION_SEC seconds; set it to 0 to skip the validation.
+*/
+#define STREAM_CHANNEL_CALIBRATION    0
+#define STREAM_CHANNEL_VALIDATION_SEC 10
+
+#endif
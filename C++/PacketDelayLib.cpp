@@ -0,0 +1,7287 @@
+﻿/*************************************************************************************/
+/*
+* File name: PacketDelayLib.cpp
+*
+* Synopsis:  Packet delay library. It enumerates the pixel formats of a GigE Vision®
+*            camera, manages the grab buffers, measures the reference frame rate,
+*            searches the inter-packet delay and reports the results. Its interface is
+*            the Tuner class of PacketDelay.h; PacketDelay.cpp is its example.
+*
+*      Note: The inter-packet delay is initially set to zero. A reference frame rate
+*            is then sampled and used for subsequent calculations. The algorithm then
+*            proceeds and calculates a theoretical inter-packet delay for the current 
+*            camera parameters (SizeX, SizeY, PacketSize, PixelFormat). This theoretical
+*            delay is used as a starting point. At this point acquisition is re-started
+*            and the obtained frame-rate is compared to the reference frame-rate.
+*            Modifications to the theoretical inter-packet delay are then performed when
+*            needed. This process repeats iteratively until the obtained frame rate
+*            converges to the reference frame rate. If the reference frame rate initially
+*            sampled is off, then the algorithm will not converge to the solution.
+*
+* Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+* All Rights Reserved
+*/
+
+#include <mil.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if M_MIL_USE_WINDOWS
+#include <conio.h>
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <grp.h>
+#endif
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <future>
+#include "PacketDelay.h"
+
+/* SSE2 and AVX2 versions of the missing packet scan are built on x86 targets and
+selected at run time; other targets use the scalar version. */
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SENTINEL_SCAN_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define SENTINEL_SCAN_X86 0
+#endif
+
+#if defined(__GNUC__)
+#define SIMD_TARGET_SSE2 __attribute__((target("sse2")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SIMD_TARGET_SSE2
+#define SIMD_TARGET_AVX2
+#endif
+
+using namespace std;
+
+/* Progress of a pixel format in the checkpoint. */
+#define FORMAT_STATE_PENDING    0
+#define FORMAT_STATE_SEARCH     1
+#define FORMAT_STATE_SWEEP      2
+#define FORMAT_STATE_CALIBRATED 3
+#define FORMAT_STATE_DONE       4
+
+/* Size of the IP and UDP headers, and of the GVSP header, included in M_GC_PACKET_SIZE.
+The GVSP header grows to GVSP_EXTENDED_HEADER_SIZE when the camera uses the extended ID
+mode of GigE Vision 2.0 (GevGVSPExtendedIDMode). */
+#define GVSP_IP_UDP_HEADER_SIZE   28
+#define GVSP_HEADER_SIZE          8
+#define GVSP_EXTENDED_HEADER_SIZE 20
+
+/* Ethernet framing (preamble, MAC header, CRC and inter-frame gap) added to each packet
+on the wire, and the link speed assumed by the camera's theoretical delay. */
+#define ETHERNET_FRAME_OVERHEAD 38
+#define GIGABIT_LINK_SPEED_MBPS 1000
+
+/* Cameras without an inter-packet delay (no counter tick frequency) are calibrated
+through their DeviceLinkThroughputLimit feature instead. The search still works on a
+delay, in ticks of THROUGHPUT_LIMIT_TICK_FREQ, applied as the throughput limit that
+gives the same packet period on the wire.
+*/
+#define THROUGHPUT_LIMIT_TICK_FREQ 1000000000
+
+/* Instruction sets used by the frame checks. */
+#define SIMD_LEVEL_SCALAR 0
+#define SIMD_LEVEL_SSE2   1
+#define SIMD_LEVEL_AVX2   2
+
+/* Capacity of the grab queue; the settings' BufferingSizeMax is bounded by it. */
+#define GRAB_BUFFER_LIST_CAPACITY 512
+
+/* Source of a pixel format's link speed, as stored in the checkpoint. */
+#define LINK_SPEED_SOURCE_DEFAULT    0
+#define LINK_SPEED_SOURCE_CONFIGURED 1
+#define LINK_SPEED_SOURCE_CAMERA     2
+#define LINK_SPEED_SOURCE_HOST       3
+
+/* User's processing function prototype. */
+MIL_INT MFTYPE ProcessingFunction(MIL_INT HookType,
+                                  MIL_ID HookId,
+                                  void* HookDataPtr);
+
+/* Struct and variable definitions/declarations. */
+/* Fixed-bucket histogram of inter-frame intervals, in usec. Values below 32 usec have
+their own bucket; above, each power of two is split in 32 buckets (about 3% resolution).
+It never allocates, so it can be updated from the hook.
+*/
+#define INTERVAL_HISTOGRAM_SUB_BITS 5
+#define INTERVAL_HISTOGRAM_SIZE     1024
+
+/* Function returning true if all bytes of a block are equal to the 0xFF sentinel. */
+typedef bool (*SentinelScanFunction)(const MIL_UINT8* Data, size_t Size);
+
+/* Function returning the number of bytes that differ between two blocks. */
+typedef MIL_INT (*PayloadCompareFunction)(const MIL_UINT8* Data, const MIL_UINT8* Expected, size_t Size);
+
+struct IntervalHistogram
+   {
+   IntervalHistogram()
+      {
+      memset(Counts, 0, sizeof(Counts));
+      Count = 0;
+      MaxInterval = 0;
+      Sum = 0;
+      SumOfSquares = 0;
+      }
+   MIL_UINT32 Counts[INTERVAL_HISTOGRAM_SIZE];
+   MIL_UINT64 Count;
+   MIL_DOUBLE MaxInterval;
+   MIL_DOUBLE Sum;
+   MIL_DOUBLE SumOfSquares;
+   };
+
+/* Frame rate, loss and inter-frame interval statistics (in seconds) of one
+acquisition sequence. */
+struct SequenceSummary
+   {
+   SequenceSummary()
+      {
+      DelayTickVal = 0;
+      FrameRate = 0;
+      FramesMissed = 0;
+      FramesCorrupted = 0;
+      FramesIncomplete = 0;
+      PacketsMissing = 0;
+      PayloadFramesCorrupted = 0;
+      PayloadBytesCorrupted = 0;
+      FramesNotDelivered = 0;
+      BurstTime = 0;
+      BurstTimeMax = 0;
+      LatencyMean = 0;
+      LatencyP50 = 0;
+      LatencyP99 = 0;
+      LatencyMax = 0;
+      TransferP50 = 0;
+      TransferP99 = 0;
+      TransferMax = 0;
+      SpreadRatio = 0;
+      Mean = 0;
+      StdDev = 0;
+      P50 = 0;
+      P99 = 0;
+      P999 = 0;
+      Max = 0;
+      }
+   MIL_INT DelayTickVal;
+   MIL_DOUBLE FrameRate;
+   MIL_INT FramesMissed;
+   MIL_INT FramesCorrupted;
+   MIL_INT FramesIncomplete;
+   MIL_INT PacketsMissing;
+   MIL_INT PayloadFramesCorrupted;
+   MIL_INT64 PayloadBytesCorrupted;
+   MIL_INT FramesNotDelivered;
+   MIL_DOUBLE BurstTime;
+   MIL_DOUBLE BurstTimeMax;
+   MIL_DOUBLE LatencyMean;
+   MIL_DOUBLE LatencyP50;
+   MIL_DOUBLE LatencyP99;
+   MIL_DOUBLE LatencyMax;
+   MIL_DOUBLE TransferP50;
+   MIL_DOUBLE TransferP99;
+   MIL_DOUBLE TransferMax;
+   MIL_DOUBLE SpreadRatio;
+   MIL_DOUBLE Mean;
+   MIL_DOUBLE StdDev;
+   MIL_DOUBLE P50;
+   MIL_DOUBLE P99;
+   MIL_DOUBLE P999;
+   MIL_DOUBLE Max;
+   };
+
+struct PacketDelayInfo
+   {
+   PacketDelayInfo()
+      {
+      BaseFrameRate = 0;
+      ProcessFrameRate = 0;
+      DelayInSeconds = 0;
+      TickFreq = 0;
+      DelayTickVal = 0;
+      ProcessFrameCount = 0;
+      EqualityCounter = 0;
+      CorruptedDelayTickVal = -1;
+      Error = false;
+      }
+   MIL_DOUBLE BaseFrameRate;
+   MIL_DOUBLE ProcessFrameRate;
+   MIL_DOUBLE DelayInSeconds;
+   MIL_UINT64 TickFreq;
+   MIL_INT DelayTickVal;
+   MIL_INT ProcessFrameCount;
+   MIL_INT EqualityCounter;
+   MIL_INT CorruptedDelayTickVal;
+   bool Error;
+   SequenceSummary ReferenceIntervals;
+   vector<SequenceSummary> Measurements;
+   };
+
+/* Placement of the MdigProcess hook thread; applied from the hook itself. */
+struct HookThreadPlacement
+   {
+   HookThreadPlacement()
+      {
+      RtPriority = 0;
+      Configured = false;
+      AffinityError = 0;
+      PriorityError = 0;
+      ObservedCpu = -1;
+      }
+   vector<int> CpuList;
+   int RtPriority;
+   bool Configured;
+   int AffinityError;
+   int PriorityError;
+   int ObservedCpu;
+   };
+
+/* Layout of the frame log: a 64-byte header followed by Capacity records of 40 bytes.
+Writers reserve a record by incrementing NbReserved, fill it, then set its Committed
+flag; readers ignore the records that are not committed. The mapped structures hold
+atomics; the log is read back into the plain structures of the same layout. */
+#define FRAME_LOG_MAGIC             "PDFRAMES"
+#define FRAME_STATUS_FIRST          0x0001
+#define FRAME_STATUS_INCOMPLETE     0x0002
+#define FRAME_STATUS_CORRUPTED      0x0004
+
+struct FrameLogHeader
+   {
+   char Magic[8];
+   MIL_UINT32 RecordSize;
+   MIL_UINT32 Reserved;
+   MIL_UINT64 Capacity;
+   atomic<MIL_UINT64> NbReserved;
+   MIL_UINT64 Padding[4];
+   };
+
+struct FrameLogHeaderData
+   {
+   char Magic[8];
+   MIL_UINT32 RecordSize;
+   MIL_UINT32 Reserved;
+   MIL_UINT64 Capacity;
+   MIL_UINT64 NbReserved;
+   MIL_UINT64 Padding[4];
+   };
+
+/* Digitizer identifies the digitizer that grabbed the frame, so the intervals are
+taken between the frames of the same digitizer. */
+struct FrameLogRecord
+   {
+   MIL_DOUBLE HostTime;
+   MIL_INT64 CameraTime;
+   MIL_INT32 DelayTickVal;
+   MIL_UINT32 FrameIndex;
+   MIL_UINT32 PacketsMissing;
+   MIL_UINT32 Digitizer;
+   MIL_UINT32 Reserved;
+   MIL_UINT16 Status;
+   atomic<MIL_UINT16> Committed;
+   };
+
+struct FrameLogRecordData
+   {
+   MIL_DOUBLE HostTime;
+   MIL_INT64 CameraTime;
+   MIL_INT32 DelayTickVal;
+   MIL_UINT32 FrameIndex;
+   MIL_UINT32 PacketsMissing;
+   MIL_UINT32 Digitizer;
+   MIL_UINT32 Reserved;
+   MIL_UINT16 Status;
+   MIL_UINT16 Committed;
+   };
+
+/* The atomics are shared by the processes mapping the log, which requires them to be
+lock-free; the plain structures must have the layout of the mapped ones. */
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_SHORT_LOCK_FREE == 2,
+              "The frame log requires lock-free 64-bit and 16-bit atomics.");
+static_assert(sizeof(FrameLogHeader) == 64 && sizeof(FrameLogHeaderData) == sizeof(FrameLogHeader),
+              "The frame log header must be 64 bytes.");
+static_assert(sizeof(FrameLogRecord) == 40 && sizeof(FrameLogRecordData) == sizeof(FrameLogRecord),
+              "The frame log records must be 40 bytes.");
+
+/* Mapping of a frame log file. */
+struct FrameLogFile
+   {
+   FrameLogFile()
+      {
+      Header = NULL;
+      Records = NULL;
+      MappedSize = 0;
+      NbDropped = 0;
+#if M_MIL_USE_WINDOWS
+      File = INVALID_HANDLE_VALUE;
+      Mapping = NULL;
+#else
+      File = -1;
+#endif
+      }
+
+   FrameLogHeader* Header;
+   FrameLogRecord* Records;
+   size_t MappedSize;
+   atomic<MIL_UINT64> NbDropped;
+#if M_MIL_USE_WINDOWS
+   HANDLE File;
+   HANDLE Mapping;
+#else
+   int File;
+#endif
+   };
+
+/* Methods used to align the camera's timestamp counter with the host's clock. */
+#define CLOCK_ALIGNMENT_NONE     0
+#define CLOCK_ALIGNMENT_LATCH    1
+#define CLOCK_ALIGNMENT_ARRIVALS 2
+
+/* Simultaneous readings of the camera's timestamp counter and the host's MappTimer
+clock, in seconds. */
+struct ClockSample
+   {
+   ClockSample(MIL_DOUBLE CameraTime = 0, MIL_DOUBLE HostTime = 0)
+      : CameraTime(CameraTime), HostTime(HostTime)
+      {
+      }
+
+   MIL_DOUBLE CameraTime;
+   MIL_DOUBLE HostTime;
+   };
+
+/* Relation between the camera's timestamp counter and the host's clock:
+host time = HostReference + (camera time - CameraReference) * Rate. Rate - 1 is the
+drift of the camera's clock. With CLOCK_ALIGNMENT_LATCH, the relation is regressed over
+latched timestamps. With CLOCK_ALIGNMENT_ARRIVALS, it is the lower envelope of the
+frame arrivals, so the latencies are relative to the fastest frame.
+*/
+struct ClockAlignment
+   {
+   ClockAlignment()
+      {
+      Method = CLOCK_ALIGNMENT_NONE;
+      CameraReference = 0;
+      HostReference = 0;
+      Rate = 1.0;
+      Residual = 0;
+      NbSamples = 0;
+      }
+
+   int Method;
+   MIL_DOUBLE CameraReference;
+   MIL_DOUBLE HostReference;
+   MIL_DOUBLE Rate;
+   MIL_DOUBLE Residual;
+   MIL_INT NbSamples;
+   };
+
+/* Scheduled search of one pixel format. The optimal delay, the largest that keeps the
+frame rate, lies between the lower and upper bounds; the upper bound is -1 until a
+delay is found to reduce the frame rate.
+*/
+struct FormatSchedule
+   {
+   FormatSchedule()
+      {
+      TheoreticalTickVal = 0;
+      LowerTickVal = 0;
+      UpperTickVal = -1;
+      MinTickStep = 1;
+      AcquisitionTime = 0;
+      Converged = false;
+      ExpectedFrameValid = false;
+      }
+
+   PacketDelayInfo Info;
+   MIL_INT TheoreticalTickVal;
+   MIL_INT LowerTickVal;
+   MIL_INT UpperTickVal;
+   MIL_INT MinTickStep;
+   MIL_DOUBLE AcquisitionTime;
+   bool Converged;
+   vector<MIL_UINT8> ExpectedFrame;
+   bool ExpectedFrameValid;
+   };
+
+/* Calibration at one target frame rate. The applied frame rate is the one the camera
+set; it is not accepted if it differs from the target by more than the camera's
+rounding.
+*/
+struct TargetRateInfo
+   {
+   TargetRateInfo()
+      {
+      TargetFrameRate = 0;
+      AppliedFrameRate = 0;
+      ReferenceFrameRate = 0;
+      ObtainedFrameRate = 0;
+      DelayTickVal = 0;
+      DelayInSeconds = 0;
+      Accepted = false;
+      Error = false;
+      }
+
+   MIL_DOUBLE TargetFrameRate;
+   MIL_DOUBLE AppliedFrameRate;
+   MIL_DOUBLE ReferenceFrameRate;
+   MIL_DOUBLE ObtainedFrameRate;
+   MIL_INT DelayTickVal;
+   MIL_DOUBLE DelayInSeconds;
+   bool Accepted;
+   bool Error;
+   };
+
+/* Calibration of one stream channel. The share delay spreads the channel's packets so
+it uses its share of the link, in proportion to its average bandwidth. The combined
+delay is the larger of the calibrated and share delays, unless the share delay exceeds
+the largest delay that still transfers a frame within the frame period; the channel
+is then infeasible and keeps its calibrated delay. The validation streams all the
+channels at once at their combined delays.
+*/
+struct StreamChannelInfo
+   {
+   StreamChannelInfo()
+      {
+      Channel = 0;
+      Calibrated = false;
+      TickFreq = 0;
+      PacketSize = 0;
+      PacketsPerFrame = 0;
+      PacketWireTime = 0;
+      LinkSpeedMbps = 0;
+      FrameRate = 0;
+      DelayTickVal = 0;
+      ShareDelayTickVal = 0;
+      CombinedDelayTickVal = 0;
+      MaxDelayTickVal = 0;
+      LinkShare = 0;
+      Feasible = true;
+      Validated = false;
+      ValidatedFrameRate = 0;
+      FramesLost = 0;
+      }
+
+   MIL_INT Channel;
+   bool Calibrated;
+   MIL_UINT64 TickFreq;
+   MIL_INT PacketSize;
+   MIL_INT PacketsPerFrame;
+   MIL_DOUBLE PacketWireTime;
+   MIL_INT LinkSpeedMbps;
+   MIL_DOUBLE FrameRate;
+   MIL_INT DelayTickVal;
+   MIL_INT ShareDelayTickVal;
+   MIL_INT CombinedDelayTickVal;
+   MIL_INT MaxDelayTickVal;
+   MIL_DOUBLE LinkShare;
+   bool Feasible;
+   bool Validated;
+   MIL_DOUBLE ValidatedFrameRate;
+   MIL_INT FramesLost;
+   };
+
+/* Running mean, variance and range of a value (Welford's algorithm). */
+struct OnlineStats
+   {
+   OnlineStats()
+      {
+      Count = 0;
+      Mean = 0;
+      M2 = 0;
+      Min = 0;
+      Max = 0;
+      }
+   MIL_UINT64 Count;
+   MIL_DOUBLE Mean;
+   MIL_DOUBLE M2;
+   MIL_DOUBLE Min;
+   MIL_DOUBLE Max;
+   };
+
+/* Statistics of a validation run, updated by the hook. The period statistics are
+those since the last snapshot. The lock is only held to update or copy them. */
+struct ValidationStats
+   {
+   ValidationStats()
+      {
+      NbFrames = 0;
+      NbIncomplete = 0;
+      PacketsMissing = 0;
+      NbPayloadCorrupted = 0;
+      PeriodFrames = 0;
+      PreviousFrameTime = 0;
+      }
+   mutex Lock;
+   IntervalHistogram Intervals;
+   IntervalHistogram PeriodIntervals;
+   OnlineStats IntervalStats;
+   MIL_UINT64 NbFrames;
+   MIL_UINT64 NbIncomplete;
+   MIL_UINT64 PacketsMissing;
+   MIL_UINT64 NbPayloadCorrupted;
+   MIL_UINT64 PeriodFrames;
+   MIL_DOUBLE PreviousFrameTime;
+   };
+
+/* Outcome of the validation of a pixel format's delay. */
+struct ValidationResult
+   {
+   ValidationResult()
+      {
+      Validated = false;
+      Passed = false;
+      Duration = 0;
+      NbFrames = 0;
+      FramesMissed = 0;
+      FramesCorrupted = 0;
+      NbIncomplete = 0;
+      NbPayloadCorrupted = 0;
+      LossRatio = 0;
+      FrameRate = 0;
+      MinFrameRate = 0;
+      IntervalMean = 0;
+      IntervalStdDev = 0;
+      IntervalP999 = 0;
+      IntervalMax = 0;
+      NbSnapshots = 0;
+      }
+   bool Validated;
+   bool Passed;
+   MIL_DOUBLE Duration;
+   MIL_UINT64 NbFrames;
+   MIL_INT FramesMissed;
+   MIL_INT FramesCorrupted;
+   MIL_UINT64 NbIncomplete;
+   MIL_UINT64 NbPayloadCorrupted;
+   MIL_DOUBLE LossRatio;
+   MIL_DOUBLE FrameRate;
+   MIL_DOUBLE MinFrameRate;
+   MIL_DOUBLE IntervalMean;
+   MIL_DOUBLE IntervalStdDev;
+   MIL_DOUBLE IntervalP999;
+   MIL_DOUBLE IntervalMax;
+   MIL_INT NbSnapshots;
+   };
+
+/* Records of the binary timing trace. The file starts with TRACE_FILE_MAGIC; each
+record is a type and a size followed by its content. A format record follows the
+reference sequence of its pixel format; a window record is followed by NbFrames
+frame records. Both carry the index of their pixel format, since the windows of the
+formats interleave under a time budget. Unknown records are skipped. */
+#define TRACE_FILE_MAGIC    "PDTRACE2"
+#define TRACE_RECORD_FORMAT 1
+#define TRACE_RECORD_WINDOW 2
+
+struct TraceRecordHeader
+   {
+   MIL_UINT32 Type;
+   MIL_UINT32 Size;
+   };
+
+struct TraceFormatRecord
+   {
+   MIL_INT64 FormatIndex;
+   char PixelFormat[64];
+   MIL_DOUBLE TickFreq;
+   MIL_DOUBLE PacketWireTime;
+   MIL_INT64 LinkSpeedMbps;
+   MIL_INT64 PacketsPerFrame;
+   MIL_INT64 TheoreticalTickVal;
+   MIL_INT64 PayloadVerified;
+   };
+
+struct TraceWindowRecord
+   {
+   MIL_INT64 FormatIndex;
+   MIL_INT64 DelayTickVal;
+   MIL_DOUBLE FrameRate;
+   MIL_INT64 FrameCount;
+   MIL_INT64 FramesMissed;
+   MIL_INT64 FramesCorrupted;
+   MIL_INT64 FramesIncomplete;
+   MIL_INT64 PacketsMissing;
+   MIL_INT64 PayloadFramesChecked;
+   MIL_INT64 PayloadFramesCorrupted;
+   MIL_INT64 PayloadBytesCorrupted;
+   MIL_DOUBLE MaxHookDuration;
+   MIL_INT64 NbFrames;
+   };
+
+struct TraceFrameRecord
+   {
+   MIL_DOUBLE HostTime;
+   MIL_INT64 CameraTime;
+   };
+
+struct TraceWindow
+   {
+   TraceWindowRecord Record;
+   vector<TraceFrameRecord> Frames;
+   };
+
+/* Pixel format of a trace being replayed. The windows of each delay are replayed in
+turn, starting over after the last one. */
+struct TraceFormat
+   {
+   TraceFormat()
+      {
+      memset(&Format, 0, sizeof(Format));
+      NbRequests = 0;
+      NbInexactRequests = 0;
+      }
+
+   TraceFormatRecord Format;
+   vector<TraceWindow> Windows;
+   map<MIL_INT64, vector<size_t> > WindowsByDelay;
+   map<MIL_INT64, size_t> NextWindow;
+   MIL_INT NbRequests;
+   MIL_INT NbInexactRequests;
+   };
+
+struct CalibrationControl;
+
+/* Data passed to the processing function by MdigProcess. */
+struct HookDataStruct
+   {
+   HookDataStruct()
+      {
+      Settings = NULL;
+      Placement = M_NULL;
+      FrameCount = 0;
+      PreviousFrameTime = 0;
+      MaxFrameInterval = 0;
+      MaxHookDuration = 0;
+      FramesMissed = 0;
+      FramesCorrupted = 0;
+      IsSentinel = M_NULL;
+      PacketPayloadSize = 0;
+      PacketsPerFrame = 0;
+      FrameSizeByte = 0;
+      RowSizeByte = 0;
+      PitchByte = 0;
+      FramesIncomplete = 0;
+      PacketsMissing = 0;
+      VerifyPayloads = false;
+      PayloadCompare = M_NULL;
+      ExpectedFrameValid = false;
+      PayloadFramesChecked = 0;
+      PayloadFramesCorrupted = 0;
+      PayloadBytesCorrupted = 0;
+      BurstArmed = false;
+      BurstFrames = 0;
+      BurstFirstTime = 0;
+      BurstLastTime = 0;
+      CameraTickFreq = 0;
+      ExposureTime = 0;
+      PacketWireTime = 0;
+      LinkSpeedMbps = GIGABIT_LINK_SPEED_MBPS;
+      FixedLatency = -1;
+      DelayTickVal = 0;
+      TraceFile = NULL;
+      Replay = NULL;
+      FrameLog = NULL;
+      FrameLogDigitizer = 0;
+      Validation = NULL;
+      ThroughputControl = false;
+      ThroughputLimitMin = 0;
+      ThroughputLimitMax = 0;
+      ReferenceFrameRate = 0;
+      GrabBufferListSize = 0;
+      for(MIL_INT i = 0; i < GRAB_BUFFER_LIST_CAPACITY; i++)
+         GrabBufferList[i] = M_NULL;
+      Control = NULL;
+      Cancelled = false;
+      Probing = false;
+      }
+   const PacketDelaySettings* Settings;
+   HookThreadPlacement* Placement;
+   MIL_INT FrameCount;
+   MIL_DOUBLE PreviousFrameTime;
+   MIL_DOUBLE MaxFrameInterval;
+   MIL_DOUBLE MaxHookDuration;
+   IntervalHistogram Intervals;
+   MIL_INT FramesMissed;
+   MIL_INT FramesCorrupted;
+
+   /* Missing packet scan. The maps hold one entry per packet, set to 1 when the
+      packet is missing. */
+   SentinelScanFunction IsSentinel;
+   MIL_INT PacketPayloadSize;
+   MIL_INT PacketsPerFrame;
+   MIL_INT FrameSizeByte;
+   MIL_INT RowSizeByte;
+   MIL_INT PitchByte;
+   vector<MIL_UINT8> MissingPacketMap;
+   vector<MIL_UINT8> LastIncompleteMap;
+   MIL_INT FramesIncomplete;
+   MIL_INT PacketsMissing;
+
+   /* Payload verification, enabled when the camera sends a static test pattern. The
+      expected frame holds FrameSizeByte bytes, without line padding. */
+   bool VerifyPayloads;
+   PayloadCompareFunction PayloadCompare;
+   vector<MIL_UINT8> ExpectedFrame;
+   bool ExpectedFrameValid;
+   MIL_INT PayloadFramesChecked;
+   MIL_INT PayloadFramesCorrupted;
+   MIL_INT64 PayloadBytesCorrupted;
+
+   /* Burst acquisitions. The main thread arms a burst; the hook then counts its frames
+      and records the arrival times of its first and last frames. The frame count is
+      published after the times, so the main thread reads a completed snapshot even if
+      a late frame arrives. */
+   atomic<bool> BurstArmed;
+   atomic<MIL_INT> BurstFrames;
+   atomic<MIL_DOUBLE> BurstFirstTime;
+   atomic<MIL_DOUBLE> BurstLastTime;
+
+   /* Latency measurement. The hook records the host time and camera timestamp of each
+      frame of the sequence; the vectors are empty when latencies are not measured. */
+   vector<MIL_DOUBLE> HostTimes;
+   vector<MIL_INT64> CameraTimes;
+   MIL_UINT64 CameraTickFreq;
+   MIL_DOUBLE ExposureTime;
+   ClockAlignment Alignment;
+   vector<ClockSample> LatchSamples;
+   vector<ClockSample> ArrivalSamples;
+
+   /* On-wire transfer estimate. The fixed latency is the part of the latency spent in
+      the camera before the first packet leaves, measured without delay; it is negative
+      until measured. */
+   MIL_DOUBLE PacketWireTime;
+   MIL_INT LinkSpeedMbps;
+   MIL_DOUBLE FixedLatency;
+
+   /* Timing traces. The delay is the one last set in the camera. The hook records the
+      host time of each frame in FrameTimes while a trace is recorded; when replaying,
+      the sequences come from the replayed pixel format instead of the camera. */
+   MIL_INT DelayTickVal;
+   FILE* TraceFile;
+   vector<MIL_DOUBLE> FrameTimes;
+   TraceFormat* Replay;
+
+   /* Frame log of long measurements, written by the hook; NULL when not logging. */
+   FrameLogFile* FrameLog;
+   MIL_UINT32 FrameLogDigitizer;
+
+   /* Statistics of a validation run; NULL outside of one. */
+   ValidationStats* Validation;
+
+   /* Bandwidth control through DeviceLinkThroughputLimit, in bytes per second. The
+      reference frame rate gives the theoretical delay. */
+   bool ThroughputControl;
+   MIL_INT64 ThroughputLimitMin;
+   MIL_INT64 ThroughputLimitMax;
+   MIL_DOUBLE ReferenceFrameRate;
+
+   /* Grab queue of the acquisitions. */
+   MIL_ID GrabBufferList[GRAB_BUFFER_LIST_CAPACITY];
+   MIL_INT GrabBufferListSize;
+
+   /* Progress and cancellation of a tuner's calibration; NULL outside of one. Once the
+      cancellation is seen before an acquisition, the acquisitions are skipped and
+      Cancelled stays set until the next calibration. */
+   CalibrationControl* Control;
+   bool Cancelled;
+
+   /* True during the probe sizing the grab queue, which is not reported as progress. */
+   bool Probing;
+   };
+
+/* Switch of the topology and its fan-in model. The packet period is the time
+between two packets of each of its cameras; the peak queue is the predicted
+worst-case occupancy of the uplink port's buffer. */
+struct SwitchInfo
+   {
+   SwitchInfo()
+      {
+      NbCameras = 0;
+      FirstCamera = 0;
+      BufferBytes = 0;
+      UplinkMbps = 0;
+      PacketPeriod = 0;
+      PeakQueueBytes = 0;
+      Feasible = true;
+      NbLossyCameras = 0;
+      }
+   MIL_INT NbCameras;
+   MIL_INT FirstCamera;
+   MIL_INT64 BufferBytes;
+   MIL_INT UplinkMbps;
+   MIL_DOUBLE PacketPeriod;
+   MIL_DOUBLE PeakQueueBytes;
+   bool Feasible;
+   MIL_INT NbLossyCameras;
+   };
+
+/* Trigger configuration of a trigger selector, saved before the burst calibration. */
+struct TriggerSettings
+   {
+   MIL_STRING Selector;
+   MIL_STRING Mode;
+   MIL_STRING Source;
+   };
+
+/* Camera of the contention test, with its own grab buffers and hook data. */
+struct ContentionCamera
+   {
+   ContentionCamera()
+      {
+      Digitizer = M_NULL;
+      DeviceNumber = 0;
+      DelayTickVal = 0;
+      IsolatedFrameRate = 0;
+      FrameRate = 0;
+      FramesMissed = 0;
+      FramesCorrupted = 0;
+      FramesDamaged = 0;
+      ThroughputMbps = 0;
+      Calibrated = false;
+      TickFreq = 0;
+      PacketSize = 0;
+      ModelDelayTickVal = 0;
+      }
+   MIL_ID Digitizer;
+   MIL_INT DeviceNumber;
+   MIL_STRING Model;
+   MIL_STRING PixelFormat;
+   HookThreadPlacement Placement;
+   HookDataStruct HookData;
+   MIL_INT DelayTickVal;
+   MIL_DOUBLE IsolatedFrameRate;
+   MIL_DOUBLE FrameRate;
+   MIL_INT FramesMissed;
+   MIL_INT FramesCorrupted;
+   MIL_INT FramesDamaged;
+   MIL_DOUBLE ThroughputMbps;
+   bool Calibrated;
+
+   /* Fan-in model inputs and the delay it requires. */
+   MIL_UINT64 TickFreq;
+   MIL_INT PacketSize;
+   MIL_INT ModelDelayTickVal;
+   };
+
+struct PacketDelayResults
+   {
+   PacketDelayResults()
+      {
+      Selection = 0;
+      MissingPacketScanName = MIL_TEXT("disabled");
+      PayloadVerificationName = MIL_TEXT("disabled");
+      BurstTriggerPerFrame = false;
+      OriginalFrameRate = 0;
+      OriginalFrameRateEnable = M_FALSE;
+      Checkpointing = false;
+      BandwidthControlName = MIL_TEXT("inter-packet delay");
+      OriginalThroughputLimit = 0;
+      OriginalBurstFrameCount = -1;
+      }
+
+   HookThreadPlacement Placement;
+   const MIL_TEXT_CHAR* MissingPacketScanName;
+   MIL_STRING PayloadVerificationName;
+   MIL_STRING OriginalTestPattern;
+   MIL_STRING BandwidthControlName;
+   MIL_INT64 OriginalThroughputLimit;
+   MIL_STRING OriginalThroughputLimitMode;
+   MIL_STRING BurstTriggerName;
+   MIL_STRING OriginalTriggerSelector;
+   vector<TriggerSettings> OriginalTriggers;
+   MIL_INT64 OriginalBurstFrameCount;
+   bool BurstTriggerPerFrame;
+   ClockAlignment Alignment;
+   vector<int> LinkSpeedSource;
+   MIL_STRING FrameRateFeature;
+   MIL_DOUBLE OriginalFrameRate;
+   MIL_BOOL OriginalFrameRateEnable;
+   vector<MIL_STRING> PixelFormats;
+   vector<MIL_INT> InterPacketDelayInTicks;
+   vector<MIL_DOUBLE> InterPacketDelayInSec;
+   vector<MIL_DOUBLE> ReferenceFrameRate;
+   vector<MIL_DOUBLE> ObtainedFrameRate;
+   vector<MIL_INT> GrabBufferCount;
+   vector<MIL_INT64> GrabBufferSizeByte;
+   vector<MIL_INT> LinkSpeedMbps;
+   vector<MIL_INT> DelayLowerBound;
+   vector<MIL_INT> DelayUpperBound;
+   vector<ValidationResult> Validations;
+   vector<MIL_INT64> ThroughputLimit;
+   vector<SequenceSummary> ReferenceIntervals;
+   vector<vector<SequenceSummary> > Measurements;
+   vector<vector<SequenceSummary> > DelayCurves;
+   vector<vector<StreamChannelInfo> > StreamChannels;
+   vector<vector<TargetRateInfo> > TargetRates;
+   unsigned long Selection;
+
+   /* File the validation snapshots are appended to. */
+   string ValidationSnapshotFileName;
+
+   /* Checkpoint of the run. The resume information and curve are those of the pixel
+      format that was being calibrated. */
+   bool Checkpointing;
+   string CheckpointKey;
+   string CheckpointFileName;
+   vector<int> FormatStates;
+   PacketDelayInfo ResumeInfo;
+   vector<SequenceSummary> ResumeCurve;
+   };
+
+/* Observation of the Bayesian search: the delay relative to the theoretical delay
+and the frame rate relative to the reference, minus the fraction of lost frames. The
+noise variance is larger for observations made on other units of the model.
+*/
+struct DelayObservation
+   {
+   DelayObservation(MIL_DOUBLE DelayRatio = 0, MIL_DOUBLE Throughput = 0, MIL_DOUBLE NoiseVariance = 0)
+      : DelayRatio(DelayRatio), Throughput(Throughput), NoiseVariance(NoiseVariance)
+      {
+      }
+
+   MIL_DOUBLE DelayRatio;
+   MIL_DOUBLE Throughput;
+   MIL_DOUBLE NoiseVariance;
+   };
+
+/* Exclusive lock of a file shared by the processes; the lock is released when the
+file is closed, even by a process that ends abnormally.
+*/
+struct FileLock
+   {
+   FileLock()
+      {
+#if M_MIL_USE_WINDOWS
+      File = INVALID_HANDLE_VALUE;
+#else
+      File = -1;
+#endif
+      }
+
+#if M_MIL_USE_WINDOWS
+   HANDLE File;
+#else
+   int File;
+#endif
+   };
+
+/* Camera configuration answered by the calibration service. */
+struct CalibrationQuery
+   {
+   CalibrationQuery()
+      {
+      OffsetX = 0;
+      OffsetY = 0;
+      Width = 0;
+      Height = 0;
+      PacketSize = 0;
+      }
+
+   string SerialNumber;
+   string PixelFormat;
+   MIL_INT64 OffsetX;
+   MIL_INT64 OffsetY;
+   MIL_INT64 Width;
+   MIL_INT64 Height;
+   MIL_INT64 PacketSize;
+   };
+
+/* Cached calibration result. */
+struct CalibrationCacheEntry
+   {
+   CalibrationCacheEntry()
+      {
+      DelayTickVal = 0;
+      DelayInSeconds = 0;
+      FrameRate = 0;
+      }
+
+   MIL_INT DelayTickVal;
+   MIL_DOUBLE DelayInSeconds;
+   MIL_DOUBLE FrameRate;
+   };
+
+/* Camera configuration changed by a calibration job, restored once it completes. */
+struct CameraConfiguration
+   {
+   CameraConfiguration()
+      {
+      OffsetX = 0;
+      OffsetY = 0;
+      Width = 0;
+      Height = 0;
+      PacketSize = 0;
+      ThroughputLimit = 0;
+      DelayTickVal = 0;
+      }
+
+   MIL_INT64 OffsetX;
+   MIL_INT64 OffsetY;
+   MIL_INT64 Width;
+   MIL_INT64 Height;
+   MIL_INT64 PacketSize;
+   MIL_INT64 ThroughputLimit;
+   MIL_INT DelayTickVal;
+   MIL_STRING PixelFormat;
+   };
+
+/* State shared by the service's socket loop and calibration thread. */
+struct CalibrationService
+   {
+   CalibrationService()
+      {
+      MilSystem = M_NULL;
+      MilDigitizer = M_NULL;
+      BoardType = 0;
+      Results = M_NULL;
+      HookData = M_NULL;
+      Stop = false;
+      }
+
+   MIL_ID MilSystem;
+   MIL_ID MilDigitizer;
+   MIL_INT BoardType;
+   PacketDelayResults* Results;
+   HookDataStruct* HookData;
+   string SerialNumber;
+
+   mutex Lock;
+   condition_variable JobAvailable;
+   map<string, CalibrationCacheEntry> Cache;
+   deque<CalibrationQuery> Jobs;
+   bool Stop;
+   };
+
+/* Progress reporting and cancellation of a tuner's calibration. The cancellation is
+requested from any thread; the calibrating thread checks it before each acquisition and
+reports the progress after each one. The iterations count the acquisitions of each
+pixel format.
+*/
+struct CalibrationControl
+   {
+   CalibrationControl()
+      {
+      ProgressFunction = NULL;
+      UserDataPtr = NULL;
+      Results = NULL;
+      CancelRequested = false;
+      }
+
+   PacketDelayProgressFunction ProgressFunction;
+   void* UserDataPtr;
+   const PacketDelayResults* Results;
+   vector<MIL_INT> Iterations;
+   atomic<bool> CancelRequested;
+   };
+
+/* State of a tuner: everything the calibration of its camera changes. */
+struct TunerState
+   {
+   TunerState()
+      {
+      MilSystem = M_NULL;
+      MilDigitizer = M_NULL;
+      BoardType = 0;
+      HookData.Settings = &Settings;
+      HookData.Placement = &Results.Placement;
+      HookData.Control = &Control;
+      Control.Results = &Results;
+      }
+
+   MIL_ID MilSystem;
+   MIL_ID MilDigitizer;
+   MIL_INT BoardType;
+   PacketDelaySettings Settings;
+   PacketDelayInfo Info;
+   PacketDelayResults Results;
+   HookDataStruct HookData;
+   FrameLogFile FrameLog;
+   CalibrationControl Control;
+   string TraceFileName;
+   string FrameLogFileName;
+   };
+
+/* Utility functions. */
+void EnumeratePixelFormats(MIL_ID MilDigitizer, vector<MIL_STRING>& PixelFormats);
+void StartCalibration(TunerState& State);
+bool CalibrateSelectedFormats(TunerState& State);
+void CalibrateSelection(TunerState& State);
+bool IsCancelRequested(HookDataStruct& HookData);
+void ReportProgress(HookDataStruct& HookData, MIL_DOUBLE FrameRate);
+void ApplyPixelFormat(MIL_ID MilDigitizer, PacketDelayResults& Results);
+void AllocateAcquisitionBuffers(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType,
+                                PacketDelayResults& Results, HookDataStruct& HookData);
+void AllocateGrabBuffers(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT SizeBand, MIL_INT BufType,
+                         MIL_INT64 Attribute, MIL_INT Count, HookDataStruct& HookData);
+void FreeGrabBuffers(HookDataStruct& HookData);
+MIL_INT ComputeGrabBufferCount(MIL_ID MilDigitizer, MIL_INT64 BufferSizeByte, HookDataStruct& HookData);
+void ResizeResults(PacketDelayResults& Results, MIL_INT Count);
+void CalibratePixelFormat(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType, PacketDelayInfo& Info,
+                          PacketDelayResults& Results, HookDataStruct& HookData);
+void ResetHookData(HookDataStruct& HookData);
+MIL_DOUBLE AcquireSequence(MIL_ID MilDigitizer, HookDataStruct& HookData);
+bool IsTailWithinBounds(const PacketDelayInfo& Info, const SequenceSummary& Summary, const PacketDelaySettings& Settings);
+void ApplyDelayMargin(MIL_ID MilDigitizer, PacketDelayInfo& Info, HookDataStruct& HookData);
+
+/* Link speed functions. */
+MIL_INT GetLinkSpeed(MIL_ID MilDigitizer, int& Source, const PacketDelaySettings& Settings);
+const MIL_TEXT_CHAR* GetLinkSpeedSourceName(int Source);
+MIL_DOUBLE GetPacketWireTime(MIL_INT PacketSize, MIL_INT LinkSpeedMbps);
+MIL_DOUBLE GetTheoreticalDelay(MIL_ID MilDigitizer, const HookDataStruct& HookData);
+MIL_DOUBLE GetPacketPeriod(const HookDataStruct& HookData);
+MIL_INT GetMinTickStep(const PacketDelayInfo& Info, const HookDataStruct& HookData);
+
+/* Throughput limit functions. */
+MIL_UINT64 OpenBandwidthControl(MIL_ID MilDigitizer, PacketDelayResults& Results, HookDataStruct& HookData);
+bool EnableThroughputControl(MIL_ID MilDigitizer, PacketDelayResults& Results, HookDataStruct& HookData);
+void RestoreThroughputControl(MIL_ID MilDigitizer, PacketDelayResults& Results);
+MIL_UINT64 GetTickFrequency(MIL_ID MilDigitizer, const HookDataStruct& HookData);
+MIL_INT64 GetThroughputLimit(const HookDataStruct& HookData, MIL_DOUBLE DelayInSeconds);
+
+/* Interval histogram functions. */
+void ResetHistogram(IntervalHistogram& Histogram);
+void AddToHistogram(IntervalHistogram& Histogram, MIL_DOUBLE IntervalInSec);
+MIL_DOUBLE GetHistogramPercentile(const IntervalHistogram& Histogram, MIL_DOUBLE Percentile);
+void SummarizeSequence(const HookDataStruct& HookData, MIL_INT DelayTickVal, MIL_DOUBLE FrameRate,
+                       SequenceSummary& Summary);
+
+/* Delay curve functions. */
+void SweepInterPacketDelay(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results,
+                           HookDataStruct& HookData);
+void MeasureDelayCurvePoint(MIL_ID MilDigitizer, HookDataStruct& HookData,
+                            MIL_INT DelayTickVal, vector<SequenceSummary>& Curve,
+                            vector<SequenceSummary>& ResumeCurve);
+void ExportDelayCurve(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results, const PacketDelaySettings& Settings);
+string ToNarrowString(const MIL_STRING& Str);
+MIL_INT GetLostFrameCount(const SequenceSummary& Summary);
+
+/* Frame check functions: missing packet scan and payload verification. */
+void PrepareFrameChecks(MIL_ID MilDigitizer, MIL_ID MilGrabBuffer, HookDataStruct& HookData);
+MIL_INT ScanMissingPackets(HookDataStruct& HookData, MIL_ID MilGrabBuffer);
+MIL_INT GetGvspPacketOverhead(MIL_ID MilDigitizer);
+void PrintMissingPacketMap(const vector<MIL_UINT8>& Map);
+bool EnableTestPattern(MIL_ID MilDigitizer, PacketDelayResults& Results, const PacketDelaySettings& Settings);
+void RestoreTestPattern(MIL_ID MilDigitizer, PacketDelayResults& Results);
+bool GenerateRampPattern(MIL_ID MilGrabBuffer, MIL_INT BitDepth, HookDataStruct& HookData);
+MIL_INT GetPixelFormatBitDepth(MIL_ID MilDigitizer, MIL_INT SizeBit);
+void VerifyPayload(HookDataStruct& HookData, MIL_ID MilGrabBuffer);
+int GetSimdLevel();
+const MIL_TEXT_CHAR* GetSimdLevelName(int SimdLevel);
+SentinelScanFunction GetSentinelScanFunction();
+PayloadCompareFunction GetPayloadCompareFunction();
+bool IsSentinelScalar(const MIL_UINT8* Data, size_t Size);
+MIL_INT ComparePayloadScalar(const MIL_UINT8* Data, const MIL_UINT8* Expected, size_t Size);
+int CountBits(MIL_UINT32 Value);
+#if SENTINEL_SCAN_X86
+bool IsSentinelSse2(const MIL_UINT8* Data, size_t Size);
+bool IsSentinelAvx2(const MIL_UINT8* Data, size_t Size);
+MIL_INT ComparePayloadSse2(const MIL_UINT8* Data, const MIL_UINT8* Expected, size_t Size);
+MIL_INT ComparePayloadAvx2(const MIL_UINT8* Data, const MIL_UINT8* Expected, size_t Size);
+#endif
+void AcquireReferenceFrameRate(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results,
+                               HookDataStruct& HookData);
+void FindInterPacketDelay(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results,
+                          HookDataStruct& HookData);
+void PrintResults(MIL_ID MilDigitizer, PacketDelayResults& Results, const PacketDelaySettings& Settings);
+void GetMilBufferInfoFromPixelFormat(MIL_ID MilDigitizer, MIL_INT& SizeBand,
+                                     MIL_INT& BufType, MIL_INT64& Attribute);
+
+/* Function measuring the frames delivered with a delay. */
+typedef bool (*DelayMeasurementFunction)(MIL_ID MilDigitizer, const PacketDelayResults& Results,
+                                         HookDataStruct& HookData, MIL_INT DelayTickVal,
+                                         SequenceSummary& Summary);
+
+/* Smallest loss-free delay search, used by the burst and latency modes. */
+bool FindSmallestLossFreeDelay(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results,
+                               HookDataStruct& HookData, DelayMeasurementFunction Measure,
+                               const SequenceSummary& Reference);
+
+/* Stream channel functions. */
+void CalibrateStreamChannels(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType, PacketDelayInfo& Info,
+                             PacketDelayResults& Results, HookDataStruct& HookData);
+MIL_INT GetStreamChannelCount(MIL_ID MilDigitizer);
+MIL_ID AllocateStreamChannelDigitizer(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT Channel);
+void RecordStreamChannel(MIL_ID MilDigitizer, MIL_INT Channel, const PacketDelayInfo& Info,
+                         const HookDataStruct& HookData, StreamChannelInfo& ChannelInfo);
+bool ShareLinkBandwidth(vector<StreamChannelInfo>& Channels);
+void ValidateStreamChannels(MIL_ID MilSystem, MIL_INT BoardType, const vector<MIL_ID>& Digitizers,
+                            vector<PacketDelayResults>& ChannelResults, vector<StreamChannelInfo>& Channels,
+                            const vector<HookDataStruct>& Controls, const HookDataStruct& HookData);
+void PrintStreamChannels(const vector<StreamChannelInfo>& Channels, const PacketDelaySettings& Settings);
+
+/* Time budget functions. */
+void ScheduleTimeBudget(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType, PacketDelayResults& Results,
+                        HookDataStruct& HookData);
+void OpenScheduledFormat(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType, PacketDelayResults& Results,
+                         HookDataStruct& HookData);
+void ReopenScheduledFormat(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType, PacketDelayResults& Results,
+                           const FormatSchedule& Schedule, HookDataStruct& HookData);
+void MeasureScheduledDelay(MIL_ID MilDigitizer, FormatSchedule& Schedule, HookDataStruct& HookData,
+                           MIL_INT DelayTickVal);
+MIL_DOUBLE GetScheduleUncertainty(const FormatSchedule& Schedule);
+void StoreScheduledResult(MIL_ID MilDigitizer, FormatSchedule& Schedule, PacketDelayResults& Results,
+                          HookDataStruct& HookData);
+
+/* Timing trace functions. */
+void SetInterPacketDelay(MIL_ID MilDigitizer, HookDataStruct& HookData, MIL_INT DelayTickVal);
+FILE* OpenTraceFile(const char* FileName, HookDataStruct& HookData);
+void WriteTraceFormat(const PacketDelayInfo& Info, const PacketDelayResults& Results, HookDataStruct& HookData);
+void WriteTraceWindow(HookDataStruct& HookData, MIL_DOUBLE FrameRate);
+bool ReadTraceFile(const char* FileName, vector<TraceFormat>& Formats);
+MIL_DOUBLE ReplaySequence(HookDataStruct& HookData);
+void RestoreTraceWindow(const TraceWindow& Window, HookDataStruct& HookData);
+int ReplayTrace(const char* FileName, const PacketDelaySettings& Settings);
+
+/* Frame log functions. */
+bool OpenFrameLog(const char* FileName, MIL_UINT64 Capacity, FrameLogFile& Log);
+void CloseFrameLog(FrameLogFile& Log);
+void AppendFrameLog(FrameLogFile& Log, const FrameLogRecordData& Record);
+int ReadFrameLog(const char* FileName);
+
+/* Validation functions. */
+void ValidateInterPacketDelay(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results,
+                              HookDataStruct& HookData);
+void AddToOnlineStats(OnlineStats& Stats, MIL_DOUBLE Value);
+MIL_DOUBLE GetOnlineStdDev(const OnlineStats& Stats);
+void RecordValidationFrame(ValidationStats& Stats, MIL_DOUBLE FrameTime, MIL_INT Missing, bool PayloadCorrupted);
+void PrintValidation(const ValidationResult& Validation);
+
+/* Contention test functions. */
+void RunContentionTest(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType, PacketDelayResults& Results,
+                       const HookDataStruct& HookData);
+void PrintContentionTest(const vector<ContentionCamera>& Cameras, MIL_DOUBLE Duration, const PacketDelaySettings& Settings);
+void ParseSwitchTopology(const char* TopologyStr, vector<SwitchInfo>& Switches);
+void ApplySwitchModel(SwitchInfo& Switch, vector<ContentionCamera>& Cameras);
+MIL_DOUBLE GetSwitchPeakQueue(MIL_DOUBLE ArrivalBytes, MIL_INT PacketsPerFrame, MIL_DOUBLE DrainRate,
+                              MIL_DOUBLE PacketPeriod);
+void PrintSwitchModel(const vector<SwitchInfo>& Switches, const vector<ContentionCamera>& Cameras);
+
+/* Checkpoint functions. */
+void SetFormatState(PacketDelayResults& Results, const PacketDelayInfo& Info, int State);
+void SaveCheckpoint(const PacketDelayResults& Results, const PacketDelayInfo& Info);
+bool LoadCheckpoint(MIL_ID MilDigitizer, PacketDelayResults& Results, const PacketDelaySettings& Settings);
+string GetCheckpointKey(MIL_ID MilDigitizer, const PacketDelayResults& Results, const PacketDelaySettings& Settings);
+void WriteSequenceSummary(FILE* File, const char* Tag, size_t Index, const SequenceSummary& Summary);
+bool ReadSequenceSummary(const char* Fields, SequenceSummary& Summary);
+
+/* Target frame rate functions. */
+void CalibrateTargetFrameRates(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType, PacketDelayInfo& Info,
+                               PacketDelayResults& Results, HookDataStruct& HookData);
+void ParseFrameRateList(const char* FrameRateListStr, vector<MIL_DOUBLE>& FrameRates);
+bool ApplyTargetFrameRate(MIL_ID MilDigitizer, PacketDelayResults& Results, MIL_DOUBLE FrameRate,
+                          MIL_DOUBLE& AppliedFrameRate);
+void RestoreFrameRate(MIL_ID MilDigitizer, PacketDelayResults& Results);
+void RecordTargetFrameRate(const PacketDelayInfo& Info, TargetRateInfo& TargetInfo);
+void PrintTargetFrameRates(const vector<TargetRateInfo>& TargetRates);
+
+/* Latency calibration functions. */
+void PrepareLatencyMeasurement(MIL_ID MilDigitizer, const PacketDelayInfo& Info, HookDataStruct& HookData);
+bool LatchCameraClock(MIL_ID MilDigitizer, HookDataStruct& HookData);
+void AddClockSample(vector<ClockSample>& Samples, const ClockSample& Sample);
+void AlignCameraClock(HookDataStruct& HookData);
+void FitClockLine(const vector<ClockSample>& Samples, bool LowerEnvelope, ClockAlignment& Alignment);
+MIL_DOUBLE CameraToHostTime(const ClockAlignment& Alignment, MIL_DOUBLE CameraTime);
+void PrintClockAlignment(const ClockAlignment& Alignment);
+void SummarizeLatencies(const HookDataStruct& HookData, SequenceSummary& Summary);
+bool MeasureLatencies(MIL_ID MilDigitizer, const PacketDelayResults& Results, HookDataStruct& HookData,
+                      MIL_INT DelayTickVal, SequenceSummary& Summary);
+void FindLatencyInterPacketDelay(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results,
+                                 HookDataStruct& HookData);
+
+/* Burst calibration functions. */
+bool EnableBurstTrigger(MIL_ID MilDigitizer, PacketDelayResults& Results, const PacketDelaySettings& Settings);
+void RestoreBurstTrigger(MIL_ID MilDigitizer, PacketDelayResults& Results, const PacketDelaySettings& Settings);
+bool MeasureBursts(MIL_ID MilDigitizer, const PacketDelayResults& Results, HookDataStruct& HookData,
+                   MIL_INT DelayTickVal, SequenceSummary& Summary);
+void FindBurstInterPacketDelay(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results,
+                               HookDataStruct& HookData);
+
+/* Bayesian search functions. */
+void FindInterPacketDelayBayesian(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results,
+                                  HookDataStruct& HookData);
+DelayObservation ObserveDelay(const PacketDelayInfo& Info, const SequenceSummary& Summary,
+                              MIL_DOUBLE TheoreticalDelay, const PacketDelaySettings& Settings);
+bool FitGaussianProcess(const vector<DelayObservation>& Observations, vector<MIL_DOUBLE>& Cholesky,
+                        vector<MIL_DOUBLE>& Weights);
+void PredictGaussianProcess(const vector<DelayObservation>& Observations, const vector<MIL_DOUBLE>& Cholesky,
+                            const vector<MIL_DOUBLE>& Weights, MIL_DOUBLE DelayRatio,
+                            MIL_DOUBLE& Mean, MIL_DOUBLE& Variance);
+void LoadDelayPrior(const string& Model, vector<DelayObservation>& Observations, const PacketDelaySettings& Settings);
+void AppendDelayPrior(const string& Model, const string& PixelFormat, MIL_INT PacketSize,
+                      const PacketDelayInfo& Info, MIL_DOUBLE TheoreticalDelay, const PacketDelaySettings& Settings);
+bool AcquireFileLock(const char* FileName, FileLock& Lock);
+void ReleaseFileLock(FileLock& Lock);
+string ToSingleWord(const string& Str);
+
+/* Calibration service functions. */
+void RunCalibrationService(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType,
+                           PacketDelayResults& Results, HookDataStruct& HookData);
+void CalibrationServiceThread(CalibrationService* Service);
+bool RunCalibrationJob(CalibrationService& Service, const CalibrationQuery& Query, CalibrationCacheEntry& Entry);
+void SaveCameraConfiguration(MIL_ID MilDigitizer, const HookDataStruct& HookData, CameraConfiguration& Configuration);
+void RestoreCameraConfiguration(MIL_ID MilDigitizer, HookDataStruct& HookData, const CameraConfiguration& Configuration);
+string HandleServiceRequest(CalibrationService& Service, const string& Request);
+bool ParseCalibrationQuery(const string& Request, CalibrationQuery& Query);
+string GetCalibrationKey(const CalibrationQuery& Query);
+void LoadCalibrationCache(CalibrationService& Service);
+void AppendCalibrationCache(const CalibrationQuery& Query, const CalibrationCacheEntry& Entry, const PacketDelaySettings& Settings);
+string GetCameraSerialNumber(MIL_ID MilDigitizer);
+bool SetIntegerFeature(MIL_ID MilDigitizer, const MIL_TEXT_CHAR* FeatureName, MIL_INT64 Value);
+
+/* Thread placement functions. */
+void ParseCpuList(const char* CpuListStr, vector<int>& CpuList);
+void ApplyHookThreadPlacement(HookThreadPlacement& Placement);
+void PrintThreadPlacement(const HookThreadPlacement& Placement, const PacketDelaySettings& Settings);
+int GetCurrentCpu();
+int GetCpuNumaNode(int Cpu);
+int GetNetworkInterfaceNumaNode(const char* InterfaceName);
+MIL_STRING ToMilString(const char* Str);
+bool IsEqual(MIL_DOUBLE A, MIL_DOUBLE B)
+   {
+   if(((A+0.1) >= B) && ((A-0.1) <= B))
+      return true;
+   else
+      return false;
+   }
+
+/* Create a tuner for the digitizer. */
+/* --------------------------------- */
+Tuner::Tuner(MIL_ID MilSystem, MIL_ID MilDigitizer)
+   {
+   State = new TunerState;
+   State->MilSystem = MilSystem;
+   State->MilDigitizer = MilDigitizer;
+   }
+
+Tuner::~Tuner()
+   {
+   delete State;
+   }
+
+/* Set the options of the tuner, before it is opened. */
+/* -------------------------------------------------- */
+void Tuner::SetSettings(const PacketDelaySettings& Settings)
+   {
+   State->Settings = Settings;
+   }
+
+const PacketDelaySettings& Tuner::GetSettings() const
+   {
+   return State->Settings;
+   }
+
+/* Check that the camera is a GigE Vision camera with a bandwidth control, and read */
+/* the hook thread placement requested for the acquisitions.                        */
+/* -------------------------------------------------------------------------------- */
+bool Tuner::Open()
+   {
+   const PacketDelaySettings& Settings = State->Settings;
+   PacketDelayResults& Results = State->Results;
+   HookDataStruct& HookData = State->HookData;
+
+   /* Inquire board type. */
+   MsysInquire(State->MilSystem, M_BOARD_TYPE, &State->BoardType);
+
+   /* The tuner calibrates GigE Vision cameras only. */
+   if((State->BoardType != M_GIGE_VISION))
+      {
+      MosPrintf(MIL_TEXT("Error, the system is not a GigE Vision system.\n"));
+      return false;
+      }
+
+   /* Inquire the camera's clock tick frequency, or control its throughput limit. */
+   State->Info.TickFreq = OpenBandwidthControl(State->MilDigitizer, Results, HookData);
+   if(State->Info.TickFreq == 0)
+      {
+      MosPrintf(MIL_TEXT("Error, camera supports neither inter-packet delay nor DeviceLinkThroughputLimit.\n"));
+      return false;
+      }
+
+   /* Name the tuner's files after the camera, so the tuners of other cameras, in this
+      process or in others, do not write to the same files. */
+   string SerialNumber = GetCameraSerialNumber(State->MilDigitizer);
+   Results.CheckpointFileName = GetTunerFileName(Settings.CheckpointFile.c_str(), SerialNumber.c_str());
+   Results.ValidationSnapshotFileName = GetTunerFileName(Settings.ValidationSnapshotFile.c_str(), SerialNumber.c_str());
+   State->TraceFileName = GetTunerFileName(Settings.TraceFile.c_str(), SerialNumber.c_str());
+   State->FrameLogFileName = GetTunerFileName(Settings.FrameLogFile.c_str(), SerialNumber.c_str());
+
+   /* Read the hook thread placement requested for the acquisitions. */
+   ParseCpuList(Settings.HookThreadCpuList.c_str(), Results.Placement.CpuList);
+   Results.Placement.RtPriority = Settings.HookThreadRtPriority;
+   if(Settings.MissingPacketScan)
+      Results.MissingPacketScanName = GetSimdLevelName(GetSimdLevel());
+   return true;
+   }
+
+/* Open the timing trace and the frame log of the calibration, when configured. */
+/* ---------------------------------------------------------------------------- */
+void Tuner::OpenRecordings()
+   {
+   const PacketDelaySettings& Settings = State->Settings;
+   HookDataStruct& HookData = State->HookData;
+
+   if(Settings.RecordTrace && !HookData.TraceFile)
+      HookData.TraceFile = OpenTraceFile(State->TraceFileName.c_str(), HookData);
+   if(Settings.WriteFrameLog && !HookData.FrameLog)
+      {
+      if(OpenFrameLog(State->FrameLogFileName.c_str(), Settings.FrameLogCapacity, State->FrameLog))
+         {
+         HookData.FrameLog = &State->FrameLog;
+         HookData.FrameLogDigitizer = (MIL_UINT32)State->MilDigitizer;
+         }
+      else
+         MosPrintf(MIL_TEXT("Cannot map %s; frames are not logged.\n"), ToMilString(State->FrameLogFileName.c_str()).c_str());
+      }
+   }
+
+/* Enumerate the camera's pixel formats supported by MIL. */
+/* ------------------------------------------------------ */
+vector<MIL_STRING> Tuner::GetPixelFormats()
+   {
+   vector<MIL_STRING> PixelFormats;
+   EnumeratePixelFormats(State->MilDigitizer, PixelFormats);
+   return PixelFormats;
+   }
+
+/* Select the pixel formats to calibrate. Without any, the camera's current pixel */
+/* format is calibrated.                                                           */
+/* ------------------------------------------------------------------------------- */
+void Tuner::SelectPixelFormats(const vector<MIL_STRING>& PixelFormats)
+   {
+   PacketDelayResults& Results = State->Results;
+
+   Results.PixelFormats = PixelFormats;
+   if(Results.PixelFormats.empty())
+      {
+      MIL_STRING PixelFormat;
+      MdigInquireFeature(State->MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("PixelFormat"), M_TYPE_STRING, PixelFormat);
+      Results.PixelFormats.push_back(PixelFormat);
+      }
+   ResizeResults(Results, (MIL_INT)Results.PixelFormats.size());
+   Results.Selection = 0;
+   }
+
+/* Report the progress of the calibrations to the function, called from the     */
+/* calibrating thread after each acquisition.                                    */
+/* ----------------------------------------------------------------------------- */
+void Tuner::SetProgressFunction(PacketDelayProgressFunction ProgressFunction, void* UserDataPtr)
+   {
+   State->Control.ProgressFunction = ProgressFunction;
+   State->Control.UserDataPtr = UserDataPtr;
+   }
+
+/* Calibrate the selected pixel formats. It returns false when cancelled. */
+/* ---------------------------------------------------------------------- */
+bool Tuner::Calibrate()
+   {
+   StartCalibration(*State);
+   return CalibrateSelectedFormats(*State);
+   }
+
+/* Calibrate the selected pixel formats in a thread of their own. The tuner must not */
+/* be used, except to cancel, until the future is ready.                             */
+/* --------------------------------------------------------------------------------- */
+future<bool> Tuner::CalibrateAsync()
+   {
+   /* A cancellation requested once the call returns stops this calibration. */
+   StartCalibration(*State);
+   return async(launch::async, CalibrateSelectedFormats, ref(*State));
+   }
+
+/* Request the calibration to stop before its next acquisition. The pixel format    */
+/* being calibrated is left incomplete; with checkpointing, it resumes from its last */
+/* saved state on the next run.                                                     */
+/* -------------------------------------------------------------------------------- */
+void Tuner::Cancel()
+   {
+   State->Control.CancelRequested = true;
+   }
+
+/* Get the results of the selected pixel formats. */
+/* ---------------------------------------------- */
+vector<PacketDelayFormatResult> Tuner::GetResults() const
+   {
+   const PacketDelayResults& Results = State->Results;
+   vector<PacketDelayFormatResult> FormatResults(Results.PixelFormats.size());
+
+   for(size_t i = 0; i < FormatResults.size(); i++)
+      {
+      FormatResults[i].PixelFormat = Results.PixelFormats[i];
+      FormatResults[i].DelayTickVal = Results.InterPacketDelayInTicks[i];
+      FormatResults[i].DelayInSeconds = Results.InterPacketDelayInSec[i];
+      FormatResults[i].ReferenceFrameRate = Results.ReferenceFrameRate[i];
+      FormatResults[i].ObtainedFrameRate = Results.ObtainedFrameRate[i];
+      FormatResults[i].ThroughputLimit = Results.ThroughputLimit[i];
+      FormatResults[i].Calibrated = (Results.FormatStates[i] == FORMAT_STATE_DONE);
+      }
+   return FormatResults;
+   }
+
+/* Print the report of the calibration. */
+/* ------------------------------------ */
+void Tuner::PrintResults()
+   {
+   ::PrintResults(State->MilDigitizer, State->Results, State->Settings);
+   }
+
+/* Answer the delay queries of other processes until the service is stopped. */
+/* ------------------------------------------------------------------------- */
+void Tuner::RunCalibrationService()
+   {
+   ::RunCalibrationService(State->MilSystem, State->MilDigitizer, State->BoardType, State->Results, State->HookData);
+   }
+
+/* Stress all the cameras of the system at once. */
+/* --------------------------------------------- */
+void Tuner::RunContentionTest()
+   {
+   ::RunContentionTest(State->MilSystem, State->MilDigitizer, State->BoardType, State->Results, State->HookData);
+   }
+
+/* Close the recordings, reset the camera's bandwidth control and restore its test   */
+/* pattern and frame rate.                                                           */
+/* --------------------------------------------------------------------------------- */
+void Tuner::Close()
+   {
+   const PacketDelaySettings& Settings = State->Settings;
+   PacketDelayResults& Results = State->Results;
+   HookDataStruct& HookData = State->HookData;
+   MIL_ID MilDigitizer = State->MilDigitizer;
+
+   if(HookData.TraceFile)
+      {
+      fclose(HookData.TraceFile);
+      HookData.TraceFile = NULL;
+      }
+   if(HookData.FrameLog)
+      {
+      if(State->FrameLog.NbDropped > 0)
+         MosPrintf(MIL_TEXT("%llu frames were not logged; %s is full.\n"),
+            (unsigned long long)State->FrameLog.NbDropped, ToMilString(State->FrameLogFileName.c_str()).c_str());
+      CloseFrameLog(State->FrameLog);
+      HookData.FrameLog = NULL;
+      }
+
+   if(HookData.ThroughputControl)
+      RestoreThroughputControl(MilDigitizer, Results);
+   else
+      MdigControl(MilDigitizer, M_GC_INTER_PACKET_DELAY, 0);
+   if(Settings.PayloadVerification != PAYLOAD_VERIFICATION_NONE)
+      RestoreTestPattern(MilDigitizer, Results);
+   if(!Settings.TargetFrameRates.empty())
+      RestoreFrameRate(MilDigitizer, Results);
+   }
+
+/* Calibrate the selected pixel format in the requested mode, then select the next */
+/* one. Pixel formats completed before an interruption are skipped.                */
+/* -------------------------------------------------------------------------------- */
+void CalibrateSelection(TunerState& State)
+   {
+   const PacketDelaySettings& Settings = State.Settings;
+   PacketDelayInfo& Info = State.Info;
+   PacketDelayResults& Results = State.Results;
+   HookDataStruct& HookData = State.HookData;
+
+   if(Results.Checkpointing && Results.FormatStates[Results.Selection] == FORMAT_STATE_DONE)
+      {
+      MosPrintf(MIL_TEXT("\n%s was calibrated before the interruption.\n"),
+         Results.PixelFormats[Results.Selection].c_str());
+      Results.Selection++;
+      return;
+      }
+
+   if(!Settings.TargetFrameRates.empty())
+      CalibrateTargetFrameRates(State.MilSystem, State.MilDigitizer, State.BoardType, Info, Results, HookData);
+   else if(Settings.StreamChannelCalibration)
+      CalibrateStreamChannels(State.MilSystem, State.MilDigitizer, State.BoardType, Info, Results, HookData);
+   else
+      CalibratePixelFormat(State.MilSystem, State.MilDigitizer, State.BoardType, Info, Results, HookData);
+   if(HookData.Cancelled)
+      return;
+   if(HookData.ThroughputControl)
+      Results.ThroughputLimit[Results.Selection] = GetThroughputLimit(HookData, Results.InterPacketDelayInSec[Results.Selection]);
+   SetFormatState(Results, Info, FORMAT_STATE_DONE);
+   Results.Selection++;
+   }
+
+/* Clear the cancellation and the progress of the previous calibration. */
+/* --------------------------------------------------------------------- */
+void StartCalibration(TunerState& State)
+   {
+   State.Control.CancelRequested = false;
+   State.Control.Iterations.assign(State.Results.PixelFormats.size(), 0);
+   State.HookData.Cancelled = false;
+   }
+
+/* Calibrate the selected pixel formats. With a time budget, the acquisitions of all */
+/* the pixel formats are scheduled together; otherwise, each pixel format is         */
+/* calibrated in turn and, optionally, the run is checkpointed. It returns false     */
+/* when cancelled.                                                                   */
+/* --------------------------------------------------------------------------------- */
+bool CalibrateSelectedFormats(TunerState& State)
+   {
+   const PacketDelaySettings& Settings = State.Settings;
+   PacketDelayResults& Results = State.Results;
+   HookDataStruct& HookData = State.HookData;
+
+   if(Settings.TimeBudgetSec > 0 && Results.PixelFormats.size() > 1 && Settings.CalibrationMode == CALIBRATION_MODE_FREE_RUN)
+      {
+      ScheduleTimeBudget(State.MilSystem, State.MilDigitizer, State.BoardType, Results, HookData);
+      return !HookData.Cancelled;
+      }
+
+   /* Resume an interrupted run of the same camera. */
+   if(Settings.Checkpoint)
+      {
+      Results.Checkpointing = true;
+      if(LoadCheckpoint(State.MilDigitizer, Results, Settings))
+         MosPrintf(MIL_TEXT("Resuming from %s.\n"), ToMilString(Results.CheckpointFileName.c_str()).c_str());
+      }
+
+   /* Iterate through the selected pixel formats. */
+   while(Results.Selection < Results.PixelFormats.size() && !HookData.Cancelled)
+      CalibrateSelection(State);
+
+   /* The run is complete; the checkpoint is no longer needed. */
+   if(Results.Checkpointing && !HookData.Cancelled)
+      remove(Results.CheckpointFileName.c_str());
+   return !HookData.Cancelled;
+   }
+
+/* Enumerate the camera's pixel formats. Only MIL compatible formats are kept. */
+/* --------------------------------------------------------------------------- */
+void EnumeratePixelFormats(MIL_ID MilDigitizer, vector<MIL_STRING>& PixelFormats)
+   {
+   MIL_INT64 PixFmt = 0;
+   MIL_INT Count = 0;
+   
+   /* Inquire the number of pixel formats supported by the camera. */
+   MdigInquireFeature(MilDigitizer, M_FEATURE_ENUM_ENTRY_COUNT, MIL_TEXT("PixelFormat"), M_TYPE_MIL_INT, &Count);
+   for (MIL_INT i = 0; i < Count; i++)
+      {
+      MIL_INT64 AccessMode = 0;
+      /* Get the nth pixel format's name and numerical value. */
+      MIL_STRING PixelFormat;
+      MdigInquireFeature(MilDigitizer, M_FEATURE_ENUM_ENTRY_NAME + i, MIL_TEXT("PixelFormat"), M_TYPE_STRING, PixelFormat);
+      MdigInquireFeature(MilDigitizer, M_FEATURE_ENUM_ENTRY_VALUE + i, MIL_TEXT("PixelFormat"), M_TYPE_INT64, &PixFmt);
+      MdigInquireFeature(MilDigitizer, M_FEATURE_ENUM_ENTRY_ACCESS_MODE + i, MIL_TEXT("PixelFormat"), M_TYPE_INT64, &AccessMode);
+
+      /* Validate that the pixel format is compatible with MIL. */
+      if (M_FEATURE_IS_AVAILABLE(AccessMode) && (PixFmt & PFNC_CUSTOM) != PFNC_CUSTOM)
+         {
+         MIL_INT SizeBand = 0, BufType = 0;
+         MIL_INT64 Attribute = 0;
+         
+         MappControl(M_ERROR, M_PRINT_DISABLE);
+         MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("PixelFormat"), M_TYPE_STRING, PixelFormat);
+         GetMilBufferInfoFromPixelFormat(MilDigitizer, SizeBand, BufType, Attribute);
+
+         if(SizeBand && BufType && Attribute)
+            PixelFormats.push_back(PixelFormat);
+         MappControl(M_ERROR, M_PRINT_ENABLE);
+         }
+      }
+   }
+
+/* Size the per pixel format results. */
+/* ---------------------------------- */
+void ResizeResults(PacketDelayResults& Results, MIL_INT Count)
+   {
+   Results.InterPacketDelayInTicks.assign(Count, 0);
+   Results.InterPacketDelayInSec.assign(Count, 0.0);
+   Results.ReferenceFrameRate.assign(Count, 0.0);
+   Results.ObtainedFrameRate.assign(Count, 0.0);
+   Results.GrabBufferCount.assign(Count, 0);
+   Results.GrabBufferSizeByte.assign(Count, 0);
+   Results.LinkSpeedMbps.assign(Count, 0);
+   Results.LinkSpeedSource.assign(Count, LINK_SPEED_SOURCE_DEFAULT);
+   Results.DelayLowerBound.assign(Count, 0);
+   Results.DelayUpperBound.assign(Count, -1);
+   Results.Validations.assign(Count, ValidationResult());
+   Results.ThroughputLimit.assign(Count, 0);
+   Results.ReferenceIntervals.assign(Count, SequenceSummary());
+   Results.Measurements.assign(Count, vector<SequenceSummary>());
+   Results.DelayCurves.assign(Count, vector<SequenceSummary>());
+   Results.StreamChannels.assign(Count, vector<StreamChannelInfo>());
+   Results.TargetRates.assign(Count, vector<TargetRateInfo>());
+   Results.FormatStates.assign(Count, FORMAT_STATE_PENDING);
+   }
+
+/* Calculate the inter-packet delay of the selected pixel format. */
+/* -------------------------------------------------------------- */
+void CalibratePixelFormat(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType, PacketDelayInfo& Info,
+                          PacketDelayResults& Results, HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+
+   Info = PacketDelayInfo();
+
+   /* Inquire the camera's clock frequency so we can convert clock ticks to seconds. */
+   Info.TickFreq = GetTickFrequency(MilDigitizer, HookData);
+
+   /* Apply the next pixel format for calculation. */
+   ApplyPixelFormat(MilDigitizer, Results);
+
+   /* Optionally, have the camera send a test pattern to verify the payloads. */
+   HookData.VerifyPayloads = (Settings.PayloadVerification != PAYLOAD_VERIFICATION_NONE) &&
+      EnableTestPattern(MilDigitizer, Results, Settings);
+
+   /* Detect the link speed, which sets the wire time of the packets. */
+   HookData.LinkSpeedMbps = GetLinkSpeed(MilDigitizer, Results.LinkSpeedSource[Results.Selection], Settings);
+   Results.LinkSpeedMbps[Results.Selection] = HookData.LinkSpeedMbps;
+
+   /* Allocate grab buffers matching the camera's pixel format. */
+   AllocateAcquisitionBuffers(MilSystem, MilDigitizer, BoardType, Results, HookData);
+
+   /* Print a message. */
+   MosPrintf(MIL_TEXT("\n\nCalculating inter-packet delay for %s.\n\n"), Results.PixelFormats[Results.Selection].c_str());
+
+   /* Resume the pixel format from the checkpoint of an interrupted run. */
+   int ResumeState = Results.Checkpointing ? Results.FormatStates[Results.Selection] : FORMAT_STATE_PENDING;
+   if(ResumeState == FORMAT_STATE_CALIBRATED)
+      {
+      Info = Results.ResumeInfo;
+      FreeGrabBuffers(HookData);
+      return;
+      }
+
+   /* In burst mode, measure triggered bursts instead of the free-running frame rate. */
+   if(Settings.CalibrationMode == CALIBRATION_MODE_BURST)
+      {
+      if(EnableBurstTrigger(MilDigitizer, Results, Settings))
+         FindBurstInterPacketDelay(MilDigitizer, Info, Results, HookData);
+      RestoreBurstTrigger(MilDigitizer, Results, Settings);
+      if(!HookData.Cancelled)
+         SetFormatState(Results, Info, FORMAT_STATE_CALIBRATED);
+
+      FreeGrabBuffers(HookData);
+      return;
+      }
+
+   /* In latency mode, record the camera timestamps of the frames. */
+   if(Settings.CalibrationMode == CALIBRATION_MODE_LATENCY)
+      PrepareLatencyMeasurement(MilDigitizer, Info, HookData);
+   else
+      {
+      HookData.HostTimes.clear();
+      HookData.CameraTimes.clear();
+      }
+
+   /* Only the iterative search and the sweep continue from their checkpoint. */
+   bool Resume = (ResumeState == FORMAT_STATE_SWEEP ||
+                  (ResumeState == FORMAT_STATE_SEARCH && Settings.CalibrationMode == CALIBRATION_MODE_FREE_RUN && !Settings.BayesianSearch)) &&
+                 Results.ResumeInfo.BaseFrameRate > 0;
+
+   /* Get the reference frame rate. When resuming, it is only acquired again to capture
+      the camera's test pattern. */
+   if(!Resume || Settings.PayloadVerification == PAYLOAD_VERIFICATION_CAMERA)
+      AcquireReferenceFrameRate(MilDigitizer, Info, Results, HookData);
+   if(HookData.Cancelled)
+      {
+      FreeGrabBuffers(HookData);
+      return;
+      }
+   if(Resume)
+      {
+      Info = Results.ResumeInfo;
+      Results.ReferenceFrameRate[Results.Selection] = Info.BaseFrameRate;
+      Results.ReferenceIntervals[Results.Selection] = Info.ReferenceIntervals;
+      MosPrintf(MIL_TEXT("Resuming after %d measurements.\n"), (int)Info.Measurements.size());
+      }
+   else
+      SetFormatState(Results, Info, FORMAT_STATE_SEARCH);
+
+   /* With the reference frame rate found, find the optimal inter-packet delay, unless
+      the search was completed before the interruption. */
+   bool ResumeSweep = Resume && ResumeState == FORMAT_STATE_SWEEP;
+   if(!ResumeSweep)
+      {
+      if(Settings.CalibrationMode == CALIBRATION_MODE_LATENCY)
+         {
+         FindLatencyInterPacketDelay(MilDigitizer, Info, Results, HookData);
+         Results.Alignment = HookData.Alignment;
+         }
+      else if(Settings.BayesianSearch)
+         FindInterPacketDelayBayesian(MilDigitizer, Info, Results, HookData);
+      else
+         FindInterPacketDelay(MilDigitizer, Info, Results, HookData);
+      }
+
+   /* Optionally, sample and export the whole delay versus throughput curve. The points
+      measured before an interruption are reused. */
+   if(Settings.DelaySweep && !HookData.Cancelled)
+      {
+      if(ResumeSweep)
+         Results.ResumeCurve.swap(Results.DelayCurves[Results.Selection]);
+      SetFormatState(Results, Info, FORMAT_STATE_SWEEP);
+      SweepInterPacketDelay(MilDigitizer, Info, Results, HookData);
+      Results.ResumeCurve.clear();
+      }
+
+   /* Optionally, validate the delay over a long run. */
+   if(Settings.ValidationDurationSec > 0 && Settings.CalibrationMode == CALIBRATION_MODE_FREE_RUN && !Info.Error &&
+      !HookData.Cancelled)
+      ValidateInterPacketDelay(MilDigitizer, Info, Results, HookData);
+   if(!HookData.Cancelled)
+      SetFormatState(Results, Info, FORMAT_STATE_CALIBRATED);
+
+   /* Free the grab buffers. */
+   FreeGrabBuffers(HookData);
+   }
+
+/* Calculate the inter-packet delay of each stream channel for the selected pixel     */
+/* format. The first channel is the default digitizer's; the others are calibrated    */
+/* on their own digitizer, one at a time, then the delays are combined so the         */
+/* channels share the link, and validated by streaming all the channels at once.      */
+/* ---------------------------------------------------------------------------------- */
+void CalibrateStreamChannels(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType, PacketDelayInfo& Info,
+                             PacketDelayResults& Results, HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+   MIL_INT NbChannels = GetStreamChannelCount(MilDigitizer);
+   vector<StreamChannelInfo>& Channels = Results.StreamChannels[Results.Selection];
+   Channels.assign(NbChannels, StreamChannelInfo());
+
+   /* The channels are calibrated in copies of the results, so the default digitizer's
+      results of the pixel format are kept. The copies and the digitizers are kept
+      for the validation. */
+   vector<MIL_ID> Digitizers(NbChannels, M_NULL);
+   vector<PacketDelayResults> ChannelResults(NbChannels, Results);
+   Digitizers[0] = MilDigitizer;
+   for(MIL_INT Channel = 0; Channel < NbChannels; Channel++)
+      ChannelResults[Channel].Checkpointing = false;
+
+   /* Bandwidth control of each channel; the default digitizer's was opened with the
+      tuner. The calibrations share the hook data, which is given each channel's. */
+   vector<HookDataStruct> Controls(NbChannels);
+   for(MIL_INT Channel = 0; Channel < NbChannels; Channel++)
+      Controls[Channel].Settings = HookData.Settings;
+   Controls[0].ThroughputControl = HookData.ThroughputControl;
+   Controls[0].ThroughputLimitMin = HookData.ThroughputLimitMin;
+   Controls[0].ThroughputLimitMax = HookData.ThroughputLimitMax;
+
+   MosPrintf(MIL_TEXT("\n\nStream channel 0 of %d.\n"), (int)NbChannels);
+   CalibratePixelFormat(MilSystem, MilDigitizer, BoardType, Info, Results, HookData);
+   RecordStreamChannel(MilDigitizer, 0, Info, HookData, Channels[0]);
+
+   for(MIL_INT Channel = 1; Channel < NbChannels && !HookData.Cancelled; Channel++)
+      {
+      Digitizers[Channel] = AllocateStreamChannelDigitizer(MilSystem, MilDigitizer, Channel);
+      Channels[Channel].Channel = Channel;
+      if(Digitizers[Channel] == M_NULL)
+         {
+         MosPrintf(MIL_TEXT("\nStream channel %d could not be allocated.\n"), (int)Channel);
+         continue;
+         }
+      if(OpenBandwidthControl(Digitizers[Channel], ChannelResults[Channel], Controls[Channel]) == 0)
+         {
+         MosPrintf(MIL_TEXT("\nStream channel %d has no bandwidth control.\n"), (int)Channel);
+         MdigFree(Digitizers[Channel]);
+         Digitizers[Channel] = M_NULL;
+         continue;
+         }
+      HookData.ThroughputControl = Controls[Channel].ThroughputControl;
+      HookData.ThroughputLimitMin = Controls[Channel].ThroughputLimitMin;
+      HookData.ThroughputLimitMax = Controls[Channel].ThroughputLimitMax;
+
+      PacketDelayInfo ChannelInfo;
+      MosPrintf(MIL_TEXT("\n\nStream channel %d of %d.\n"), (int)Channel, (int)NbChannels);
+      CalibratePixelFormat(MilSystem, Digitizers[Channel], BoardType, ChannelInfo, ChannelResults[Channel], HookData);
+      RecordStreamChannel(Digitizers[Channel], Channel, ChannelInfo, HookData, Channels[Channel]);
+      }
+   HookData.ThroughputControl = Controls[0].ThroughputControl;
+   HookData.ThroughputLimitMin = Controls[0].ThroughputLimitMin;
+   HookData.ThroughputLimitMax = Controls[0].ThroughputLimitMax;
+
+   if(!ShareLinkBandwidth(Channels))
+      MosPrintf(MIL_TEXT("\nThe stream channels' combined bandwidth exceeds the link capacity.\n"));
+   if(Settings.StreamChannelValidationSec > 0 && !HookData.Cancelled)
+      ValidateStreamChannels(MilSystem, BoardType, Digitizers, ChannelResults, Channels, Controls, HookData);
+
+   /* Leave the default digitizer at its calibrated delay and release the others. */
+   if(!Info.Error)
+      SetInterPacketDelay(MilDigitizer, HookData, Info.DelayTickVal);
+   for(MIL_INT Channel = 1; Channel < NbChannels; Channel++)
+      {
+      if(Digitizers[Channel] == M_NULL)
+         continue;
+      if(Controls[Channel].ThroughputControl)
+         RestoreThroughputControl(Digitizers[Channel], ChannelResults[Channel]);
+      else
+         MdigControl(Digitizers[Channel], M_GC_INTER_PACKET_DELAY, 0);
+      if(Settings.PayloadVerification != PAYLOAD_VERIFICATION_NONE)
+         RestoreTestPattern(Digitizers[Channel], ChannelResults[Channel]);
+      MdigFree(Digitizers[Channel]);
+      }
+   }
+
+/* Inquire the number of stream channels of the device. */
+/* ----------------------------------------------------- */
+MIL_INT GetStreamChannelCount(MIL_ID MilDigitizer)
+   {
+   MIL_INT64 Count = 0;
+   MIL_BOOL Present = M_FALSE;
+
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   MdigInquireFeature(MilDigitizer, M_FEATURE_PRESENT, MIL_TEXT("DeviceStreamChannelCount"), M_TYPE_BOOLEAN, &Present);
+   if(Present)
+      MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("DeviceStreamChannelCount"), M_TYPE_INT64, &Count);
+   else
+      MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("GevStreamChannelCount"), M_TYPE_INT64, &Count);
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+
+   return max((MIL_INT)Count, (MIL_INT)1);
+   }
+
+/* Allocate a digitizer grabbing from another stream channel of the default     */
+/* digitizer's device.                                                          */
+/* ---------------------------------------------------------------------------- */
+MIL_ID AllocateStreamChannelDigitizer(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT Channel)
+   {
+   MIL_ID ChannelDigitizer = M_NULL;
+   MIL_INT DeviceNumber = 0;
+
+   MdigInquire(MilDigitizer, M_NUMBER, &DeviceNumber);
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   MdigAlloc(MilSystem, DeviceNumber, MIL_TEXT("M_DEFAULT"), M_GC_STREAM_CHANNEL(Channel), &ChannelDigitizer);
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+
+   return ChannelDigitizer;
+   }
+
+/* Record the calibration of a stream channel. */
+/* ------------------------------------------- */
+void RecordStreamChannel(MIL_ID MilDigitizer, MIL_INT Channel, const PacketDelayInfo& Info,
+                         const HookDataStruct& HookData, StreamChannelInfo& ChannelInfo)
+   {
+   ChannelInfo.Channel = Channel;
+   ChannelInfo.Calibrated = !Info.Error && Info.BaseFrameRate > 0 && HookData.PacketsPerFrame > 0;
+   ChannelInfo.TickFreq = Info.TickFreq;
+   MdigInquire(MilDigitizer, M_GC_PACKET_SIZE, &ChannelInfo.PacketSize);
+   ChannelInfo.PacketsPerFrame = HookData.PacketsPerFrame;
+   ChannelInfo.PacketWireTime = HookData.PacketWireTime;
+   ChannelInfo.LinkSpeedMbps = HookData.LinkSpeedMbps;
+   ChannelInfo.FrameRate = Info.BaseFrameRate;
+   ChannelInfo.DelayTickVal = Info.DelayTickVal;
+   ChannelInfo.CombinedDelayTickVal = Info.DelayTickVal;
+   }
+
+/* Share the link between the stream channels in proportion to their average         */
+/* bandwidth. A channel sending at a fraction S of the line rate while its frame is   */
+/* transferred needs a delay of WireTime * (1/S - 1) after each packet; with the      */
+/* shares summing to 1, the combined peak rate is the line rate and each frame is     */
+/* transferred within its frame period, provided the average bandwidths fit the link. */
+/* A channel whose share delay exceeds the largest delay transferring its frame       */
+/* within the frame period is infeasible and keeps its calibrated delay.              */
+/* ---------------------------------------------------------------------------------- */
+bool ShareLinkBandwidth(vector<StreamChannelInfo>& Channels)
+   {
+   MIL_DOUBLE TotalLoad = 0;
+
+   /* Fraction of the link used by each channel on average. */
+   for(size_t i = 0; i < Channels.size(); i++)
+      {
+      if(Channels[i].Calibrated)
+         {
+         Channels[i].LinkShare = Channels[i].FrameRate * Channels[i].PacketsPerFrame * Channels[i].PacketWireTime;
+         TotalLoad += Channels[i].LinkShare;
+         }
+      }
+   if(TotalLoad <= 0)
+      return false;
+
+   for(size_t i = 0; i < Channels.size(); i++)
+      {
+      StreamChannelInfo& Info = Channels[i];
+      if(!Info.Calibrated || Info.TickFreq == 0)
+         continue;
+
+      Info.LinkShare /= TotalLoad;
+      MIL_DOUBLE ShareDelay = Info.PacketWireTime * (1.0 / Info.LinkShare - 1.0);
+      Info.ShareDelayTickVal = (MIL_INT)ceil(ShareDelay * Info.TickFreq);
+
+      /* The largest delay still sending the frame's packets within the frame period. */
+      MIL_DOUBLE MaxDelay = 1.0 / (Info.FrameRate * Info.PacketsPerFrame) - Info.PacketWireTime;
+      Info.MaxDelayTickVal = (MIL_INT)floor(max(MaxDelay, 0.0) * Info.TickFreq);
+      Info.Feasible = Info.ShareDelayTickVal <= max(Info.MaxDelayTickVal, Info.DelayTickVal);
+      Info.CombinedDelayTickVal = Info.Feasible ? max(Info.DelayTickVal, Info.ShareDelayTickVal) : Info.DelayTickVal;
+      }
+
+   return TotalLoad <= 1.0;
+   }
+
+/* Stream the calibrated channels at once at their combined delays for              */
+/* StreamChannelValidationSec, and record each channel's frame rate and losses.      */
+/* The losses are those MIL reports and the incomplete frames; the payloads are not  */
+/* verified, since the channels' expected frames are not captured.                   */
+/* --------------------------------------------------------------------------------- */
+void ValidateStreamChannels(MIL_ID MilSystem, MIL_INT BoardType, const vector<MIL_ID>& Digitizers,
+                            vector<PacketDelayResults>& ChannelResults, vector<StreamChannelInfo>& Channels,
+                            const vector<HookDataStruct>& Controls, const HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+   MIL_INT NbChannels = (MIL_INT)Channels.size();
+   vector<HookThreadPlacement> Placements(NbChannels, *HookData.Placement);
+   vector<HookDataStruct> ChannelHookData(NbChannels);
+   vector<ValidationStats> Stats(NbChannels);
+   MIL_DOUBLE StartTime = 0, EndTime = 0;
+
+   /* Give each channel grab buffers of its own and its combined delay. */
+   for(MIL_INT i = 0; i < NbChannels; i++)
+      {
+      StreamChannelInfo& Info = Channels[i];
+      HookDataStruct& ChannelHook = ChannelHookData[i];
+      if(!Info.Calibrated || Digitizers[i] == M_NULL)
+         continue;
+      ChannelHook.Placement = &Placements[i];
+      ChannelHook.Settings = HookData.Settings;
+      ChannelHook.LinkSpeedMbps = Info.LinkSpeedMbps;
+      ChannelHook.VerifyPayloads = false;
+      ChannelHook.ThroughputControl = Controls[i].ThroughputControl;
+      ChannelHook.ThroughputLimitMin = Controls[i].ThroughputLimitMin;
+      ChannelHook.ThroughputLimitMax = Controls[i].ThroughputLimitMax;
+      AllocateAcquisitionBuffers(MilSystem, Digitizers[i], BoardType, ChannelResults[i], ChannelHook);
+      SetInterPacketDelay(Digitizers[i], ChannelHook, Info.CombinedDelayTickVal);
+      }
+
+   /* Stream all the channels at once. */
+   MosPrintf(MIL_TEXT("\nStreaming %d stream channels at once for %d seconds.\n"), (int)NbChannels,
+      (int)Settings.StreamChannelValidationSec);
+   MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+   for(MIL_INT i = 0; i < NbChannels; i++)
+      {
+      HookDataStruct& ChannelHook = ChannelHookData[i];
+      if(ChannelHook.GrabBufferListSize == 0)
+         continue;
+      ResetHookData(ChannelHook);
+      ChannelHook.Validation = &Stats[i];
+      MdigProcess(Digitizers[i], ChannelHook.GrabBufferList, ChannelHook.GrabBufferListSize,
+         M_START, M_DEFAULT, ProcessingFunction, &ChannelHook);
+      }
+   MosSleep(Settings.StreamChannelValidationSec * 1000);
+   MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+
+   for(MIL_INT i = 0; i < NbChannels; i++)
+      {
+      StreamChannelInfo& Info = Channels[i];
+      HookDataStruct& ChannelHook = ChannelHookData[i];
+      if(ChannelHook.GrabBufferListSize == 0)
+         continue;
+      MIL_INT FramesMissed = 0, FramesCorrupted = 0;
+      MdigProcess(Digitizers[i], ChannelHook.GrabBufferList, ChannelHook.GrabBufferListSize,
+         M_STOP, M_DEFAULT, ProcessingFunction, &ChannelHook);
+      MdigInquire(Digitizers[i], M_PROCESS_FRAME_MISSED, &FramesMissed);
+      MdigInquire(Digitizers[i], M_PROCESS_FRAME_CORRUPTED, &FramesCorrupted);
+      ChannelHook.Validation = NULL;
+      Info.Validated = true;
+      Info.ValidatedFrameRate = Stats[i].NbFrames / (EndTime - StartTime);
+      Info.FramesLost = FramesMissed + FramesCorrupted + (MIL_INT)Stats[i].NbIncomplete;
+      FreeGrabBuffers(ChannelHook);
+      }
+   }
+
+/* Print the stream channels' delays and the combined bandwidth. */
+/* ------------------------------------------------------------- */
+void PrintStreamChannels(const vector<StreamChannelInfo>& Channels, const PacketDelaySettings& Settings)
+   {
+   MIL_DOUBLE AverageMbps = 0, PeakMbps = 0;
+   MIL_INT LinkSpeedMbps = 0;
+
+   for(size_t i = 0; i < Channels.size(); i++)
+      {
+      const StreamChannelInfo& Info = Channels[i];
+      if(!Info.Calibrated)
+         {
+         MosPrintf(MIL_TEXT("Stream channel %d:     not calibrated\n"), (int)Info.Channel);
+         continue;
+         }
+
+      MIL_DOUBLE Delay = Info.TickFreq ? (MIL_DOUBLE)Info.CombinedDelayTickVal / Info.TickFreq : 0.0;
+      MIL_DOUBLE PacketBits = Info.PacketWireTime * Info.LinkSpeedMbps;
+      LinkSpeedMbps = Info.LinkSpeedMbps;
+      AverageMbps += Info.FrameRate * Info.PacketsPerFrame * PacketBits;
+      PeakMbps += PacketBits / (Info.PacketWireTime + Delay);
+      if(!Info.Feasible)
+         MosPrintf(MIL_TEXT("Stream channel %d:     infeasible, its share needs %d ticks above the %d ticks ")
+            MIL_TEXT("keeping %.1f fps; %d ticks calibrated kept\n"), (int)Info.Channel, (int)Info.ShareDelayTickVal,
+            (int)Info.MaxDelayTickVal, Info.FrameRate, (int)Info.DelayTickVal);
+      else
+         MosPrintf(MIL_TEXT("Stream channel %d:     %d ticks calibrated, %d ticks shared, %d ticks combined ")
+            MIL_TEXT("(%.1f fps, %d packets of %d bytes)\n"), (int)Info.Channel, (int)Info.DelayTickVal,
+            (int)Info.ShareDelayTickVal, (int)Info.CombinedDelayTickVal, Info.FrameRate,
+            (int)Info.PacketsPerFrame, (int)Info.PacketSize);
+      if(Info.Validated)
+         {
+         bool Passed = Info.ValidatedFrameRate >= Info.FrameRate * (1.0 - Settings.ValidationMaxRateDrop) &&
+                       Info.FramesLost == 0;
+         MosPrintf(MIL_TEXT("                      streamed together: %.1f fps, %d frames lost, %s\n"),
+            Info.ValidatedFrameRate, (int)Info.FramesLost, Passed ? MIL_TEXT("PASS") : MIL_TEXT("FAIL"));
+         }
+      }
+   MosPrintf(MIL_TEXT("Combined bandwidth:   average %.0f, peak %.0f of %d Mbit/s\n"), AverageMbps, PeakMbps,
+      (int)LinkSpeedMbps);
+   }
+
+/* Calibrate all the pixel formats within the time budget. After a coarse pass on   */
+/* every format, the format with the widest uncertainty on its optimal delay is      */
+/* bisected until it is no longer the widest, and so on until the budget runs out    */
+/* or every format has converged. An acquisition is only started if the time it took */
+/* before on the same format still fits in the budget.                               */
+/* --------------------------------------------------------------------------------- */
+void ScheduleTimeBudget(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType, PacketDelayResults& Results,
+                        HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+
+   /* Largest delay tried, relative to the theoretical delay, and convergence. */
+   const MIL_INT MaxBracketFactor = 16;
+   const MIL_DOUBLE MinUncertainty = 0.02;
+   vector<FormatSchedule> Schedules(Results.PixelFormats.size());
+   MIL_DOUBLE StartTime = 0, Now = 0;
+
+   MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+   MosPrintf(MIL_TEXT("\n\nCalculating inter-packet delays within %d seconds.\n"), (int)Settings.TimeBudgetSec);
+
+   /* Coarse pass: the reference, the theoretical delay and one delay on the other side
+      of it, each while the budget remains. The formats not reached have no reference
+      and are left out of the refinement. */
+   for(size_t i = 0; i < Schedules.size() && !HookData.Cancelled; i++)
+      {
+      FormatSchedule& Schedule = Schedules[i];
+      MappTimer(M_DEFAULT, M_TIMER_READ, &Now);
+      if(Now >= StartTime + Settings.TimeBudgetSec)
+         {
+         MosPrintf(MIL_TEXT("\nThe time budget ran out before %s.\n"), Results.PixelFormats[i].c_str());
+         break;
+         }
+      Results.Selection = (unsigned long)i;
+      OpenScheduledFormat(MilSystem, MilDigitizer, BoardType, Results, HookData);
+      Schedule.Info.TickFreq = GetTickFrequency(MilDigitizer, HookData);
+      AcquireReferenceFrameRate(MilDigitizer, Schedule.Info, Results, HookData);
+      MappTimer(M_DEFAULT, M_TIMER_READ, &Schedule.AcquisitionTime);
+      Schedule.AcquisitionTime -= Now;
+      Schedule.TheoreticalTickVal = max(Schedule.Info.DelayTickVal, (MIL_INT)1);
+      Schedule.MinTickStep = GetMinTickStep(Schedule.Info, HookData);
+
+      /* Keep the expected frame of the reference, since the grab buffers of the format
+         are allocated again for each refinement. */
+      Schedule.ExpectedFrameValid = HookData.PayloadCompare != M_NULL && HookData.ExpectedFrameValid;
+      if(Schedule.ExpectedFrameValid)
+         Schedule.ExpectedFrame = HookData.ExpectedFrame;
+
+      MappTimer(M_DEFAULT, M_TIMER_READ, &Now);
+      if(Schedule.Info.BaseFrameRate > 0 && !HookData.Cancelled &&
+         Now + Schedule.AcquisitionTime < StartTime + Settings.TimeBudgetSec)
+         {
+         MeasureScheduledDelay(MilDigitizer, Schedule, HookData, Schedule.TheoreticalTickVal);
+         MappTimer(M_DEFAULT, M_TIMER_READ, &Now);
+         if(Now + Schedule.AcquisitionTime < StartTime + Settings.TimeBudgetSec)
+            MeasureScheduledDelay(MilDigitizer, Schedule, HookData, Schedule.UpperTickVal < 0 ?
+               Schedule.TheoreticalTickVal * 2 : max(Schedule.TheoreticalTickVal / 2, (MIL_INT)1));
+         }
+
+      FreeGrabBuffers(HookData);
+      }
+
+   /* Refinement: bisect the widest uncertainty until it is no longer the widest. */
+   MappTimer(M_DEFAULT, M_TIMER_READ, &Now);
+   while(Now < StartTime + Settings.TimeBudgetSec && !HookData.Cancelled)
+      {
+      size_t Widest = Schedules.size();
+      MIL_DOUBLE WidestUncertainty = 0, NextUncertainty = 0;
+      for(size_t i = 0; i < Schedules.size(); i++)
+         {
+         MIL_DOUBLE Uncertainty = GetScheduleUncertainty(Schedules[i]);
+         if(Schedules[i].Converged || Schedules[i].Info.BaseFrameRate <= 0 ||
+            Now + Schedules[i].AcquisitionTime >= StartTime + Settings.TimeBudgetSec)
+            continue;
+         if(Widest == Schedules.size() || Uncertainty > WidestUncertainty)
+            {
+            NextUncertainty = WidestUncertainty;
+            WidestUncertainty = Uncertainty;
+            Widest = i;
+            }
+         else if(Uncertainty > NextUncertainty)
+            NextUncertainty = Uncertainty;
+         }
+      if(Widest == Schedules.size())
+         break;
+
+      FormatSchedule& Schedule = Schedules[Widest];
+      Results.Selection = (unsigned long)Widest;
+      ReopenScheduledFormat(MilSystem, MilDigitizer, BoardType, Results, Schedule, HookData);
+      do
+         {
+         MIL_INT TickVal = (Schedule.UpperTickVal < 0) ? max(Schedule.LowerTickVal * 2, Schedule.TheoreticalTickVal) :
+                           (Schedule.LowerTickVal + Schedule.UpperTickVal) / 2;
+         MeasureScheduledDelay(MilDigitizer, Schedule, HookData, TickVal);
+         MappTimer(M_DEFAULT, M_TIMER_READ, &Now);
+
+         Schedule.Converged = (Schedule.UpperTickVal >= 0 &&
+                               (GetScheduleUncertainty(Schedule) <= MinUncertainty ||
+                                Schedule.UpperTickVal - Schedule.LowerTickVal <= Schedule.MinTickStep)) ||
+                              (Schedule.UpperTickVal < 0 && Schedule.LowerTickVal >= Schedule.TheoreticalTickVal * MaxBracketFactor);
+         }
+      while(!Schedule.Converged && GetScheduleUncertainty(Schedule) >= NextUncertainty &&
+            Now + Schedule.AcquisitionTime < StartTime + Settings.TimeBudgetSec);
+
+      FreeGrabBuffers(HookData);
+      }
+
+   /* Store the formats' results. The margin is verified on the payloads while the
+      budget still allows an acquisition of the format. Only the formats with a
+      reference and a delay are calibrated, unless the run was cancelled. */
+   for(size_t i = 0; i < Schedules.size(); i++)
+      {
+      FormatSchedule& Schedule = Schedules[i];
+      Results.Selection = (unsigned long)i;
+      MappTimer(M_DEFAULT, M_TIMER_READ, &Now);
+      bool Verify = Schedule.ExpectedFrameValid && !HookData.Cancelled &&
+                    Now + Schedule.AcquisitionTime < StartTime + Settings.TimeBudgetSec;
+      if(Verify)
+         ReopenScheduledFormat(MilSystem, MilDigitizer, BoardType, Results, Schedule, HookData);
+      else
+         HookData.PayloadCompare = M_NULL;
+      StoreScheduledResult(MilDigitizer, Schedule, Results, HookData);
+      Results.FormatStates[i] = (Schedule.Info.BaseFrameRate > 0 && !Schedule.Info.Error && !HookData.Cancelled) ?
+                                FORMAT_STATE_DONE : FORMAT_STATE_PENDING;
+      FreeGrabBuffers(HookData);
+      }
+   MosPrintf(MIL_TEXT("\n"));
+   }
+
+/* Apply the selected pixel format and allocate its grab buffers. */
+/* -------------------------------------------------------------- */
+void OpenScheduledFormat(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType, PacketDelayResults& Results,
+                         HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+
+   ApplyPixelFormat(MilDigitizer, Results);
+   HookData.VerifyPayloads = (Settings.PayloadVerification != PAYLOAD_VERIFICATION_NONE) &&
+      EnableTestPattern(MilDigitizer, Results, Settings);
+   HookData.LinkSpeedMbps = GetLinkSpeed(MilDigitizer, Results.LinkSpeedSource[Results.Selection], Settings);
+   Results.LinkSpeedMbps[Results.Selection] = HookData.LinkSpeedMbps;
+   AllocateAcquisitionBuffers(MilSystem, MilDigitizer, BoardType, Results, HookData);
+   HookData.HostTimes.clear();
+   HookData.CameraTimes.clear();
+   }
+
+/* Apply a pixel format calibrated before and allocate its grab buffers. The payloads */
+/* are verified against the expected frame of the format's reference, if any.         */
+/* ---------------------------------------------------------------------------------- */
+void ReopenScheduledFormat(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType, PacketDelayResults& Results,
+                           const FormatSchedule& Schedule, HookDataStruct& HookData)
+   {
+   OpenScheduledFormat(MilSystem, MilDigitizer, BoardType, Results, HookData);
+   if(HookData.PayloadCompare && Schedule.ExpectedFrameValid &&
+      HookData.ExpectedFrame.size() == Schedule.ExpectedFrame.size())
+      {
+      HookData.ExpectedFrame = Schedule.ExpectedFrame;
+      HookData.ExpectedFrameValid = true;
+      }
+   else
+      HookData.PayloadCompare = M_NULL;
+   }
+
+/* Acquire a sequence with a delay and narrow the bounds of the optimal delay. A      */
+/* delay that keeps the frame rate raises the lower bound; one that reduces it lowers */
+/* the upper bound. Delays that corrupt the payloads are too small to be used.        */
+/* ---------------------------------------------------------------------------------- */
+void MeasureScheduledDelay(MIL_ID MilDigitizer, FormatSchedule& Schedule, HookDataStruct& HookData,
+                           MIL_INT DelayTickVal)
+   {
+   PacketDelayInfo& Info = Schedule.Info;
+   SequenceSummary Summary;
+   MIL_DOUBLE StartTime = 0, EndTime = 0;
+
+   MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+   SetInterPacketDelay(MilDigitizer, HookData, DelayTickVal);
+   Info.ProcessFrameRate = AcquireSequence(MilDigitizer, HookData);
+   SummarizeSequence(HookData, DelayTickVal, Info.ProcessFrameRate, Summary);
+   Info.Measurements.push_back(Summary);
+   MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+   Schedule.AcquisitionTime = max(Schedule.AcquisitionTime, EndTime - StartTime);
+   MosPrintf(MIL_TEXT("."));
+
+   if(Summary.PayloadFramesCorrupted > 0 && DelayTickVal > Info.CorruptedDelayTickVal)
+      Info.CorruptedDelayTickVal = DelayTickVal;
+
+   if(IsEqual(Info.BaseFrameRate, Info.ProcessFrameRate) && IsTailWithinBounds(Info, Summary, *HookData.Settings))
+      Schedule.LowerTickVal = max(Schedule.LowerTickVal, DelayTickVal);
+   else if(Schedule.UpperTickVal < 0 || DelayTickVal < Schedule.UpperTickVal)
+      Schedule.UpperTickVal = DelayTickVal;
+   }
+
+/* Return the width of the bounds relative to the upper bound; 1 while unbounded. */
+/* ------------------------------------------------------------------------------ */
+MIL_DOUBLE GetScheduleUncertainty(const FormatSchedule& Schedule)
+   {
+   if(Schedule.UpperTickVal <= 0)
+      return 1.0;
+   return (MIL_DOUBLE)(Schedule.UpperTickVal - Schedule.LowerTickVal) / Schedule.UpperTickVal;
+   }
+
+/* Store the best delay so far of the selected pixel format: the lower bound of the  */
+/* optimal delay less the margin of ApplyDelayMargin, which is verified on the       */
+/* payloads when the format is open with its expected frame.                         */
+/* --------------------------------------------------------------------------------- */
+void StoreScheduledResult(MIL_ID MilDigitizer, FormatSchedule& Schedule, PacketDelayResults& Results,
+                          HookDataStruct& HookData)
+   {
+   PacketDelayInfo& Info = Schedule.Info;
+   SequenceSummary Solution;
+
+   /* Keep the measurement of the lower bound last for the report. */
+   for(size_t i = 0; i < Info.Measurements.size(); i++)
+      {
+      if(Info.Measurements[i].DelayTickVal == Schedule.LowerTickVal)
+         {
+         Solution = Info.Measurements[i];
+         Info.Measurements.erase(Info.Measurements.begin() + i);
+         Info.Measurements.push_back(Solution);
+         Info.ProcessFrameRate = Solution.FrameRate;
+         break;
+         }
+      }
+
+   Info.Error = (Schedule.LowerTickVal == 0 || Schedule.LowerTickVal <= Info.CorruptedDelayTickVal ||
+                 Info.TickFreq == 0);
+   if(Info.Error)
+      {
+      Info.DelayTickVal = 0;
+      Info.DelayInSeconds = 0.0;
+      }
+   else
+      {
+      Info.DelayTickVal = Schedule.LowerTickVal;
+      Info.DelayInSeconds = (MIL_DOUBLE)Info.DelayTickVal / Info.TickFreq;
+      ApplyDelayMargin(MilDigitizer, Info, HookData);
+      }
+
+   Results.InterPacketDelayInTicks[Results.Selection] = Info.DelayTickVal;
+   Results.InterPacketDelayInSec[Results.Selection] = Info.DelayInSeconds;
+   Results.ObtainedFrameRate[Results.Selection] = Info.ProcessFrameRate;
+   Results.Measurements[Results.Selection] = Info.Measurements;
+   Results.DelayLowerBound[Results.Selection] = Schedule.LowerTickVal;
+   Results.DelayUpperBound[Results.Selection] = Schedule.UpperTickVal;
+   }
+
+/* Set the inter-packet delay in the camera, unless a trace is replayed. */
+/* --------------------------------------------------------------------- */
+void SetInterPacketDelay(MIL_ID MilDigitizer, HookDataStruct& HookData, MIL_INT DelayTickVal)
+   {
+   HookData.DelayTickVal = DelayTickVal;
+   if(HookData.Replay)
+      return;
+
+   if(HookData.ThroughputControl)
+      {
+      MIL_INT64 Limit = GetThroughputLimit(HookData, (MIL_DOUBLE)DelayTickVal / THROUGHPUT_LIMIT_TICK_FREQ);
+      MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("DeviceLinkThroughputLimit"), M_TYPE_INT64, &Limit);
+      }
+   else
+      MdigControl(MilDigitizer, M_GC_INTER_PACKET_DELAY, DelayTickVal);
+   }
+
+/* Create the timing trace and have the hook record the time of each frame. */
+/* ------------------------------------------------------------------------ */
+FILE* OpenTraceFile(const char* FileName, HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+   FILE* File = fopen(FileName, "wb");
+   if(!File)
+      {
+      MosPrintf(MIL_TEXT("Cannot create %s; the timing trace is not recorded.\n"), ToMilString(FileName).c_str());
+      return NULL;
+      }
+   fwrite(TRACE_FILE_MAGIC, 1, strlen(TRACE_FILE_MAGIC), File);
+   HookData.FrameTimes.assign(Settings.SequenceFrameCount, 0.0);
+   return File;
+   }
+
+/* Append the format record of the selected pixel format, once its reference frame  */
+/* rate and theoretical delay are known.                                           */
+/* ------------------------------------------------------------------------------- */
+void WriteTraceFormat(const PacketDelayInfo& Info, const PacketDelayResults& Results, HookDataStruct& HookData)
+   {
+   TraceRecordHeader Header;
+   TraceFormatRecord Format;
+   string PixelFormat = ToNarrowString(Results.PixelFormats[Results.Selection]);
+
+   memset(&Format, 0, sizeof(Format));
+   Format.FormatIndex = (MIL_INT64)Results.Selection;
+   strncpy(Format.PixelFormat, PixelFormat.c_str(), sizeof(Format.PixelFormat) - 1);
+   Format.TickFreq = (MIL_DOUBLE)Info.TickFreq;
+   Format.PacketWireTime = HookData.PacketWireTime;
+   Format.LinkSpeedMbps = HookData.LinkSpeedMbps;
+   Format.PacketsPerFrame = HookData.PacketsPerFrame;
+   Format.TheoreticalTickVal = Info.DelayTickVal;
+   Format.PayloadVerified = (HookData.PayloadCompare != M_NULL);
+
+   Header.Type = TRACE_RECORD_FORMAT;
+   Header.Size = sizeof(Format);
+   fwrite(&Header, sizeof(Header), 1, HookData.TraceFile);
+   fwrite(&Format, sizeof(Format), 1, HookData.TraceFile);
+   fflush(HookData.TraceFile);
+   }
+
+/* Append the window record of the sequence just acquired, tagged with the pixel    */
+/* format selected in the tuner's results.                                          */
+/* -------------------------------------------------------------------------------- */
+void WriteTraceWindow(HookDataStruct& HookData, MIL_DOUBLE FrameRate)
+   {
+   TraceRecordHeader Header;
+   TraceWindowRecord Window;
+   vector<TraceFrameRecord> Frames(min(HookData.FrameCount, (MIL_INT)HookData.FrameTimes.size()));
+
+   for(size_t i = 0; i < Frames.size(); i++)
+      {
+      Frames[i].HostTime = HookData.FrameTimes[i];
+      Frames[i].CameraTime = (i < HookData.CameraTimes.size()) ? HookData.CameraTimes[i] : 0;
+      }
+
+   Window.FormatIndex = (HookData.Control && HookData.Control->Results) ?
+      (MIL_INT64)HookData.Control->Results->Selection : 0;
+   Window.DelayTickVal = HookData.DelayTickVal;
+   Window.FrameRate = FrameRate;
+   Window.FrameCount = HookData.FrameCount;
+   Window.FramesMissed = HookData.FramesMissed;
+   Window.FramesCorrupted = HookData.FramesCorrupted;
+   Window.FramesIncomplete = HookData.FramesIncomplete;
+   Window.PacketsMissing = HookData.PacketsMissing;
+   Window.PayloadFramesChecked = HookData.PayloadFramesChecked;
+   Window.PayloadFramesCorrupted = HookData.PayloadFramesCorrupted;
+   Window.PayloadBytesCorrupted = HookData.PayloadBytesCorrupted;
+   Window.MaxHookDuration = HookData.MaxHookDuration;
+   Window.NbFrames = (MIL_INT64)Frames.size();
+
+   Header.Type = TRACE_RECORD_WINDOW;
+   Header.Size = (MIL_UINT32)(sizeof(Window) + Frames.size() * sizeof(TraceFrameRecord));
+   fwrite(&Header, sizeof(Header), 1, HookData.TraceFile);
+   fwrite(&Window, sizeof(Window), 1, HookData.TraceFile);
+   if(!Frames.empty())
+      fwrite(&Frames[0], sizeof(TraceFrameRecord), Frames.size(), HookData.TraceFile);
+   fflush(HookData.TraceFile);
+   }
+
+/* Read a timing trace. The reference sequence of a format, its last window before   */
+/* its format record, is the first window of the format; a format without one is   */
+/* dropped. Returns false if the file is not a trace.                                */
+/* --------------------------------------------------------------------------------- */
+bool ReadTraceFile(const char* FileName, vector<TraceFormat>& Formats)
+   {
+   TraceRecordHeader Header;
+   char Magic[sizeof(TRACE_FILE_MAGIC)] = {0};
+   map<MIL_INT64, vector<TraceWindow> > Pending;
+   map<MIL_INT64, size_t> FormatPositions;
+
+   FILE* File = fopen(FileName, "rb");
+   if(!File)
+      return false;
+   if(fread(Magic, 1, strlen(TRACE_FILE_MAGIC), File) != strlen(TRACE_FILE_MAGIC) ||
+      strcmp(Magic, TRACE_FILE_MAGIC) != 0)
+      {
+      fclose(File);
+      return false;
+      }
+
+   while(fread(&Header, sizeof(Header), 1, File) == 1)
+      {
+      if(Header.Type == TRACE_RECORD_FORMAT && Header.Size == sizeof(TraceFormatRecord))
+         {
+         TraceFormat Format;
+         if(fread(&Format.Format, sizeof(TraceFormatRecord), 1, File) != 1)
+            break;
+         vector<TraceWindow>& FormatPending = Pending[Format.Format.FormatIndex];
+         if(!FormatPending.empty())
+            {
+            Format.Windows.push_back(FormatPending.back());
+            FormatPositions[Format.Format.FormatIndex] = Formats.size();
+            Formats.push_back(Format);
+            }
+         Pending.erase(Format.Format.FormatIndex);
+         }
+      else if(Header.Type == TRACE_RECORD_WINDOW && Header.Size >= sizeof(TraceWindowRecord))
+         {
+         TraceWindow Window;
+         if(fread(&Window.Record, sizeof(TraceWindowRecord), 1, File) != 1 || Window.Record.NbFrames < 0 ||
+            Header.Size != sizeof(TraceWindowRecord) + Window.Record.NbFrames * sizeof(TraceFrameRecord))
+            break;
+         Window.Frames.resize((size_t)Window.Record.NbFrames);
+         if(!Window.Frames.empty() &&
+            fread(&Window.Frames[0], sizeof(TraceFrameRecord), Window.Frames.size(), File) != Window.Frames.size())
+            break;
+         map<MIL_INT64, size_t>::const_iterator Position = FormatPositions.find(Window.Record.FormatIndex);
+         if(Position != FormatPositions.end())
+            Formats[Position->second].Windows.push_back(Window);
+         else
+            Pending[Window.Record.FormatIndex].push_back(Window);
+         }
+      else if(fseek(File, Header.Size, SEEK_CUR) != 0)
+         break;
+      }
+   fclose(File);
+
+   for(size_t i = 0; i < Formats.size(); i++)
+      {
+      for(size_t j = 0; j < Formats[i].Windows.size(); j++)
+         Formats[i].WindowsByDelay[Formats[i].Windows[j].Record.DelayTickVal].push_back(j);
+      }
+   return true;
+   }
+
+/* Replace the acquisition of a sequence with a recorded one at the nearest delay,   */
+/* the smaller one on a tie, and return its frame rate. A format without windows     */
+/* replays an empty sequence.                                                        */
+/* --------------------------------------------------------------------------------- */
+MIL_DOUBLE ReplaySequence(HookDataStruct& HookData)
+   {
+   TraceFormat& Replay = *HookData.Replay;
+   if(Replay.WindowsByDelay.empty())
+      {
+      ResetHookData(HookData);
+      return 0.0;
+      }
+   map<MIL_INT64, vector<size_t> >::iterator Nearest = Replay.WindowsByDelay.lower_bound(HookData.DelayTickVal);
+
+   if(Nearest == Replay.WindowsByDelay.end() ||
+      (Nearest != Replay.WindowsByDelay.begin() && Nearest->first != HookData.DelayTickVal))
+      {
+      map<MIL_INT64, vector<size_t> >::iterator Below = Nearest;
+      --Below;
+      if(Nearest == Replay.WindowsByDelay.end() ||
+         HookData.DelayTickVal - Below->first <= Nearest->first - HookData.DelayTickVal)
+         Nearest = Below;
+      }
+
+   Replay.NbRequests++;
+   if(Nearest->first != HookData.DelayTickVal)
+      Replay.NbInexactRequests++;
+
+   size_t& Next = Replay.NextWindow[Nearest->first];
+   const TraceWindow& Window = Replay.Windows[Nearest->second[Next]];
+   Next = (Next + 1) % Nearest->second.size();
+
+   RestoreTraceWindow(Window, HookData);
+   return Window.Record.FrameRate;
+   }
+
+/* Fill the hook data as the hook and AcquireSequence would have for a recorded     */
+/* sequence.                                                                        */
+/* -------------------------------------------------------------------------------- */
+void RestoreTraceWindow(const TraceWindow& Window, HookDataStruct& HookData)
+   {
+   ResetHookData(HookData);
+   for(size_t i = 0; i < Window.Frames.size(); i++)
+      {
+      if(i > 0)
+         {
+         MIL_DOUBLE Interval = Window.Frames[i].HostTime - Window.Frames[i - 1].HostTime;
+         if(Interval > HookData.MaxFrameInterval)
+            HookData.MaxFrameInterval = Interval;
+         AddToHistogram(HookData.Intervals, Interval);
+         }
+      HookData.PreviousFrameTime = Window.Frames[i].HostTime;
+      if(i < HookData.HostTimes.size())
+         {
+         HookData.HostTimes[i] = Window.Frames[i].HostTime;
+         HookData.CameraTimes[i] = Window.Frames[i].CameraTime;
+         }
+      }
+   HookData.FrameCount = (MIL_INT)Window.Record.FrameCount;
+   HookData.FramesMissed = (MIL_INT)Window.Record.FramesMissed;
+   HookData.FramesCorrupted = (MIL_INT)Window.Record.FramesCorrupted;
+   HookData.FramesIncomplete = (MIL_INT)Window.Record.FramesIncomplete;
+   HookData.PacketsMissing = (MIL_INT)Window.Record.PacketsMissing;
+   HookData.PayloadFramesChecked = (MIL_INT)Window.Record.PayloadFramesChecked;
+   HookData.PayloadFramesCorrupted = (MIL_INT)Window.Record.PayloadFramesCorrupted;
+   HookData.PayloadBytesCorrupted = Window.Record.PayloadBytesCorrupted;
+   HookData.MaxHookDuration = Window.Record.MaxHookDuration;
+   }
+
+/* Run the iterative search TraceReplayRuns times on each pixel format of a trace    */
+/* and print the distribution of the delays found. Only the iterative search is      */
+/* replayed, whatever the mode the trace was recorded in.                            */
+/* --------------------------------------------------------------------------------- */
+int ReplayTrace(const char* FileName, const PacketDelaySettings& Settings)
+   {
+   vector<TraceFormat> Formats;
+   PacketDelayResults Results;
+   HookDataStruct HookData;
+
+   if(!ReadTraceFile(FileName, Formats) || Formats.empty())
+      {
+      MosPrintf(MIL_TEXT("%s is not a timing trace or holds no pixel format.\n"), ToMilString(FileName).c_str());
+      return 0;
+      }
+
+   for(size_t i = 0; i < Formats.size(); i++)
+      Results.PixelFormats.push_back(ToMilString(Formats[i].Format.PixelFormat));
+   ResizeResults(Results, (MIL_INT)Formats.size());
+   HookData.Placement = &Results.Placement;
+   HookData.Settings = &Settings;
+
+   MosPrintf(MIL_TEXT("\nReplaying %s: %d pixel formats, %d runs each.\n\n"), ToMilString(FileName).c_str(),
+      (int)Formats.size(), (int)Settings.TraceReplayRuns);
+
+   for(Results.Selection = 0; Results.Selection < Formats.size(); Results.Selection++)
+      {
+      TraceFormat& Format = Formats[Results.Selection];
+      MIL_INT MinTickVal = -1, MaxTickVal = 0, NbErrors = 0;
+      MIL_DOUBLE SumTickVal = 0;
+      size_t NbMeasurements = 0;
+      chrono::steady_clock::time_point StartTime = chrono::steady_clock::now();
+
+      HookData.Replay = &Format;
+      HookData.PacketWireTime = Format.Format.PacketWireTime;
+      HookData.LinkSpeedMbps = (MIL_INT)Format.Format.LinkSpeedMbps;
+      HookData.PacketsPerFrame = (MIL_INT)Format.Format.PacketsPerFrame;
+      HookData.PayloadCompare = Format.Format.PayloadVerified ? GetPayloadCompareFunction() : M_NULL;
+
+      for(MIL_INT Run = 0; Run < Settings.TraceReplayRuns; Run++)
+         {
+         /* The reference is always the recorded one. */
+         PacketDelayInfo Info;
+         Info.TickFreq = (MIL_UINT64)Format.Format.TickFreq;
+         RestoreTraceWindow(Format.Windows[0], HookData);
+         Info.BaseFrameRate = Format.Windows[0].Record.FrameRate;
+         SummarizeSequence(HookData, 0, Info.BaseFrameRate, Info.ReferenceIntervals);
+         Info.DelayTickVal = (MIL_INT)Format.Format.TheoreticalTickVal;
+         Info.DelayInSeconds = Info.TickFreq ? (MIL_DOUBLE)Info.DelayTickVal / Info.TickFreq : 0.0;
+         Results.ReferenceFrameRate[Results.Selection] = Info.BaseFrameRate;
+         Results.ReferenceIntervals[Results.Selection] = Info.ReferenceIntervals;
+
+         FindInterPacketDelay(M_NULL, Info, Results, HookData);
+         NbMeasurements += Info.Measurements.size();
+         if(Info.Error)
+            {
+            NbErrors++;
+            continue;
+            }
+         SumTickVal += Info.DelayTickVal;
+         MinTickVal = (MinTickVal < 0) ? Info.DelayTickVal : min(MinTickVal, Info.DelayTickVal);
+         MaxTickVal = max(MaxTickVal, Info.DelayTickVal);
+         }
+
+      MIL_DOUBLE Elapsed = chrono::duration<MIL_DOUBLE>(chrono::steady_clock::now() - StartTime).count();
+      MosPrintf(MIL_TEXT("\n%s: %d windows recorded.\n"), Results.PixelFormats[Results.Selection].c_str(),
+         (int)Format.Windows.size());
+      if(NbErrors < Settings.TraceReplayRuns)
+         MosPrintf(MIL_TEXT("Delay found:          %d/%.1f/%d ticks (min/mean/max)\n"), (int)MinTickVal,
+            SumTickVal / (Settings.TraceReplayRuns - NbErrors), (int)MaxTickVal);
+      MosPrintf(MIL_TEXT("Searches failed:      %d of %d\n"), (int)NbErrors, (int)Settings.TraceReplayRuns);
+      MosPrintf(MIL_TEXT("Sequences per search: %.1f (%d of %d at a delay not recorded)\n"),
+         (MIL_DOUBLE)NbMeasurements / Settings.TraceReplayRuns, (int)Format.NbInexactRequests, (int)Format.NbRequests);
+      MosPrintf(MIL_TEXT("Searches per second:  %.0f\n"), Elapsed > 0 ? Settings.TraceReplayRuns / Elapsed : 0.0);
+      }
+   MosPrintf(MIL_TEXT("\n"));
+   return 0;
+   }
+
+/* Map a frame log for writing. The file is created with a capacity of              */
+/* Capacity records unless it already holds a log, which is appended to. Another     */
+/* existing file is left untouched. A log shorter than its capacity is not mapped,   */
+/* since writing past its end would raise a bus error.                               */
+/* --------------------------------------------------------------------------------- */
+bool OpenFrameLog(const char* FileName, MIL_UINT64 Capacity, FrameLogFile& Log)
+   {
+   FrameLogHeaderData Header;
+   MIL_UINT64 FileSize = 0;
+   bool Exists = false;
+
+   /* Read the header of an existing log for its capacity. */
+   FILE* File = fopen(FileName, "rb");
+   if(File)
+      {
+      Exists = (fread(&Header, sizeof(Header), 1, File) == 1 &&
+                memcmp(Header.Magic, FRAME_LOG_MAGIC, sizeof(Header.Magic)) == 0 &&
+                Header.RecordSize == sizeof(FrameLogRecord));
+      fclose(File);
+      if(!Exists)
+         {
+         MosPrintf(MIL_TEXT("%s exists and is not a frame log.\n"), ToMilString(FileName).c_str());
+         return false;
+         }
+      Capacity = Header.Capacity;
+      }
+   Log.MappedSize = (size_t)(sizeof(FrameLogHeader) + Capacity * sizeof(FrameLogRecord));
+
+#if M_MIL_USE_WINDOWS
+   Log.File = CreateFileA(FileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                          Exists ? OPEN_EXISTING : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+   if(Log.File == INVALID_HANDLE_VALUE)
+      return false;
+   LARGE_INTEGER Size;
+   if(Exists && GetFileSizeEx(Log.File, &Size))
+      FileSize = (MIL_UINT64)Size.QuadPart;
+#else
+   Log.File = open(FileName, O_RDWR | O_CREAT, 0644);
+   if(Log.File < 0)
+      return false;
+   struct stat Status;
+   if(Exists && fstat(Log.File, &Status) == 0)
+      FileSize = (MIL_UINT64)Status.st_size;
+#endif
+   if(Exists && FileSize < Log.MappedSize)
+      {
+      MosPrintf(MIL_TEXT("%s is shorter than its capacity of %llu records.\n"), ToMilString(FileName).c_str(),
+         (unsigned long long)Capacity);
+      CloseFrameLog(Log);
+      return false;
+      }
+
+#if M_MIL_USE_WINDOWS
+   Log.Mapping = CreateFileMappingA(Log.File, NULL, PAGE_READWRITE, (DWORD)((MIL_UINT64)Log.MappedSize >> 32),
+                                    (DWORD)Log.MappedSize, NULL);
+   if(Log.Mapping)
+      Log.Header = (FrameLogHeader*)MapViewOfFile(Log.Mapping, FILE_MAP_WRITE, 0, 0, Log.MappedSize);
+#else
+   if(!Exists && ftruncate(Log.File, (off_t)Log.MappedSize) != 0)
+      {
+      CloseFrameLog(Log);
+      return false;
+      }
+   void* Address = mmap(NULL, Log.MappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, Log.File, 0);
+   Log.Header = (Address == MAP_FAILED) ? NULL : (FrameLogHeader*)Address;
+#endif
+   if(!Log.Header)
+      {
+      CloseFrameLog(Log);
+      return false;
+      }
+   Log.Records = (FrameLogRecord*)(Log.Header + 1);
+
+   /* The new file is all zeros; only the header needs to be written. */
+   if(!Exists)
+      {
+      memcpy(Log.Header->Magic, FRAME_LOG_MAGIC, sizeof(Log.Header->Magic));
+      Log.Header->RecordSize = sizeof(FrameLogRecord);
+      Log.Header->Capacity = Capacity;
+      Log.Header->NbReserved.store(0, memory_order_relaxed);
+      }
+   return true;
+   }
+
+/* Unmap a frame log; the system writes the pages back to the file. */
+/* ---------------------------------------------------------------- */
+void CloseFrameLog(FrameLogFile& Log)
+   {
+#if M_MIL_USE_WINDOWS
+   if(Log.Header)
+      UnmapViewOfFile(Log.Header);
+   if(Log.Mapping)
+      CloseHandle(Log.Mapping);
+   if(Log.File != INVALID_HANDLE_VALUE)
+      CloseHandle(Log.File);
+   Log.Mapping = NULL;
+   Log.File = INVALID_HANDLE_VALUE;
+#else
+   if(Log.Header)
+      munmap(Log.Header, Log.MappedSize);
+   if(Log.File >= 0)
+      close(Log.File);
+   Log.File = -1;
+#endif
+   Log.Header = NULL;
+   Log.Records = NULL;
+   }
+
+/* Append a record to the frame log. Called from the hook; any number of writers can */
+/* append at the same time without locking.                                          */
+/* --------------------------------------------------------------------------------- */
+void AppendFrameLog(FrameLogFile& Log, const FrameLogRecordData& Record)
+   {
+   MIL_UINT64 Index = Log.Header->NbReserved.fetch_add(1, memory_order_relaxed);
+   if(Index >= Log.Header->Capacity)
+      {
+      Log.NbDropped.fetch_add(1, memory_order_relaxed);
+      return;
+      }
+
+   FrameLogRecord& Slot = Log.Records[Index];
+   Slot.HostTime = Record.HostTime;
+   Slot.CameraTime = Record.CameraTime;
+   Slot.DelayTickVal = Record.DelayTickVal;
+   Slot.FrameIndex = Record.FrameIndex;
+   Slot.PacketsMissing = Record.PacketsMissing;
+   Slot.Digitizer = Record.Digitizer;
+   Slot.Status = Record.Status;
+   Slot.Committed.store(1, memory_order_release);
+   }
+
+/* Scan a frame log and print, for each delay, the frames, the losses and the         */
+/* longest interval between two frames of the same sequence of a digitizer. The log   */
+/* is read into plain records, up to its end if it is truncated; records being        */
+/* written while it is read may be skipped.                                           */
+/* ---------------------------------------------------------------------------------- */
+int ReadFrameLog(const char* FileName)
+   {
+   /* Statistics of the frames logged with one delay. */
+   struct DelayStats
+      {
+      DelayStats() { NbFrames = 0; NbIncomplete = 0; NbCorrupted = 0; PacketsMissing = 0; MaxInterval = 0; }
+      MIL_UINT64 NbFrames;
+      MIL_UINT64 NbIncomplete;
+      MIL_UINT64 NbCorrupted;
+      MIL_UINT64 PacketsMissing;
+      MIL_DOUBLE MaxInterval;
+      };
+
+   /* Records read at once. */
+   const size_t ChunkSize = 65536;
+
+   FrameLogHeaderData Header;
+   vector<FrameLogRecordData> Records(ChunkSize);
+   map<MIL_INT32, DelayStats> Stats;
+   map<MIL_UINT32, MIL_DOUBLE> PreviousTimes;
+   MIL_UINT64 NbCommitted = 0, NbRead = 0;
+   MIL_DOUBLE FirstTime = 0, LastTime = 0;
+   chrono::steady_clock::time_point StartTime = chrono::steady_clock::now();
+
+   FILE* File = fopen(FileName, "rb");
+   if(!File || fread(&Header, sizeof(Header), 1, File) != 1 ||
+      memcmp(Header.Magic, FRAME_LOG_MAGIC, sizeof(Header.Magic)) != 0 || Header.RecordSize != sizeof(FrameLogRecord))
+      {
+      if(File)
+         fclose(File);
+      MosPrintf(MIL_TEXT("%s is not a frame log.\n"), ToMilString(FileName).c_str());
+      return 0;
+      }
+
+   MIL_UINT64 NbRecords = min(Header.NbReserved, Header.Capacity);
+   while(NbRead < NbRecords)
+      {
+      size_t NbChunk = fread(&Records[0], sizeof(FrameLogRecordData), (size_t)min((MIL_UINT64)ChunkSize, NbRecords - NbRead), File);
+      if(NbChunk == 0)
+         break;
+      NbRead += NbChunk;
+
+      for(size_t i = 0; i < NbChunk; i++)
+         {
+         const FrameLogRecordData& Record = Records[i];
+         if(!Record.Committed)
+            continue;
+
+         DelayStats& Delay = Stats[Record.DelayTickVal];
+         Delay.NbFrames++;
+         Delay.PacketsMissing += Record.PacketsMissing;
+         if(Record.Status & FRAME_STATUS_INCOMPLETE)
+            Delay.NbIncomplete++;
+         if(Record.Status & FRAME_STATUS_CORRUPTED)
+            Delay.NbCorrupted++;
+
+         /* The interval is taken from the previous frame of the same digitizer. */
+         map<MIL_UINT32, MIL_DOUBLE>::iterator Previous = PreviousTimes.find(Record.Digitizer);
+         if(Previous != PreviousTimes.end() && !(Record.Status & FRAME_STATUS_FIRST))
+            Delay.MaxInterval = max(Delay.MaxInterval, Record.HostTime - Previous->second);
+         PreviousTimes[Record.Digitizer] = Record.HostTime;
+
+         FirstTime = (NbCommitted == 0) ? Record.HostTime : min(FirstTime, Record.HostTime);
+         LastTime = max(LastTime, Record.HostTime);
+         NbCommitted++;
+         }
+      }
+   fclose(File);
+   MIL_DOUBLE Elapsed = chrono::duration<MIL_DOUBLE>(chrono::steady_clock::now() - StartTime).count();
+
+   MosPrintf(MIL_TEXT("\n%s: %llu frames of %d digitizers over %.1f s (%llu records reserved, %llu capacity).\n"),
+      ToMilString(FileName).c_str(), (unsigned long long)NbCommitted, (int)PreviousTimes.size(), LastTime - FirstTime,
+      (unsigned long long)Header.NbReserved, (unsigned long long)Header.Capacity);
+   if(NbRead < NbRecords)
+      MosPrintf(MIL_TEXT("The log is truncated after %llu of its %llu records.\n"), (unsigned long long)NbRead,
+         (unsigned long long)NbRecords);
+   MosPrintf(MIL_TEXT("Scanned in %.3f s.\n\n"), Elapsed);
+   MosPrintf(MIL_TEXT("Delay (ticks)      Frames  Incomplete  Corrupted  Packets missing  Max interval (ms)\n"));
+   for(map<MIL_INT32, DelayStats>::const_iterator It = Stats.begin(); It != Stats.end(); ++It)
+      {
+      MosPrintf(MIL_TEXT("%13d  %10llu  %10llu  %9llu  %15llu  %17.3f\n"), (int)It->first,
+         (unsigned long long)It->second.NbFrames, (unsigned long long)It->second.NbIncomplete,
+         (unsigned long long)It->second.NbCorrupted, (unsigned long long)It->second.PacketsMissing,
+         It->second.MaxInterval * 1e3);
+      }
+   MosPrintf(MIL_TEXT("\n"));
+   return 0;
+   }
+
+/* Stream continuously at the calculated delay for ValidationDurationSec and        */
+/* decide whether the delay passes. The statistics are kept online, so the memory   */
+/* used does not depend on the duration.                                            */
+/* -------------------------------------------------------------------------------- */
+void ValidateInterPacketDelay(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results,
+                              HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+   ValidationResult& Validation = Results.Validations[Results.Selection];
+   ValidationStats Stats;
+   OnlineStats FrameRates;
+   MIL_DOUBLE StartTime = 0, SnapshotTime = 0, Now = 0;
+   MIL_INT FramesMissed = 0, FramesCorrupted = 0, PreviousMissed = 0, PreviousCorrupted = 0;
+   MIL_UINT64 PreviousIncomplete = 0, PreviousPacketsMissing = 0, PreviousPayloadCorrupted = 0;
+   string PixelFormat = ToNarrowString(Results.PixelFormats[Results.Selection]);
+
+   /* Append the snapshots to the file, with a header if it is new. Every value but the
+      elapsed time is that of the snapshot's period. */
+   FILE* File = fopen(Results.ValidationSnapshotFileName.c_str(), "a");
+   if(File && ftell(File) == 0)
+      fprintf(File, "pixel_format,delay_ticks,elapsed_s,period_s,frames,frame_rate,frames_missed,frames_corrupted,"
+                    "frames_incomplete,packets_missing,payload_corrupted,interval_p99_ms,interval_max_ms\n");
+
+   MosPrintf(MIL_TEXT("\nValidating %d ticks for %d seconds.\n"), (int)Info.DelayTickVal, (int)Settings.ValidationDurationSec);
+   SetInterPacketDelay(MilDigitizer, HookData, Info.DelayTickVal);
+   ResetHookData(HookData);
+   HookData.Validation = &Stats;
+   MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+   SnapshotTime = StartTime;
+   MdigProcess(MilDigitizer, HookData.GrabBufferList, HookData.GrabBufferListSize,
+      M_START, M_DEFAULT, ProcessingFunction, &HookData);
+
+   bool Done = false;
+   while(!Done)
+      {
+      MosSleep(100);
+      MappTimer(M_DEFAULT, M_TIMER_READ, &Now);
+      Done = (Now - StartTime >= Settings.ValidationDurationSec) || IsCancelRequested(HookData);
+      if(!Done && Now - SnapshotTime < Settings.ValidationSnapshotSec)
+         continue;
+
+      /* Take the statistics of the period and start the next one. */
+      IntervalHistogram PeriodIntervals;
+      MIL_UINT64 PeriodFrames = 0, NbIncomplete = 0, PacketsMissing = 0, NbPayloadCorrupted = 0;
+      Stats.Lock.lock();
+      PeriodIntervals = Stats.PeriodIntervals;
+      PeriodFrames = Stats.PeriodFrames;
+      NbIncomplete = Stats.NbIncomplete;
+      PacketsMissing = Stats.PacketsMissing;
+      NbPayloadCorrupted = Stats.NbPayloadCorrupted;
+      ResetHistogram(Stats.PeriodIntervals);
+      Stats.PeriodFrames = 0;
+      Stats.Lock.unlock();
+      MdigInquire(MilDigitizer, M_PROCESS_FRAME_MISSED, &FramesMissed);
+      MdigInquire(MilDigitizer, M_PROCESS_FRAME_CORRUPTED, &FramesCorrupted);
+
+      /* The first period includes the start of the acquisition and the last one may be
+         a short remainder; only the full periods in between bound the frame rate. */
+      MIL_DOUBLE Period = Now - SnapshotTime;
+      MIL_DOUBLE FrameRate = (Period > 0) ? PeriodFrames / Period : 0.0;
+      if(Validation.NbSnapshots > 0 && Period >= Settings.ValidationSnapshotSec)
+         AddToOnlineStats(FrameRates, FrameRate);
+      Validation.NbSnapshots++;
+
+      MIL_INT PeriodMissed = FramesMissed - PreviousMissed;
+      MIL_INT PeriodCorrupted = FramesCorrupted - PreviousCorrupted;
+      MIL_UINT64 PeriodIncomplete = NbIncomplete - PreviousIncomplete;
+      MIL_UINT64 PeriodPacketsMissing = PacketsMissing - PreviousPacketsMissing;
+      MIL_UINT64 PeriodPayloadCorrupted = NbPayloadCorrupted - PreviousPayloadCorrupted;
+      MosPrintf(MIL_TEXT("%7.0f s: %.2f fps, %d missed, %d corrupted, %d incomplete, p99 %.3f msec, max %.3f msec\n"),
+         Now - StartTime, FrameRate, (int)PeriodMissed, (int)PeriodCorrupted, (int)PeriodIncomplete,
+         GetHistogramPercentile(PeriodIntervals, 0.99)*1e3, PeriodIntervals.MaxInterval*1e3);
+      if(File)
+         {
+         fprintf(File, "%s,%d,%.1f,%.1f,%llu,%.3f,%d,%d,%llu,%llu,%llu,%.4f,%.4f\n", PixelFormat.c_str(),
+            (int)Info.DelayTickVal, Now - StartTime, Period, (unsigned long long)PeriodFrames, FrameRate,
+            (int)PeriodMissed, (int)PeriodCorrupted, (unsigned long long)PeriodIncomplete,
+            (unsigned long long)PeriodPacketsMissing, (unsigned long long)PeriodPayloadCorrupted,
+            GetHistogramPercentile(PeriodIntervals, 0.99)*1e3, PeriodIntervals.MaxInterval*1e3);
+         fflush(File);
+         }
+      PreviousMissed = FramesMissed;
+      PreviousCorrupted = FramesCorrupted;
+      PreviousIncomplete = NbIncomplete;
+      PreviousPacketsMissing = PacketsMissing;
+      PreviousPayloadCorrupted = NbPayloadCorrupted;
+      SnapshotTime = Now;
+      }
+
+   MdigProcess(MilDigitizer, HookData.GrabBufferList, HookData.GrabBufferListSize,
+      M_STOP, M_DEFAULT, ProcessingFunction, &HookData);
+   MdigInquire(MilDigitizer, M_PROCESS_FRAME_MISSED, &FramesMissed);
+   MdigInquire(MilDigitizer, M_PROCESS_FRAME_CORRUPTED, &FramesCorrupted);
+   HookData.Validation = NULL;
+   if(File)
+      fclose(File);
+
+   /* Decide against the thresholds. */
+   MIL_UINT64 NbDamaged = FramesMissed + FramesCorrupted + Stats.NbIncomplete + Stats.NbPayloadCorrupted;
+   MIL_DOUBLE FramePeriod = (Info.BaseFrameRate > 0) ? 1.0 / Info.BaseFrameRate : 0.0;
+   Validation.Validated = true;
+   Validation.Duration = Now - StartTime;
+   Validation.NbFrames = Stats.NbFrames;
+   Validation.FramesMissed = FramesMissed;
+   Validation.FramesCorrupted = FramesCorrupted;
+   Validation.NbIncomplete = Stats.NbIncomplete;
+   Validation.NbPayloadCorrupted = Stats.NbPayloadCorrupted;
+   Validation.LossRatio = (Stats.NbFrames + FramesMissed > 0) ?
+                          (MIL_DOUBLE)NbDamaged / (Stats.NbFrames + FramesMissed) : 1.0;
+   Validation.FrameRate = (Validation.Duration > 0) ? Stats.NbFrames / Validation.Duration : 0.0;
+   Validation.MinFrameRate = (FrameRates.Count > 0) ? FrameRates.Min : Validation.FrameRate;
+   Validation.IntervalMean = Stats.IntervalStats.Mean;
+   Validation.IntervalStdDev = GetOnlineStdDev(Stats.IntervalStats);
+   Validation.IntervalP999 = GetHistogramPercentile(Stats.Intervals, 0.999);
+   Validation.IntervalMax = Stats.IntervalStats.Max;
+   Validation.Passed = Stats.NbFrames > 0 &&
+                       Validation.LossRatio <= Settings.ValidationMaxLossRatio &&
+                       Validation.MinFrameRate >= Info.BaseFrameRate * (1.0 - Settings.ValidationMaxRateDrop) &&
+                       Validation.IntervalP999 <= FramePeriod * Settings.ValidationMaxJitterRatio;
+   MosPrintf(MIL_TEXT("Validation %s.\n"), Validation.Passed ? MIL_TEXT("PASS") : MIL_TEXT("FAIL"));
+   }
+
+/* Add a value to running statistics. */
+/* ---------------------------------- */
+void AddToOnlineStats(OnlineStats& Stats, MIL_DOUBLE Value)
+   {
+   Stats.Count++;
+   MIL_DOUBLE Delta = Value - Stats.Mean;
+   Stats.Mean += Delta / Stats.Count;
+   Stats.M2 += Delta * (Value - Stats.Mean);
+   if(Stats.Count == 1 || Value < Stats.Min)
+      Stats.Min = Value;
+   if(Stats.Count == 1 || Value > Stats.Max)
+      Stats.Max = Value;
+   }
+
+/* Return the standard deviation of running statistics. */
+/* ---------------------------------------------------- */
+MIL_DOUBLE GetOnlineStdDev(const OnlineStats& Stats)
+   {
+   return (Stats.Count > 1) ? sqrt(Stats.M2 / (Stats.Count - 1)) : 0.0;
+   }
+
+/* Update the validation statistics with a frame. Called from the hook. */
+/* -------------------------------------------------------------------- */
+void RecordValidationFrame(ValidationStats& Stats, MIL_DOUBLE FrameTime, MIL_INT Missing, bool PayloadCorrupted)
+   {
+   lock_guard<mutex> Guard(Stats.Lock);
+   if(Stats.NbFrames > 0)
+      {
+      MIL_DOUBLE Interval = FrameTime - Stats.PreviousFrameTime;
+      AddToHistogram(Stats.Intervals, Interval);
+      AddToHistogram(Stats.PeriodIntervals, Interval);
+      AddToOnlineStats(Stats.IntervalStats, Interval);
+      }
+   Stats.PreviousFrameTime = FrameTime;
+   Stats.NbFrames++;
+   Stats.PeriodFrames++;
+   if(Missing > 0)
+      {
+      Stats.NbIncomplete++;
+      Stats.PacketsMissing += Missing;
+      }
+   if(PayloadCorrupted)
+      Stats.NbPayloadCorrupted++;
+   }
+
+/* Print the outcome of a validation run. */
+/* -------------------------------------- */
+void PrintValidation(const ValidationResult& Validation)
+   {
+   MosPrintf(MIL_TEXT("Validation:           %s after %.0f s, %llu frames in %d snapshots\n"),
+      Validation.Passed ? MIL_TEXT("PASS") : MIL_TEXT("FAIL"), Validation.Duration,
+      (unsigned long long)Validation.NbFrames, (int)Validation.NbSnapshots);
+   MosPrintf(MIL_TEXT("Validation losses:    %d missed, %d corrupted, %llu incomplete, %llu payload (%.2e)\n"),
+      (int)Validation.FramesMissed, (int)Validation.FramesCorrupted, (unsigned long long)Validation.NbIncomplete,
+      (unsigned long long)Validation.NbPayloadCorrupted, Validation.LossRatio);
+   MosPrintf(MIL_TEXT("Validation rate:      %.2f fps, lowest snapshot %.2f fps\n"), Validation.FrameRate,
+      Validation.MinFrameRate);
+   MosPrintf(MIL_TEXT("Validation intervals: mean %.3f, std %.3f, p99.9 %.3f, max %.3f msec\n"),
+      Validation.IntervalMean*1e3, Validation.IntervalStdDev*1e3, Validation.IntervalP999*1e3,
+      Validation.IntervalMax*1e3);
+   }
+
+/* Calibrate every camera of the system alone at its current pixel format, then      */
+/* stream all of them at their delay at the same time and compare their frame rates. */
+/* --------------------------------------------------------------------------------- */
+void RunContentionTest(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType, PacketDelayResults& Results,
+                       const HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+   MIL_INT NbCameras = 0, DefaultDevice = 0;
+   MIL_DOUBLE StartTime = 0, EndTime = 0;
+
+   MsysInquire(MilSystem, M_NUM_CAMERA_PRESENT, &NbCameras);
+   MdigInquire(MilDigitizer, M_NUMBER, &DefaultDevice);
+   NbCameras = max(NbCameras, DefaultDevice + 1);
+   vector<ContentionCamera> Cameras(NbCameras);
+   vector<PacketDelayResults> CameraResults(NbCameras, Results);
+
+   /* Calibrate each camera alone; the default digitizer is already allocated. */
+   for(MIL_INT i = 0; i < NbCameras; i++)
+      {
+      ContentionCamera& Camera = Cameras[i];
+      Camera.DeviceNumber = i;
+      if(i == DefaultDevice)
+         Camera.Digitizer = MilDigitizer;
+      else
+         {
+         MappControl(M_ERROR, M_PRINT_DISABLE);
+         MdigAlloc(MilSystem, M_DEV0 + i, MIL_TEXT("M_DEFAULT"), M_DEFAULT, &Camera.Digitizer);
+         MappControl(M_ERROR, M_PRINT_ENABLE);
+         }
+      if(Camera.Digitizer == M_NULL)
+         {
+         MosPrintf(MIL_TEXT("\nCamera %d could not be allocated.\n"), (int)i);
+         continue;
+         }
+      MdigInquire(Camera.Digitizer, M_CAMERA_MODEL, Camera.Model);
+      MdigInquireFeature(Camera.Digitizer, M_FEATURE_VALUE, MIL_TEXT("PixelFormat"), M_TYPE_STRING, Camera.PixelFormat);
+
+      /* The camera's results hold its current pixel format only. */
+      PacketDelayInfo Info;
+      CameraResults[i].PixelFormats.assign(1, Camera.PixelFormat);
+      ResizeResults(CameraResults[i], 1);
+      CameraResults[i].Selection = 0;
+      CameraResults[i].Checkpointing = false;
+      Camera.Placement = Results.Placement;
+      Camera.HookData.Placement = &Camera.Placement;
+      Camera.HookData.Settings = HookData.Settings;
+
+      /* Open the bandwidth control of the other cameras; the default digitizer's was
+         opened with the tuner. */
+      if(i == DefaultDevice)
+         {
+         Camera.HookData.ThroughputControl = HookData.ThroughputControl;
+         Camera.HookData.ThroughputLimitMin = HookData.ThroughputLimitMin;
+         Camera.HookData.ThroughputLimitMax = HookData.ThroughputLimitMax;
+         }
+      else if(OpenBandwidthControl(Camera.Digitizer, CameraResults[i], Camera.HookData) == 0)
+         {
+         MosPrintf(MIL_TEXT("\nCamera %d has no bandwidth control.\n"), (int)i);
+         continue;
+         }
+      MosPrintf(MIL_TEXT("\n\nCamera %d: %s.\n"), (int)i, Camera.Model.c_str());
+      CalibratePixelFormat(MilSystem, Camera.Digitizer, BoardType, Info, CameraResults[i], Camera.HookData);
+      Camera.Calibrated = !Info.Error && Info.ProcessFrameRate > 0;
+      Camera.DelayTickVal = Info.Error ? 0 : Info.DelayTickVal;
+      Camera.TickFreq = Info.TickFreq;
+      MdigInquire(Camera.Digitizer, M_GC_PACKET_SIZE, &Camera.PacketSize);
+
+      /* Keep grab buffers of the camera's own for the contention run. */
+      AllocateAcquisitionBuffers(MilSystem, Camera.Digitizer, BoardType, CameraResults[i], Camera.HookData);
+      }
+
+   /* Raise the delays to those the switches' buffers require. */
+   vector<SwitchInfo> Switches;
+   ParseSwitchTopology(Settings.SwitchTopology.c_str(), Switches);
+   for(size_t k = 0; k < Switches.size(); k++)
+      ApplySwitchModel(Switches[k], Cameras);
+   for(MIL_INT i = 0; i < NbCameras; i++)
+      {
+      Cameras[i].DelayTickVal = max(Cameras[i].DelayTickVal, Cameras[i].ModelDelayTickVal);
+      if(Cameras[i].Digitizer != M_NULL)
+         SetInterPacketDelay(Cameras[i].Digitizer, Cameras[i].HookData, Cameras[i].DelayTickVal);
+      }
+
+   /* Measure each camera alone at the delay it streams with under contention. */
+   for(MIL_INT i = 0; i < NbCameras; i++)
+      {
+      ContentionCamera& Camera = Cameras[i];
+      if(Camera.HookData.GrabBufferListSize > 0)
+         Camera.IsolatedFrameRate = AcquireSequence(Camera.Digitizer, Camera.HookData);
+      }
+
+   /* Stream all the cameras at once. */
+   MosPrintf(MIL_TEXT("\nStreaming %d cameras at once for %d seconds.\n"), (int)NbCameras, (int)Settings.ContentionDurationSec);
+   vector<ValidationStats> Stats(NbCameras);
+   MappTimer(M_DEFAULT, M_TIMER_READ, &StartTime);
+   for(MIL_INT i = 0; i < NbCameras; i++)
+      {
+      ContentionCamera& Camera = Cameras[i];
+      if(Camera.HookData.GrabBufferListSize == 0)
+         continue;
+      ResetHookData(Camera.HookData);
+      Camera.HookData.Validation = &Stats[i];
+      MdigProcess(Camera.Digitizer, Camera.HookData.GrabBufferList, Camera.HookData.GrabBufferListSize,
+         M_START, M_DEFAULT, ProcessingFunction, &Camera.HookData);
+      }
+   MosSleep(Settings.ContentionDurationSec * 1000);
+   MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+
+   for(MIL_INT i = 0; i < NbCameras; i++)
+      {
+      ContentionCamera& Camera = Cameras[i];
+      if(Camera.HookData.GrabBufferListSize == 0)
+         continue;
+      MdigProcess(Camera.Digitizer, Camera.HookData.GrabBufferList, Camera.HookData.GrabBufferListSize,
+         M_STOP, M_DEFAULT, ProcessingFunction, &Camera.HookData);
+      MdigInquire(Camera.Digitizer, M_PROCESS_FRAME_MISSED, &Camera.FramesMissed);
+      MdigInquire(Camera.Digitizer, M_PROCESS_FRAME_CORRUPTED, &Camera.FramesCorrupted);
+      Camera.HookData.Validation = NULL;
+      Camera.FramesDamaged = (MIL_INT)(Stats[i].NbIncomplete + Stats[i].NbPayloadCorrupted);
+      Camera.FrameRate = Stats[i].NbFrames / (EndTime - StartTime);
+      Camera.ThroughputMbps = Camera.FrameRate * Camera.HookData.FrameSizeByte * 8.0 / 1e6;
+      }
+
+   /* Release the cameras' resources. */
+   for(MIL_INT i = 0; i < NbCameras; i++)
+      {
+      ContentionCamera& Camera = Cameras[i];
+      FreeGrabBuffers(Camera.HookData);
+      if(Camera.Digitizer == M_NULL)
+         continue;
+      if(!Camera.HookData.ThroughputControl)
+         MdigControl(Camera.Digitizer, M_GC_INTER_PACKET_DELAY, 0);
+      else if(Camera.Digitizer != MilDigitizer)
+         RestoreThroughputControl(Camera.Digitizer, CameraResults[i]);
+      if(Settings.PayloadVerification != PAYLOAD_VERIFICATION_NONE)
+         RestoreTestPattern(Camera.Digitizer, CameraResults[i]);
+      if(Camera.Digitizer != MilDigitizer)
+         MdigFree(Camera.Digitizer);
+      }
+
+   PrintContentionTest(Cameras, EndTime - StartTime, Settings);
+
+   /* Compare the fan-in model with the losses measured. */
+   for(size_t k = 0; k < Switches.size(); k++)
+      {
+      for(MIL_INT i = Switches[k].FirstCamera; i < min(Switches[k].FirstCamera + Switches[k].NbCameras, NbCameras); i++)
+         {
+         if(Cameras[i].FramesMissed > 0 || Cameras[i].FramesCorrupted > 0 || Cameras[i].FramesDamaged > 0)
+            Switches[k].NbLossyCameras++;
+         }
+      }
+   if(!Switches.empty())
+      PrintSwitchModel(Switches, Cameras);
+   }
+
+/* Parse the switch topology, assigning the cameras to the switches in order. */
+/* -------------------------------------------------------------------------- */
+void ParseSwitchTopology(const char* TopologyStr, vector<SwitchInfo>& Switches)
+   {
+   const char* Ptr = TopologyStr;
+   MIL_INT FirstCamera = 0;
+   Switches.clear();
+
+   while(*Ptr)
+      {
+      long NbCameras = 0, UplinkMbps = 0;
+      long long BufferBytes = 0;
+      if(sscanf(Ptr, "%ld:%lld:%ld", &NbCameras, &BufferBytes, &UplinkMbps) == 3 &&
+         NbCameras > 0 && BufferBytes > 0 && UplinkMbps > 0)
+         {
+         SwitchInfo Switch;
+         Switch.NbCameras = NbCameras;
+         Switch.FirstCamera = FirstCamera;
+         Switch.BufferBytes = BufferBytes;
+         Switch.UplinkMbps = UplinkMbps;
+         Switches.push_back(Switch);
+         FirstCamera += NbCameras;
+         }
+
+      /* Skip to the next switch. */
+      while(*Ptr && *Ptr != ';')
+         Ptr++;
+      if(*Ptr)
+         Ptr++;
+      }
+   }
+
+/* Compute the packet period that keeps the switch's uplink buffer from overflowing */
+/* and the delay it requires from each camera of the switch. In the worst case, the */
+/* cameras send their frames at the same time: one packet of each arrives at once,  */
+/* and while the frames last, the queue grows by what the uplink cannot drain.      */
+/* Without growth the queue holds one packet per camera, so a period longer than    */
+/* the uplink's time to send those packets is never required.                      */
+/* -------------------------------------------------------------------------------- */
+void ApplySwitchModel(SwitchInfo& Switch, vector<ContentionCamera>& Cameras)
+   {
+   MIL_DOUBLE ArrivalBytes = 0, MinPeriod = 0;
+   MIL_INT PacketsPerFrame = 0;
+   MIL_DOUBLE DrainRate = Switch.UplinkMbps * 1e6 / 8.0;
+   MIL_INT LastCamera = min(Switch.FirstCamera + Switch.NbCameras, (MIL_INT)Cameras.size());
+
+   for(MIL_INT i = Switch.FirstCamera; i < LastCamera; i++)
+      {
+      if(Cameras[i].HookData.GrabBufferListSize == 0)
+         continue;
+      ArrivalBytes += (MIL_DOUBLE)(Cameras[i].PacketSize + ETHERNET_FRAME_OVERHEAD);
+      PacketsPerFrame = max(PacketsPerFrame, Cameras[i].HookData.PacketsPerFrame);
+      MinPeriod = max(MinPeriod, Cameras[i].HookData.PacketWireTime);
+      }
+   if(ArrivalBytes == 0 || PacketsPerFrame == 0)
+      return;
+
+   /* Q(T) = A + (A/T - D) * P * T <= B gives T >= (A * (P + 1) - B) / (D * P). */
+   MIL_DOUBLE DrainPeriod = ArrivalBytes / DrainRate;
+   MIL_DOUBLE BufferPeriod = (ArrivalBytes * (PacketsPerFrame + 1) - Switch.BufferBytes) / (DrainRate * PacketsPerFrame);
+   Switch.PacketPeriod = max(MinPeriod, min(DrainPeriod, BufferPeriod));
+   Switch.PeakQueueBytes = GetSwitchPeakQueue(ArrivalBytes, PacketsPerFrame, DrainRate, Switch.PacketPeriod);
+   Switch.Feasible = (ArrivalBytes <= Switch.BufferBytes);
+
+   for(MIL_INT i = Switch.FirstCamera; i < LastCamera; i++)
+      {
+      ContentionCamera& Camera = Cameras[i];
+      if(Camera.HookData.GrabBufferListSize == 0)
+         continue;
+      MIL_DOUBLE Delay = max(Switch.PacketPeriod - Camera.HookData.PacketWireTime, 0.0);
+      Camera.ModelDelayTickVal = (MIL_INT)ceil(Delay * Camera.TickFreq);
+      }
+   }
+
+/* Return the worst-case occupancy of a switch's uplink buffer, in bytes. */
+/* ---------------------------------------------------------------------- */
+MIL_DOUBLE GetSwitchPeakQueue(MIL_DOUBLE ArrivalBytes, MIL_INT PacketsPerFrame, MIL_DOUBLE DrainRate,
+                              MIL_DOUBLE PacketPeriod)
+   {
+   if(PacketPeriod <= 0)
+      return ArrivalBytes * PacketsPerFrame;
+   MIL_DOUBLE Growth = max(ArrivalBytes / PacketPeriod - DrainRate, 0.0);
+   return ArrivalBytes + Growth * PacketsPerFrame * PacketPeriod;
+   }
+
+/* Print the fan-in model of each switch and whether the losses measured agree. */
+/* ---------------------------------------------------------------------------- */
+void PrintSwitchModel(const vector<SwitchInfo>& Switches, const vector<ContentionCamera>& Cameras)
+   {
+   for(size_t k = 0; k < Switches.size(); k++)
+      {
+      const SwitchInfo& Switch = Switches[k];
+      bool Fits = Switch.Feasible && Switch.PeakQueueBytes <= Switch.BufferBytes;
+      MosPrintf(MIL_TEXT("Switch %d:             cameras %d to %d, %lld bytes of buffer, %d Mbit/s uplink\n"),
+         (int)k, (int)Switch.FirstCamera, (int)(Switch.FirstCamera + Switch.NbCameras - 1),
+         (long long)Switch.BufferBytes, (int)Switch.UplinkMbps);
+      MosPrintf(MIL_TEXT("Switch %d model:       packet period %.3f usec, peak queue %.0f bytes (%.0f%%)%s\n"),
+         (int)k, Switch.PacketPeriod*1e6, Switch.PeakQueueBytes, Switch.PeakQueueBytes * 100.0 / Switch.BufferBytes,
+         Switch.Feasible ? MIL_TEXT("") : MIL_TEXT(", one packet per camera overflows"));
+      for(MIL_INT i = Switch.FirstCamera; i < min(Switch.FirstCamera + Switch.NbCameras, (MIL_INT)Cameras.size()); i++)
+         {
+         const ContentionCamera& Camera = Cameras[i];
+         MIL_DOUBLE FrameTime = Camera.HookData.PacketsPerFrame * Switch.PacketPeriod;
+         MosPrintf(MIL_TEXT("Camera %d model delay: %d ticks%s\n"), (int)i, (int)Camera.ModelDelayTickVal,
+            (Camera.IsolatedFrameRate > 0 && FrameTime * Camera.IsolatedFrameRate > 1.0) ?
+            MIL_TEXT(", longer than the frame period") : MIL_TEXT(""));
+         }
+      MosPrintf(MIL_TEXT("Switch %d measured:    %d of %d cameras lost frames; %s\n"), (int)k,
+         (int)Switch.NbLossyCameras, (int)Switch.NbCameras,
+         (Fits == (Switch.NbLossyCameras == 0)) ? MIL_TEXT("the model agrees") :
+         Fits ? MIL_TEXT("losses the model does not predict") : MIL_TEXT("no loss although the model predicts overflow"));
+      }
+   MosPrintf(MIL_TEXT("\n"));
+   }
+
+/* Print the frame rates obtained alone and under contention, flagging the cameras */
+/* that degrade.                                                                   */
+/* ------------------------------------------------------------------------------- */
+void PrintContentionTest(const vector<ContentionCamera>& Cameras, MIL_DOUBLE Duration, const PacketDelaySettings& Settings)
+   {
+   MIL_DOUBLE TotalThroughput = 0;
+   MIL_INT NbDegraded = 0;
+
+   MosPrintf(MIL_TEXT("\n\nContention test over %.0f seconds\n"), Duration);
+   MosPrintf(MIL_TEXT("----------------------------------------------------------\n"));
+   for(size_t i = 0; i < Cameras.size(); i++)
+      {
+      const ContentionCamera& Camera = Cameras[i];
+      if(Camera.HookData.GrabBufferListSize == 0)
+         {
+         MosPrintf(MIL_TEXT("Camera %d:             not tested\n"), (int)i);
+         continue;
+         }
+      MIL_DOUBLE Drop = (Camera.IsolatedFrameRate > 0) ? 1.0 - Camera.FrameRate / Camera.IsolatedFrameRate : 0.0;
+      bool Degraded = Camera.FramesMissed > 0 || Camera.FramesCorrupted > 0 || Camera.FramesDamaged > 0 ||
+                      Drop > Settings.ValidationMaxRateDrop;
+      if(Degraded)
+         NbDegraded++;
+      TotalThroughput += Camera.ThroughputMbps;
+      MosPrintf(MIL_TEXT("Camera %d:             %s, %s, %d ticks%s\n"), (int)i, Camera.Model.c_str(),
+         Camera.PixelFormat.c_str(), (int)Camera.DelayTickVal, Camera.Calibrated ? MIL_TEXT("") : MIL_TEXT(" (not calibrated)"));
+      MosPrintf(MIL_TEXT("Camera %d frame rate:  %.2f fps alone, %.2f fps under contention (%+.1f%%)\n"), (int)i,
+         Camera.IsolatedFrameRate, Camera.FrameRate, -Drop * 100.0);
+      MosPrintf(MIL_TEXT("Camera %d losses:      %d missed, %d corrupted, %d incomplete or altered, %.1f Mbit/s%s\n"),
+         (int)i, (int)Camera.FramesMissed, (int)Camera.FramesCorrupted, (int)Camera.FramesDamaged, Camera.ThroughputMbps,
+         Degraded ? MIL_TEXT(" -> DEGRADED") : MIL_TEXT(""));
+      }
+   MosPrintf(MIL_TEXT("----------------------------------------------------------\n"));
+   MosPrintf(MIL_TEXT("Total throughput:     %.1f Mbit/s of payload\n"), TotalThroughput);
+   MosPrintf(MIL_TEXT("Degraded cameras:     %d of %d\n\n"), (int)NbDegraded, (int)Cameras.size());
+   }
+
+/* Record the progress of the selected pixel format and checkpoint the run. */
+/* ------------------------------------------------------------------------- */
+void SetFormatState(PacketDelayResults& Results, const PacketDelayInfo& Info, int State)
+   {
+   Results.FormatStates[Results.Selection] = State;
+   if(Results.Checkpointing)
+      SaveCheckpoint(Results, Info);
+   }
+
+/* Write the checkpoint: the results of the started pixel formats and the search     */
+/* state of the selected one. The file is replaced only once completely written, so  */
+/* an interruption while writing keeps the previous checkpoint.                       */
+/* ---------------------------------------------------------------------------------- */
+void SaveCheckpoint(const PacketDelayResults& Results, const PacketDelayInfo& Info)
+   {
+   string TempFileName = Results.CheckpointFileName + ".tmp";
+   FILE* File = fopen(TempFileName.c_str(), "w");
+   if(!File)
+      {
+      MosPrintf(MIL_TEXT("Unable to write %s.\n"), ToMilString(TempFileName.c_str()).c_str());
+      return;
+      }
+
+   fprintf(File, "%s\n", Results.CheckpointKey.c_str());
+   for(size_t i = 0; i < Results.PixelFormats.size(); i++)
+      {
+      if(Results.FormatStates[i] == FORMAT_STATE_PENDING)
+         continue;
+
+      fprintf(File, "format %d %d %s\n", (int)i, Results.FormatStates[i], ToNarrowString(Results.PixelFormats[i]).c_str());
+      fprintf(File, "result %d %lld %.17g %.17g %.17g %lld %lld %lld %d\n", (int)i,
+         (long long)Results.InterPacketDelayInTicks[i], Results.InterPacketDelayInSec[i],
+         Results.ReferenceFrameRate[i], Results.ObtainedFrameRate[i], (long long)Results.GrabBufferCount[i],
+         (long long)Results.GrabBufferSizeByte[i], (long long)Results.LinkSpeedMbps[i], Results.LinkSpeedSource[i]);
+      WriteSequenceSummary(File, "reference", i, Results.ReferenceIntervals[i]);
+      for(size_t j = 0; j < Results.Measurements[i].size(); j++)
+         WriteSequenceSummary(File, "measurement", i, Results.Measurements[i][j]);
+      for(size_t j = 0; j < Results.DelayCurves[i].size(); j++)
+         WriteSequenceSummary(File, "curve", i, Results.DelayCurves[i][j]);
+      if(i == Results.Selection)
+         {
+         for(size_t j = 0; j < Results.ResumeCurve.size(); j++)
+            WriteSequenceSummary(File, "curve", i, Results.ResumeCurve[j]);
+         }
+      for(size_t j = 0; j < Results.StreamChannels[i].size(); j++)
+         {
+         const StreamChannelInfo& Channel = Results.StreamChannels[i][j];
+         fprintf(File, "channel %d %lld %d %llu %lld %lld %.17g %lld %.17g %lld %lld %lld %.17g %d %lld %d %.17g %lld\n",
+            (int)i, (long long)Channel.Channel, Channel.Calibrated ? 1 : 0, (unsigned long long)Channel.TickFreq,
+            (long long)Channel.PacketSize, (long long)Channel.PacketsPerFrame, Channel.PacketWireTime,
+            (long long)Channel.LinkSpeedMbps, Channel.FrameRate, (long long)Channel.DelayTickVal,
+            (long long)Channel.ShareDelayTickVal, (long long)Channel.CombinedDelayTickVal, Channel.LinkShare,
+            Channel.Feasible ? 1 : 0, (long long)Channel.MaxDelayTickVal, Channel.Validated ? 1 : 0,
+            Channel.ValidatedFrameRate, (long long)Channel.FramesLost);
+         }
+      for(size_t j = 0; j < Results.TargetRates[i].size(); j++)
+         {
+         const TargetRateInfo& Target = Results.TargetRates[i][j];
+         fprintf(File, "target %d %.17g %.17g %.17g %.17g %lld %.17g %d %d\n", (int)i, Target.TargetFrameRate,
+            Target.AppliedFrameRate, Target.ReferenceFrameRate, Target.ObtainedFrameRate,
+            (long long)Target.DelayTickVal, Target.DelayInSeconds, Target.Error ? 1 : 0, Target.Accepted ? 1 : 0);
+         }
+      }
+
+   /* Search state of the pixel format being calibrated. */
+   if(Results.Selection < Results.PixelFormats.size() &&
+      Results.FormatStates[Results.Selection] != FORMAT_STATE_DONE)
+      {
+      fprintf(File, "info %d %.17g %.17g %.17g %llu %lld %lld %lld %lld %d\n", (int)Results.Selection,
+         Info.BaseFrameRate, Info.ProcessFrameRate, Info.DelayInSeconds, (unsigned long long)Info.TickFreq,
+         (long long)Info.DelayTickVal, (long long)Info.ProcessFrameCount, (long long)Info.EqualityCounter,
+         (long long)Info.CorruptedDelayTickVal, Info.Error ? 1 : 0);
+      WriteSequenceSummary(File, "inforeference", Results.Selection, Info.ReferenceIntervals);
+      for(size_t j = 0; j < Info.Measurements.size(); j++)
+         WriteSequenceSummary(File, "infomeasurement", Results.Selection, Info.Measurements[j]);
+      }
+   fclose(File);
+
+#if M_MIL_USE_WINDOWS
+   remove(Results.CheckpointFileName.c_str());
+#endif
+   rename(TempFileName.c_str(), Results.CheckpointFileName.c_str());
+   }
+
+/* Read the checkpoint of an interrupted run of the same camera, calibration mode    */
+/* and pixel formats. Nothing is restored if the checkpoint does not match.          */
+/* --------------------------------------------------------------------------------- */
+bool LoadCheckpoint(MIL_ID MilDigitizer, PacketDelayResults& Results, const PacketDelaySettings& Settings)
+   {
+   PacketDelayResults Loaded = Results;
+   char Line[2048];
+   bool Valid = true;
+
+   Results.CheckpointKey = GetCheckpointKey(MilDigitizer, Results, Settings);
+   Loaded.CheckpointKey = Results.CheckpointKey;
+   FILE* File = fopen(Results.CheckpointFileName.c_str(), "r");
+   if(!File)
+      return false;
+
+   if(!fgets(Line, sizeof(Line), File) || string(Line, strcspn(Line, "\r\n")) != Results.CheckpointKey)
+      {
+      fclose(File);
+      return false;
+      }
+
+   while(Valid && fgets(Line, sizeof(Line), File))
+      {
+      char Tag[32];
+      int Index = -1, Offset = 0;
+      if(sscanf(Line, "%31s %d %n", Tag, &Index, &Offset) < 2 || Index < 0 || Index >= (int)Results.PixelFormats.size())
+         {
+         Valid = false;
+         break;
+         }
+
+      const char* Fields = Line + Offset;
+      string TagStr = Tag;
+      SequenceSummary Summary;
+      if(TagStr == "format")
+         {
+         char PixelFormat[128];
+         int State = 0;
+         Valid = sscanf(Fields, "%d %127s", &State, PixelFormat) == 2 &&
+                 ToNarrowString(Results.PixelFormats[Index]) == PixelFormat;
+         Loaded.FormatStates[Index] = State;
+         }
+      else if(TagStr == "result")
+         {
+         long long DelayTickVal, BufferCount, BufferSize, LinkSpeed;
+
+         Valid = sscanf(Fields, "%lld %lf %lf %lf %lld %lld %lld %d", &DelayTickVal,
+            &Loaded.InterPacketDelayInSec[Index], &Loaded.ReferenceFrameRate[Index],
+            &Loaded.ObtainedFrameRate[Index], &BufferCount, &BufferSize, &LinkSpeed,
+            &Loaded.LinkSpeedSource[Index]) == 8;
+         Loaded.InterPacketDelayInTicks[Index] = (MIL_INT)DelayTickVal;
+         Loaded.GrabBufferCount[Index] = (MIL_INT)BufferCount;
+         Loaded.GrabBufferSizeByte[Index] = (MIL_INT64)BufferSize;
+         Loaded.LinkSpeedMbps[Index] = (MIL_INT)LinkSpeed;
+         }
+      else if(TagStr == "reference")
+         Valid = ReadSequenceSummary(Fields, Loaded.ReferenceIntervals[Index]);
+      else if(TagStr == "measurement" && (Valid = ReadSequenceSummary(Fields, Summary)))
+         Loaded.Measurements[Index].push_back(Summary);
+      else if(TagStr == "curve" && (Valid = ReadSequenceSummary(Fields, Summary)))
+         Loaded.DelayCurves[Index].push_back(Summary);
+      else if(TagStr == "channel")
+         {
+         StreamChannelInfo Channel;
+         long long Number, PacketSize, PacketsPerFrame, LinkSpeed, DelayTickVal, ShareDelayTickVal, CombinedDelayTickVal;
+         long long MaxDelayTickVal, FramesLost;
+         unsigned long long TickFreq;
+         int Calibrated, Feasible, Validated;
+         Valid = sscanf(Fields, "%lld %d %llu %lld %lld %lf %lld %lf %lld %lld %lld %lf %d %lld %d %lf %lld", &Number,
+            &Calibrated, &TickFreq, &PacketSize, &PacketsPerFrame, &Channel.PacketWireTime, &LinkSpeed,
+            &Channel.FrameRate, &DelayTickVal, &ShareDelayTickVal, &CombinedDelayTickVal, &Channel.LinkShare,
+            &Feasible, &MaxDelayTickVal, &Validated, &Channel.ValidatedFrameRate, &FramesLost) == 17;
+         Channel.Channel = (MIL_INT)Number;
+         Channel.Calibrated = (Calibrated != 0);
+         Channel.TickFreq = (MIL_UINT64)TickFreq;
+         Channel.PacketSize = (MIL_INT)PacketSize;
+         Channel.PacketsPerFrame = (MIL_INT)PacketsPerFrame;
+         Channel.LinkSpeedMbps = (MIL_INT)LinkSpeed;
+         Channel.DelayTickVal = (MIL_INT)DelayTickVal;
+         Channel.ShareDelayTickVal = (MIL_INT)ShareDelayTickVal;
+         Channel.CombinedDelayTickVal = (MIL_INT)CombinedDelayTickVal;
+         Channel.Feasible = (Feasible != 0);
+         Channel.MaxDelayTickVal = (MIL_INT)MaxDelayTickVal;
+         Channel.Validated = (Validated != 0);
+         Channel.FramesLost = (MIL_INT)FramesLost;
+         Loaded.StreamChannels[Index].push_back(Channel);
+         }
+      else if(TagStr == "target")
+         {
+         TargetRateInfo Target;
+         long long DelayTickVal;
+         int Error, Accepted;
+         Valid = sscanf(Fields, "%lf %lf %lf %lf %lld %lf %d %d", &Target.TargetFrameRate, &Target.AppliedFrameRate,
+            &Target.ReferenceFrameRate, &Target.ObtainedFrameRate, &DelayTickVal, &Target.DelayInSeconds,
+            &Error, &Accepted) == 8;
+         Target.DelayTickVal = (MIL_INT)DelayTickVal;
+         Target.Error = (Error != 0);
+         Target.Accepted = (Accepted != 0);
+         Loaded.TargetRates[Index].push_back(Target);
+         }
+      else if(TagStr == "info")
+         {
+         PacketDelayInfo& Info = Loaded.ResumeInfo;
+         long long DelayTickVal, ProcessFrameCount, EqualityCounter, CorruptedDelayTickVal;
+         unsigned long long TickFreq;
+         int Error;
+         Valid = sscanf(Fields, "%lf %lf %lf %llu %lld %lld %lld %lld %d", &Info.BaseFrameRate,
+            &Info.ProcessFrameRate, &Info.DelayInSeconds, &TickFreq, &DelayTickVal, &ProcessFrameCount,
+            &EqualityCounter, &CorruptedDelayTickVal, &Error) == 9;
+         Info.TickFreq = (MIL_UINT64)TickFreq;
+         Info.DelayTickVal = (MIL_INT)DelayTickVal;
+         Info.ProcessFrameCount = (MIL_INT)ProcessFrameCount;
+         Info.EqualityCounter = (MIL_INT)EqualityCounter;
+         Info.CorruptedDelayTickVal = (MIL_INT)CorruptedDelayTickVal;
+         Info.Error = (Error != 0);
+         }
+      else if(TagStr == "inforeference")
+         Valid = ReadSequenceSummary(Fields, Loaded.ResumeInfo.ReferenceIntervals);
+      else if(TagStr == "infomeasurement" && (Valid = ReadSequenceSummary(Fields, Summary)))
+         Loaded.ResumeInfo.Measurements.push_back(Summary);
+      }
+   fclose(File);
+
+   if(!Valid)
+      {
+      MosPrintf(MIL_TEXT("Ignoring the invalid checkpoint %s.\n"), ToMilString(Results.CheckpointFileName.c_str()).c_str());
+      return false;
+      }
+   Results = Loaded;
+   return true;
+   }
+
+/* Return the first line of the checkpoint, identifying the camera, the calibration  */
+/* mode and the number of pixel formats.                                             */
+/* --------------------------------------------------------------------------------- */
+string GetCheckpointKey(MIL_ID MilDigitizer, const PacketDelayResults& Results, const PacketDelaySettings& Settings)
+   {
+   MIL_STRING Model;
+   char Key[512];
+
+   MdigInquire(MilDigitizer, M_CAMERA_MODEL, Model);
+   snprintf(Key, sizeof(Key), "camera %s %s %d %d", ToSingleWord(ToNarrowString(Model)).c_str(),
+      GetCameraSerialNumber(MilDigitizer).c_str(), Settings.CalibrationMode, (int)Results.PixelFormats.size());
+   return string(Key);
+   }
+
+/* Write a sequence summary on one line of the checkpoint. */
+/* ------------------------------------------------------- */
+void WriteSequenceSummary(FILE* File, const char* Tag, size_t Index, const SequenceSummary& Summary)
+   {
+   fprintf(File, "%s %d %lld %.17g %lld %lld %lld %lld %lld %lld %lld", Tag, (int)Index,
+      (long long)Summary.DelayTickVal, Summary.FrameRate, (long long)Summary.FramesMissed,
+      (long long)Summary.FramesCorrupted, (long long)Summary.FramesIncomplete, (long long)Summary.PacketsMissing,
+      (long long)Summary.PayloadFramesCorrupted, (long long)Summary.PayloadBytesCorrupted,
+      (long long)Summary.FramesNotDelivered);
+   fprintf(File, " %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g\n",
+      Summary.BurstTime, Summary.BurstTimeMax, Summary.LatencyMean, Summary.LatencyP50, Summary.LatencyP99,
+      Summary.LatencyMax, Summary.TransferP50, Summary.TransferP99, Summary.TransferMax, Summary.SpreadRatio,
+      Summary.Mean, Summary.StdDev, Summary.P50, Summary.P99, Summary.P999, Summary.Max);
+   }
+
+/* Read a sequence summary written by WriteSequenceSummary, after its tag and index. */
+/* --------------------------------------------------------------------------------- */
+bool ReadSequenceSummary(const char* Fields, SequenceSummary& Summary)
+   {
+   long long DelayTickVal, FramesMissed, FramesCorrupted, FramesIncomplete, PacketsMissing;
+   long long PayloadFramesCorrupted, PayloadBytesCorrupted, FramesNotDelivered;
+
+   if(sscanf(Fields, "%lld %lf %lld %lld %lld %lld %lld %lld %lld %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf",
+      &DelayTickVal, &Summary.FrameRate, &FramesMissed, &FramesCorrupted, &FramesIncomplete, &PacketsMissing,
+      &PayloadFramesCorrupted, &PayloadBytesCorrupted, &FramesNotDelivered, &Summary.BurstTime,
+      &Summary.BurstTimeMax, &Summary.LatencyMean, &Summary.LatencyP50, &Summary.LatencyP99, &Summary.LatencyMax,
+      &Summary.TransferP50, &Summary.TransferP99, &Summary.TransferMax, &Summary.SpreadRatio, &Summary.Mean,
+      &Summary.StdDev, &Summary.P50, &Summary.P99, &Summary.P999, &Summary.Max) != 25)
+      return false;
+
+   Summary.DelayTickVal = (MIL_INT)DelayTickVal;
+   Summary.FramesMissed = (MIL_INT)FramesMissed;
+   Summary.FramesCorrupted = (MIL_INT)FramesCorrupted;
+   Summary.FramesIncomplete = (MIL_INT)FramesIncomplete;
+   Summary.PacketsMissing = (MIL_INT)PacketsMissing;
+   Summary.PayloadFramesCorrupted = (MIL_INT)PayloadFramesCorrupted;
+   Summary.PayloadBytesCorrupted = (MIL_INT64)PayloadBytesCorrupted;
+   Summary.FramesNotDelivered = (MIL_INT)FramesNotDelivered;
+   return true;
+   }
+
+/* Calculate the inter-packet delay of the selected pixel format at each target      */
+/* frame rate. The results of the pixel format are those of the first target the     */
+/* camera accepts; the others are calibrated in a copy of the results and reported   */
+/* per target.                                                                       */
+/* --------------------------------------------------------------------------------- */
+void CalibrateTargetFrameRates(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType, PacketDelayInfo& Info,
+                               PacketDelayResults& Results, HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+   vector<MIL_DOUBLE> FrameRates;
+   bool FirstAccepted = true;
+   ParseFrameRateList(Settings.TargetFrameRates.c_str(), FrameRates);
+   vector<TargetRateInfo>& TargetRates = Results.TargetRates[Results.Selection];
+   TargetRates.assign(FrameRates.size(), TargetRateInfo());
+
+   /* The frame rate range depends on the pixel format, so apply it first. */
+   ApplyPixelFormat(MilDigitizer, Results);
+
+   Info = PacketDelayInfo();
+   for(size_t i = 0; i < FrameRates.size() && !HookData.Cancelled; i++)
+      {
+      TargetRateInfo& TargetInfo = TargetRates[i];
+      TargetInfo.TargetFrameRate = FrameRates[i];
+      TargetInfo.Accepted = ApplyTargetFrameRate(MilDigitizer, Results, FrameRates[i], TargetInfo.AppliedFrameRate);
+      if(!TargetInfo.Accepted)
+         {
+         MosPrintf(MIL_TEXT("\nThe camera does not accept a frame rate of %.2f fps.\n"), FrameRates[i]);
+         TargetInfo.Error = true;
+         continue;
+         }
+
+      MosPrintf(MIL_TEXT("\n\nTarget frame rate of %.2f fps.\n"), TargetInfo.AppliedFrameRate);
+      if(FirstAccepted)
+         {
+         FirstAccepted = false;
+         CalibratePixelFormat(MilSystem, MilDigitizer, BoardType, Info, Results, HookData);
+         RecordTargetFrameRate(Info, TargetInfo);
+         }
+      else
+         {
+         PacketDelayResults TargetResults = Results;
+         PacketDelayInfo TargetRunInfo;
+         TargetResults.Checkpointing = false;
+         CalibratePixelFormat(MilSystem, MilDigitizer, BoardType, TargetRunInfo, TargetResults, HookData);
+         RecordTargetFrameRate(TargetRunInfo, TargetInfo);
+         }
+      }
+
+   /* Without an accepted target, the pixel format has no results. */
+   if(FirstAccepted)
+      Info.Error = true;
+   }
+
+/* Parse a comma-separated list of frame rates. */
+/* -------------------------------------------- */
+void ParseFrameRateList(const char* FrameRateListStr, vector<MIL_DOUBLE>& FrameRates)
+   {
+   const char* Ptr = FrameRateListStr;
+   FrameRates.clear();
+
+   while(*Ptr)
+      {
+      char* End = NULL;
+      MIL_DOUBLE FrameRate = strtod(Ptr, &End);
+      if(End == Ptr)
+         {
+         /* Skip separators and invalid characters. */
+         Ptr++;
+         continue;
+         }
+      Ptr = End;
+      if(FrameRate > 0.0)
+         FrameRates.push_back(FrameRate);
+      }
+   }
+
+/* Set the camera's frame rate, saving the original configuration the first time.    */
+/* Cameras following older SFNC versions name the feature AcquisitionFrameRateAbs.  */
+/* --------------------------------------------------------------------------------- */
+bool ApplyTargetFrameRate(MIL_ID MilDigitizer, PacketDelayResults& Results, MIL_DOUBLE FrameRate,
+                          MIL_DOUBLE& AppliedFrameRate)
+   {
+   MIL_BOOL Present = M_FALSE;
+   MIL_BOOL Enable = M_TRUE;
+
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   if(Results.FrameRateFeature.empty())
+      {
+      Results.FrameRateFeature = MIL_TEXT("AcquisitionFrameRate");
+      MdigInquireFeature(MilDigitizer, M_FEATURE_PRESENT, Results.FrameRateFeature.c_str(), M_TYPE_BOOLEAN, &Present);
+      if(!Present)
+         Results.FrameRateFeature = MIL_TEXT("AcquisitionFrameRateAbs");
+      MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, Results.FrameRateFeature.c_str(), M_TYPE_DOUBLE, &Results.OriginalFrameRate);
+      MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("AcquisitionFrameRateEnable"), M_TYPE_BOOLEAN, &Results.OriginalFrameRateEnable);
+      }
+
+   AppliedFrameRate = 0;
+   MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("AcquisitionFrameRateEnable"), M_TYPE_BOOLEAN, &Enable);
+   MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, Results.FrameRateFeature.c_str(), M_TYPE_DOUBLE, &FrameRate);
+   MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, Results.FrameRateFeature.c_str(), M_TYPE_DOUBLE, &AppliedFrameRate);
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+
+   /* The camera may round the frame rate to its own resolution. */
+   return AppliedFrameRate > 0.0 && fabs(AppliedFrameRate - FrameRate) <= FrameRate * 0.01;
+   }
+
+/* Restore the camera's original frame rate configuration. */
+/* ------------------------------------------------------- */
+void RestoreFrameRate(MIL_ID MilDigitizer, PacketDelayResults& Results)
+   {
+   if(Results.FrameRateFeature.empty())
+      return;
+
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   if(Results.OriginalFrameRate > 0.0)
+      MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, Results.FrameRateFeature.c_str(), M_TYPE_DOUBLE, &Results.OriginalFrameRate);
+   MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("AcquisitionFrameRateEnable"), M_TYPE_BOOLEAN, &Results.OriginalFrameRateEnable);
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+   }
+
+/* Record the calibration at a target frame rate. */
+/* ---------------------------------------------- */
+void RecordTargetFrameRate(const PacketDelayInfo& Info, TargetRateInfo& TargetInfo)
+   {
+   TargetInfo.ReferenceFrameRate = Info.BaseFrameRate;
+   TargetInfo.ObtainedFrameRate = Info.ProcessFrameRate;
+   TargetInfo.DelayTickVal = Info.DelayTickVal;
+   TargetInfo.DelayInSeconds = Info.DelayInSeconds;
+   TargetInfo.Error = Info.Error;
+   }
+
+/* Print the delay calculated at each target frame rate. */
+/* ----------------------------------------------------- */
+void PrintTargetFrameRates(const vector<TargetRateInfo>& TargetRates)
+   {
+   for(size_t i = 0; i < TargetRates.size(); i++)
+      {
+      const TargetRateInfo& Info = TargetRates[i];
+      if(!Info.Accepted)
+         MosPrintf(MIL_TEXT("Target %7.2f fps:    not accepted by the camera\n"), Info.TargetFrameRate);
+      else
+         MosPrintf(MIL_TEXT("Target %7.2f fps:    %d ticks (%.3f usec)%s, reference %.1f, obtained %.1f fps\n"),
+            Info.AppliedFrameRate, (int)Info.DelayTickVal, Info.DelayInSeconds*1e6,
+            Info.Error ? MIL_TEXT(" not found") : MIL_TEXT(""), Info.ReferenceFrameRate, Info.ObtainedFrameRate);
+      }
+   }
+
+/* Set the camera's pixel format to the next value. */
+/* ------------------------------------------------ */
+void ApplyPixelFormat(MIL_ID MilDigitizer, PacketDelayResults& Results)
+   {
+   MIL_INT64 AccessMode = 0;
+
+   /* Wait for PixelFormat to become writable before writing. */
+   MdigInquireFeature(MilDigitizer, M_FEATURE_ACCESS_MODE, MIL_TEXT("PixelFormat"), M_TYPE_INT64, &AccessMode);
+   while (M_FEATURE_IS_WRITABLE(AccessMode) == M_FALSE)
+      {
+      MdigInquireFeature(MilDigitizer, M_FEATURE_ACCESS_MODE, MIL_TEXT("PixelFormat"), M_TYPE_INT64, &AccessMode);
+      MosSleep(250);
+      }
+
+   MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("PixelFormat"), M_TYPE_STRING, Results.PixelFormats[Results.Selection]);
+   }
+
+/* Allocate acquisition buffers compatible with the camera's pixel format. The size  */
+/* of the grab queue is computed from a short probe acquisition.                     */
+/* --------------------------------------------------------------------------------- */
+void AllocateAcquisitionBuffers(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType,
+                                PacketDelayResults& Results, HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+   MIL_INT SizeBand = 1;
+   MIL_INT BufType = 8+M_UNSIGNED;
+   MIL_INT64 AdditionalAttributes = 0;
+   MIL_INT64 BufferSizeByte = 0;
+
+   /* On the M_GIGE_VISION system, turn off the pixel-format switching feature. */
+   /* Also turn off the automatic Bayer conversion feature. */
+   /* We must also allocate grab buffers that are of the same format as the camera. */
+   if(BoardType == M_GIGE_VISION)
+      {
+      MdigControl(MilDigitizer, M_GC_PIXEL_FORMAT_SWITCHING, M_DISABLE);
+      MdigControl(MilDigitizer, M_BAYER_CONVERSION, M_DISABLE);
+      GetMilBufferInfoFromPixelFormat(MilDigitizer, SizeBand, BufType, AdditionalAttributes);
+      }
+
+   /* Allocate the minimum grab queue; it is used to probe the frame period. */
+   FreeGrabBuffers(HookData);
+   AllocateGrabBuffers(MilSystem, MilDigitizer, SizeBand, BufType, AdditionalAttributes,
+      Settings.BufferingSizeMin, HookData);
+
+   if(HookData.GrabBufferListSize > 0)
+      {
+      MbufInquire(HookData.GrabBufferList[0], M_SIZE_BYTE, &BufferSizeByte);
+
+      /* Size the grab queue as required by the measured frame period and hook
+         latency. The frame checks are prepared first so that the probe includes their
+         cost in the hook latency. The probe's queue is freed down to a count below it,
+         e.g. under a memory budget smaller than the minimum queue. */
+      PrepareFrameChecks(MilDigitizer, HookData.GrabBufferList[0], HookData);
+      MIL_INT Count = ComputeGrabBufferCount(MilDigitizer, BufferSizeByte, HookData);
+      while(HookData.GrabBufferListSize > Count)
+         MbufFree(HookData.GrabBufferList[--HookData.GrabBufferListSize]);
+      AllocateGrabBuffers(MilSystem, MilDigitizer, SizeBand, BufType, AdditionalAttributes, Count, HookData);
+      }
+
+   /* Compute the packet layout of the grab buffers for the frame checks. */
+   if(HookData.GrabBufferListSize > 0)
+      PrepareFrameChecks(MilDigitizer, HookData.GrabBufferList[0], HookData);
+
+   Results.GrabBufferCount[Results.Selection] = HookData.GrabBufferListSize;
+   Results.GrabBufferSizeByte[Results.Selection] = BufferSizeByte * HookData.GrabBufferListSize;
+
+   MosPrintf(MIL_TEXT("Using %d grab buffers (%.1f MB).\n"), (int)HookData.GrabBufferListSize,
+      (MIL_DOUBLE)Results.GrabBufferSizeByte[Results.Selection] / (1024.0 * 1024.0));
+   }
+
+/* Append grab buffers to the grab queue until it holds Count buffers, and clear them. */
+/* ----------------------------------------------------------------------------------- */
+void AllocateGrabBuffers(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT SizeBand, MIL_INT BufType,
+                         MIL_INT64 Attribute, MIL_INT Count, HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+
+   MappControl(M_DEFAULT, M_ERROR, M_PRINT_DISABLE);
+   MIL_INT MaxCount = min(Settings.BufferingSizeMax, (MIL_INT)GRAB_BUFFER_LIST_CAPACITY);
+   for(; HookData.GrabBufferListSize < Count && HookData.GrabBufferListSize < MaxCount;
+      HookData.GrabBufferListSize++)
+      {
+      MbufAllocColor(MilSystem,
+         SizeBand,
+         MdigInquire(MilDigitizer, M_SIZE_X, M_NULL),
+         MdigInquire(MilDigitizer, M_SIZE_Y, M_NULL),
+         BufType,
+         M_IMAGE+M_GRAB+M_PROC+Attribute,
+         &HookData.GrabBufferList[HookData.GrabBufferListSize]);
+
+      if (HookData.GrabBufferList[HookData.GrabBufferListSize])
+         {
+         MbufClear(HookData.GrabBufferList[HookData.GrabBufferListSize], 0xFF);
+         }
+      else
+         break;
+      }
+   MappControl(M_DEFAULT, M_ERROR, M_PRINT_ENABLE);
+   }
+
+/* Free the grab queue. */
+/* -------------------- */
+void FreeGrabBuffers(HookDataStruct& HookData)
+   {
+   while(HookData.GrabBufferListSize > 0)
+      MbufFree(HookData.GrabBufferList[--HookData.GrabBufferListSize]);
+   }
+
+/* Compute the number of grab buffers needed to absorb the worst-case hook latency   */
+/* at the camera's frame rate, within the memory budget.                             */
+/* --------------------------------------------------------------------------------- */
+MIL_INT ComputeGrabBufferCount(MIL_ID MilDigitizer, MIL_INT64 BufferSizeByte, HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+   MIL_DOUBLE FrameRate = 0, FramePeriod = 0, HookLatency = 0;
+   MIL_INT Count = Settings.BufferingSizeMin, BudgetCount = Settings.BufferingSizeMax;
+
+   /* Probe the frame period with the inter-packet delay to zero. In burst mode, the
+      camera might wait for external triggers; the queue holds a whole burst instead. */
+   if(Settings.CalibrationMode == CALIBRATION_MODE_BURST)
+      Count = Settings.BurstFrameCount + 2;
+   else
+      {
+      /* The probe is neither part of the timing trace nor an iteration of the progress. */
+      FILE* TraceFile = HookData.TraceFile;
+      HookData.TraceFile = NULL;
+      HookData.Probing = true;
+      SetInterPacketDelay(MilDigitizer, HookData, 0);
+      FrameRate = AcquireSequence(MilDigitizer, HookData);
+      HookData.Probing = false;
+      HookData.TraceFile = TraceFile;
+      }
+
+   if(FrameRate > 0)
+      {
+      FramePeriod = 1.0 / FrameRate;
+
+      /* The worst-case latency is the longest delay of a frame past its expected
+         arrival, plus the time spent in the hook and the user's allowance. The probe
+         runs the same hook, frame checks included, as the measurements. */
+      HookLatency = HookData.MaxFrameInterval - FramePeriod;
+      if(HookLatency < 0)
+         HookLatency = 0;
+      HookLatency += HookData.MaxHookDuration + Settings.HookLatencyAllowanceMs / 1000.0;
+
+      /* One buffer per frame arriving during the latency, plus the buffer being
+         processed and the buffer being grabbed. */
+      Count = (MIL_INT)(HookLatency / FramePeriod + 0.999) + 2;
+      }
+
+   if(BufferSizeByte > 0)
+      BudgetCount = (MIL_INT)(((MIL_INT64)Settings.BufferingMemoryBudgetMB * 1024 * 1024) / BufferSizeByte);
+
+   if(Count > Settings.BufferingSizeMax)
+      Count = Settings.BufferingSizeMax;
+   if(Count > GRAB_BUFFER_LIST_CAPACITY)
+      Count = GRAB_BUFFER_LIST_CAPACITY;
+   if(Count < Settings.BufferingSizeMin)
+      Count = Settings.BufferingSizeMin;
+
+   /* The memory budget is applied last. Below the buffer being processed and the buffer
+      being grabbed, the queue is kept at two buffers anyway. The number of buffers
+      actually allocated is printed with the grab queue. */
+   if(Count > BudgetCount)
+      {
+      Count = BudgetCount > 2 ? BudgetCount : 2;
+      MosPrintf(MIL_TEXT("The memory budget of %d MB limits the grab queue; frames might be ")
+         MIL_TEXT("missed during hook latencies.\n"), (int)Settings.BufferingMemoryBudgetMB);
+      }
+
+   if(Settings.PrintDetails)
+      MosPrintf(MIL_TEXT("Frame period: %.3f msec, worst-case hook latency: %.3f msec.\n"),
+         FramePeriod * 1e3, HookLatency * 1e3);
+
+   return Count;
+   }
+
+/* Reset the per-sequence hook data before starting MdigProcess. */
+/* ------------------------------------------------------------- */
+void ResetHookData(HookDataStruct& HookData)
+   {
+   /* The hook thread placement is (re)applied on the first frame of each sequence. */
+   HookData.Placement->Configured = false;
+   HookData.FrameCount = 0;
+   HookData.PreviousFrameTime = 0;
+   HookData.MaxFrameInterval = 0;
+   HookData.MaxHookDuration = 0;
+   ResetHistogram(HookData.Intervals);
+   HookData.FramesMissed = 0;
+   HookData.FramesCorrupted = 0;
+   HookData.FramesIncomplete = 0;
+   HookData.PacketsMissing = 0;
+   HookData.PayloadFramesChecked = 0;
+   HookData.PayloadFramesCorrupted = 0;
+   HookData.PayloadBytesCorrupted = 0;
+   HookData.BurstArmed = false;
+   HookData.BurstFrames = 0;
+   HookData.BurstFirstTime = 0;
+   HookData.BurstLastTime = 0;
+   }
+
+/* Grab one sequence of SequenceFrameCount frames and return the obtained frame rate. */
+/* ---------------------------------------------------------------------------------- */
+MIL_DOUBLE AcquireSequence(MIL_ID MilDigitizer, HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+   MIL_DOUBLE FrameRate = 0;
+
+   /* When replaying a trace, the sequence is a recorded one. */
+   if(HookData.Replay)
+      return ReplaySequence(HookData);
+
+   /* After a cancellation request, the sequence is skipped. */
+   if(IsCancelRequested(HookData))
+      {
+      ResetHookData(HookData);
+      return FrameRate;
+      }
+
+   /* Relate the camera's timestamps to the host's clock just before the sequence. */
+   if(!HookData.HostTimes.empty())
+      LatchCameraClock(MilDigitizer, HookData);
+
+   /* Start acquisition. */
+   ResetHookData(HookData);
+   MdigProcess(MilDigitizer, HookData.GrabBufferList, HookData.GrabBufferListSize,
+      M_SEQUENCE+M_COUNT(Settings.SequenceFrameCount), M_DEFAULT, ProcessingFunction, &HookData);
+
+   /* Inquire the obtained frame rate. */
+   MdigInquire(MilDigitizer, M_PROCESS_FRAME_RATE, &FrameRate);
+
+   /* Stop acquisition. */
+   MdigProcess(MilDigitizer, HookData.GrabBufferList, HookData.GrabBufferListSize,
+      M_STOP, M_DEFAULT, ProcessingFunction, &HookData);
+
+   /* Inquire the frames lost by the sequence. */
+   MdigInquire(MilDigitizer, M_PROCESS_FRAME_MISSED, &HookData.FramesMissed);
+   MdigInquire(MilDigitizer, M_PROCESS_FRAME_CORRUPTED, &HookData.FramesCorrupted);
+
+   /* Latch again after the sequence and update the clock alignment, using the frame
+      arrivals if the camera cannot latch its timestamp. */
+   if(!HookData.HostTimes.empty())
+      {
+      LatchCameraClock(MilDigitizer, HookData);
+      for(MIL_INT i = 0; i < min(HookData.FrameCount, (MIL_INT)HookData.HostTimes.size()); i++)
+         AddClockSample(HookData.ArrivalSamples, ClockSample(
+            (MIL_DOUBLE)HookData.CameraTimes[i] / HookData.CameraTickFreq, HookData.HostTimes[i]));
+      AlignCameraClock(HookData);
+      }
+
+   if(HookData.TraceFile)
+      WriteTraceWindow(HookData, FrameRate);
+   ReportProgress(HookData, FrameRate);
+
+   return FrameRate;
+   }
+
+/* Check, before an acquisition, whether the calibration is to be cancelled. */
+/* ------------------------------------------------------------------------- */
+bool IsCancelRequested(HookDataStruct& HookData)
+   {
+   if(HookData.Control && HookData.Control->CancelRequested)
+      HookData.Cancelled = true;
+   return HookData.Cancelled;
+   }
+
+/* Report the progress of the calibration after an acquisition: the pixel format, */
+/* the number of its acquisitions so far, the delay and the measured frame rate.  */
+/* ------------------------------------------------------------------------------ */
+void ReportProgress(HookDataStruct& HookData, MIL_DOUBLE FrameRate)
+   {
+   CalibrationControl* Control = HookData.Control;
+   if(HookData.Probing || !Control || !Control->ProgressFunction || !Control->Results)
+      return;
+
+   const PacketDelayResults& Results = *Control->Results;
+   if(Results.Selection >= Results.PixelFormats.size())
+      return;
+   if(Control->Iterations.size() != Results.PixelFormats.size())
+      Control->Iterations.assign(Results.PixelFormats.size(), 0);
+
+   PacketDelayProgress Progress;
+   Progress.PixelFormat = Results.PixelFormats[Results.Selection];
+   Progress.FormatIndex = (MIL_INT)Results.Selection;
+   Progress.NbFormats = (MIL_INT)Results.PixelFormats.size();
+   Progress.Iteration = ++Control->Iterations[Results.Selection];
+   Progress.DelayTickVal = HookData.DelayTickVal;
+   Progress.FrameRate = FrameRate;
+   (*Control->ProgressFunction)(Progress, Control->UserDataPtr);
+   }
+
+/* Use MdigProcess to acquire a reference frame rate with the inter-packet delay to zero. */
+/* -------------------------------------------------------------------------------------- */
+void AcquireReferenceFrameRate(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results,
+                               HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+
+   /* Set initial inter-packet delay to zero; this is to measure the base frame rate of the
+      camera. */
+   SetInterPacketDelay(MilDigitizer, HookData, 0);
+
+   /* Start the MdigProcess; here we want to record a base frame rate and
+      inter-frame intervals that will be used for our calculations later. */
+   Info.BaseFrameRate = AcquireSequence(MilDigitizer, HookData);
+   SummarizeSequence(HookData, 0, Info.BaseFrameRate, Info.ReferenceIntervals);
+
+   /* In camera mode, the first reference frame is the expected test pattern; if no
+      other reference frame matches it, the pattern is not static (or the first frame was
+      corrupted). In simulated mode, the reference frames must match the generated ramp.
+      Either way, the pattern cannot be verified. */
+   if(HookData.PayloadCompare && HookData.PayloadFramesChecked > 0 &&
+      HookData.PayloadFramesCorrupted == HookData.PayloadFramesChecked)
+      {
+      if(Settings.PayloadVerification == PAYLOAD_VERIFICATION_CAMERA)
+         {
+         MosPrintf(MIL_TEXT("No reference frame matches the first one; payload verification disabled.\n"));
+         Results.PayloadVerificationName = MIL_TEXT("disabled (test pattern is not static)");
+         }
+      else
+         {
+         MosPrintf(MIL_TEXT("No reference frame matches the simulated ramp; payload verification disabled.\n"));
+         Results.PayloadVerificationName = MIL_TEXT("disabled (test pattern differs from the simulated ramp)");
+         }
+      HookData.PayloadCompare = M_NULL;
+      HookData.VerifyPayloads = false;
+      }
+   Results.ReferenceFrameRate[Results.Selection] = Info.BaseFrameRate;
+   Results.ReferenceIntervals[Results.Selection] = Info.ReferenceIntervals;
+   HookData.ReferenceFrameRate = Info.BaseFrameRate;
+
+   /* With the frame-rate estimated, inquire the theoretical inter-packet delay to use. */
+   Info.DelayInSeconds = GetTheoreticalDelay(MilDigitizer, HookData);
+
+   /* Convert the delay from seconds to camera ticks. */
+   Info.DelayTickVal = (MIL_UINT32)(Info.DelayInSeconds * Info.TickFreq);
+
+   if(HookData.TraceFile)
+      WriteTraceFormat(Info, Results, HookData);
+   }
+
+/* Return the speed of the camera's link in Mbit/s: the configured speed, else the  */
+/* camera's link speed feature, else the speed of the host interface on Linux.      */
+/* -------------------------------------------------------------------------------- */
+MIL_INT GetLinkSpeed(MIL_ID MilDigitizer, int& Source, const PacketDelaySettings& Settings)
+   {
+   MIL_INT64 Speed = 0;
+   MIL_BOOL Present = M_FALSE;
+
+   if(Settings.LinkSpeedMbps > 0)
+      {
+      Source = LINK_SPEED_SOURCE_CONFIGURED;
+      return Settings.LinkSpeedMbps;
+      }
+
+   /* GevLinkSpeed is in Mbit/s; DeviceLinkSpeed is in bytes per second. */
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   MdigInquireFeature(MilDigitizer, M_FEATURE_PRESENT, MIL_TEXT("GevLinkSpeed"), M_TYPE_BOOLEAN, &Present);
+   if(Present)
+      MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("GevLinkSpeed"), M_TYPE_INT64, &Speed);
+   else
+      {
+      MdigInquireFeature(MilDigitizer, M_FEATURE_PRESENT, MIL_TEXT("DeviceLinkSpeed"), M_TYPE_BOOLEAN, &Present);
+      if(Present)
+         {
+         MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("DeviceLinkSpeed"), M_TYPE_INT64, &Speed);
+         Speed = Speed * 8 / 1000000;
+         }
+      }
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+   if(Speed > 0)
+      {
+      Source = LINK_SPEED_SOURCE_CAMERA;
+      return (MIL_INT)Speed;
+      }
+
+#if !M_MIL_USE_WINDOWS
+   if(!Settings.NetworkInterfaceName.empty())
+      {
+      char Path[256];
+      int InterfaceSpeed = 0;
+      snprintf(Path, sizeof(Path), "/sys/class/net/%s/speed", Settings.NetworkInterfaceName.c_str());
+      FILE* File = fopen(Path, "r");
+      if(File)
+         {
+         if(fscanf(File, "%d", &InterfaceSpeed) == 1 && InterfaceSpeed > 0)
+            {
+            fclose(File);
+            Source = LINK_SPEED_SOURCE_HOST;
+            return InterfaceSpeed;
+            }
+         fclose(File);
+         }
+      }
+#endif
+
+   Source = LINK_SPEED_SOURCE_DEFAULT;
+   return Settings.DefaultLinkSpeedMbps;
+   }
+
+/* Return the name of the source of a link speed. */
+/* ---------------------------------------------- */
+const MIL_TEXT_CHAR* GetLinkSpeedSourceName(int Source)
+   {
+   switch(Source)
+      {
+      case LINK_SPEED_SOURCE_CONFIGURED: return MIL_TEXT("configured");
+      case LINK_SPEED_SOURCE_CAMERA:     return MIL_TEXT("camera");
+      case LINK_SPEED_SOURCE_HOST:       return MIL_TEXT("host interface");
+      default:                           return MIL_TEXT("default");
+      }
+   }
+
+/* Return the time a packet of the given GigE Vision packet size occupies the wire. */
+/* -------------------------------------------------------------------------------- */
+MIL_DOUBLE GetPacketWireTime(MIL_INT PacketSize, MIL_INT LinkSpeedMbps)
+   {
+   return (PacketSize + ETHERNET_FRAME_OVERHEAD) * 8.0 / (LinkSpeedMbps * 1e6);
+   }
+
+/* Return the theoretical inter-packet delay: the delay spreading the packets over   */
+/* the reference frame period at the measured link speed. Without a reference, the   */
+/* camera's theoretical delay, which assumes a gigabit link, is corrected by the     */
+/* difference in wire time at the measured link speed.                               */
+/* --------------------------------------------------------------------------------- */
+MIL_DOUBLE GetTheoreticalDelay(MIL_ID MilDigitizer, const HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+   MIL_DOUBLE TheoreticalDelay = 0;
+   MIL_INT PacketSize = 0;
+
+   if(HookData.ReferenceFrameRate > 0 && HookData.PacketsPerFrame > 0 && HookData.PacketWireTime > 0)
+      return max(GetPacketPeriod(HookData) - HookData.PacketWireTime, 0.0);
+   if(HookData.ThroughputControl)
+      return 0;
+
+   MdigInquire(MilDigitizer, M_GC_THEORETICAL_INTER_PACKET_DELAY, &TheoreticalDelay);
+   MdigInquire(MilDigitizer, M_GC_PACKET_SIZE, &PacketSize);
+   if(TheoreticalDelay > 0 && HookData.LinkSpeedMbps > 0 && HookData.LinkSpeedMbps != Settings.DefaultLinkSpeedMbps)
+      TheoreticalDelay = max(TheoreticalDelay + GetPacketWireTime(PacketSize, Settings.DefaultLinkSpeedMbps) -
+                             GetPacketWireTime(PacketSize, HookData.LinkSpeedMbps), 0.0);
+
+   return TheoreticalDelay;
+   }
+
+/* Return the period of the packets at the reference frame rate, or the packet's    */
+/* wire time before the reference is known.                                        */
+/* -------------------------------------------------------------------------------- */
+MIL_DOUBLE GetPacketPeriod(const HookDataStruct& HookData)
+   {
+   if(HookData.ReferenceFrameRate <= 0 || HookData.PacketsPerFrame <= 0)
+      return HookData.PacketWireTime;
+   return max(1.0 / (HookData.ReferenceFrameRate * HookData.PacketsPerFrame), HookData.PacketWireTime);
+   }
+
+/* Return the smallest useful change of delay, in ticks: 1% of the packet period,    */
+/* below which the packet rate does not measurably change. On a fast link the wire   */
+/* time is a small part of the period, so the step follows the delay rather than it. */
+/* --------------------------------------------------------------------------------- */
+MIL_INT GetMinTickStep(const PacketDelayInfo& Info, const HookDataStruct& HookData)
+   {
+   return max((MIL_INT)(GetPacketPeriod(HookData) * Info.TickFreq / 100.0), (MIL_INT)1);
+   }
+
+/* Inquire the frequency of the camera's delay ticks. Without an inter-packet delay,  */
+/* the camera's throughput limit is controlled instead, if it has one. Returns 0 if   */
+/* the camera has neither.                                                            */
+/* ---------------------------------------------------------------------------------- */
+MIL_UINT64 OpenBandwidthControl(MIL_ID MilDigitizer, PacketDelayResults& Results, HookDataStruct& HookData)
+   {
+   MIL_UINT64 TickFreq = 0;
+
+   MdigInquire(MilDigitizer, M_GC_COUNTER_TICK_FREQUENCY, &TickFreq);
+   if(TickFreq == 0 && EnableThroughputControl(MilDigitizer, Results, HookData))
+      TickFreq = GetTickFrequency(MilDigitizer, HookData);
+   return TickFreq;
+   }
+
+/* Switch the camera's bandwidth control to DeviceLinkThroughputLimit, saving its    */
+/* configuration. Returns false if the camera does not have the feature.            */
+/* -------------------------------------------------------------------------------- */
+bool EnableThroughputControl(MIL_ID MilDigitizer, PacketDelayResults& Results, HookDataStruct& HookData)
+   {
+   MIL_BOOL Present = M_FALSE;
+
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   MdigInquireFeature(MilDigitizer, M_FEATURE_PRESENT, MIL_TEXT("DeviceLinkThroughputLimit"), M_TYPE_BOOLEAN, &Present);
+   if(Present)
+      {
+      MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("DeviceLinkThroughputLimit"), M_TYPE_INT64, &Results.OriginalThroughputLimit);
+      MdigInquireFeature(MilDigitizer, M_FEATURE_MIN, MIL_TEXT("DeviceLinkThroughputLimit"), M_TYPE_INT64, &HookData.ThroughputLimitMin);
+      MdigInquireFeature(MilDigitizer, M_FEATURE_MAX, MIL_TEXT("DeviceLinkThroughputLimit"), M_TYPE_INT64, &HookData.ThroughputLimitMax);
+      }
+
+   /* The limit is only applied in its On mode, where the camera has one. The mode is
+      left as is when the limit cannot be controlled. */
+   if(Present && HookData.ThroughputLimitMax > 0)
+      {
+      MIL_BOOL ModePresent = M_FALSE;
+      MdigInquireFeature(MilDigitizer, M_FEATURE_PRESENT, MIL_TEXT("DeviceLinkThroughputLimitMode"), M_TYPE_BOOLEAN, &ModePresent);
+      if(ModePresent)
+         {
+         MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("DeviceLinkThroughputLimitMode"), M_TYPE_STRING, Results.OriginalThroughputLimitMode);
+         MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("DeviceLinkThroughputLimitMode"), M_TYPE_STRING, MIL_STRING(MIL_TEXT("On")));
+         }
+      }
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+
+   if(!Present || HookData.ThroughputLimitMax <= 0)
+      return false;
+   HookData.ThroughputControl = true;
+   Results.BandwidthControlName = MIL_TEXT("DeviceLinkThroughputLimit");
+   return true;
+   }
+
+/* Restore the throughput limit configuration of the camera. */
+/* --------------------------------------------------------- */
+void RestoreThroughputControl(MIL_ID MilDigitizer, PacketDelayResults& Results)
+   {
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("DeviceLinkThroughputLimit"), M_TYPE_INT64, &Results.OriginalThroughputLimit);
+   if(!Results.OriginalThroughputLimitMode.empty())
+      MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("DeviceLinkThroughputLimitMode"), M_TYPE_STRING, Results.OriginalThroughputLimitMode);
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+   }
+
+/* Return the frequency of the delay ticks: the camera's counter, or the ticks of the */
+/* delay applied as a throughput limit.                                               */
+/* ---------------------------------------------------------------------------------- */
+MIL_UINT64 GetTickFrequency(MIL_ID MilDigitizer, const HookDataStruct& HookData)
+   {
+   MIL_UINT64 TickFreq = 0;
+
+   if(HookData.ThroughputControl)
+      return THROUGHPUT_LIMIT_TICK_FREQ;
+   MdigInquire(MilDigitizer, M_GC_COUNTER_TICK_FREQUENCY, &TickFreq);
+   return TickFreq;
+   }
+
+/* Return the throughput limit, in bytes per second, giving the packet period of a    */
+/* delay: the packet's wire bytes sent every wire time plus delay. Without a known    */
+/* packet size, or without delay, the limit is the highest.                           */
+/* ---------------------------------------------------------------------------------- */
+MIL_INT64 GetThroughputLimit(const HookDataStruct& HookData, MIL_DOUBLE DelayInSeconds)
+   {
+   if(HookData.PacketWireTime <= 0 || DelayInSeconds <= 0)
+      return HookData.ThroughputLimitMax;
+
+   MIL_DOUBLE WireBytes = HookData.PacketWireTime * HookData.LinkSpeedMbps * 1e6 / 8.0;
+   MIL_INT64 Limit = (MIL_INT64)(WireBytes / (HookData.PacketWireTime + DelayInSeconds));
+   return min(max(Limit, HookData.ThroughputLimitMin), HookData.ThroughputLimitMax);
+   }
+
+/* Iteratively find a solution that maximizes the inter-packet delay without      */
+/* disturbing the frame-rate of the camera.                                       */
+/* ------------------------------------------------------------------------------ */
+void FindInterPacketDelay(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results,
+                          HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+   bool Done = false;
+
+   /* Smaller delay changes do not measurably change the packet rate. */
+   MIL_INT MinTickStep = GetMinTickStep(Info, HookData);
+
+   if(Settings.PrintDetails)
+      MosPrintf(MIL_TEXT("Reference frame-rate used: %.2f\n\n"), Info.BaseFrameRate);
+
+   while(!Done)
+      {
+      /* Set the delay in the camera. Initially this delay is the theoretical delay
+         at the measured link speed. */
+      SetInterPacketDelay(MilDigitizer, HookData, Info.DelayTickVal);
+
+      /* Acquire a sequence and get the frame rate and inter-frame intervals obtained
+         with the current inter-packet delay. */
+      Info.ProcessFrameRate = AcquireSequence(MilDigitizer, HookData);
+      if(HookData.Cancelled)
+         {
+         Info.Error = true;
+         break;
+         }
+      SequenceSummary Summary;
+      SummarizeSequence(HookData, Info.DelayTickVal, Info.ProcessFrameRate, Summary);
+      Info.Measurements.push_back(Summary);
+
+      if(Settings.PrintDetails)
+         {
+         MosPrintf(MIL_TEXT("Programming delay of %d ticks; frame-rate obtained: %.2f; ")
+            MIL_TEXT("intervals p50/p99/p99.9/max: %.3f/%.3f/%.3f/%.3f msec\n"),
+            (int)Info.DelayTickVal, Info.ProcessFrameRate,
+            Summary.P50*1e3, Summary.P99*1e3, Summary.P999*1e3, Summary.Max*1e3);
+         if(Summary.FramesIncomplete > 0)
+            {
+            MosPrintf(MIL_TEXT("%d packets missing in %d frames; last incomplete frame: "),
+               (int)Summary.PacketsMissing, (int)Summary.FramesIncomplete);
+            PrintMissingPacketMap(HookData.LastIncompleteMap);
+            }
+         if(Summary.PayloadFramesCorrupted > 0)
+            MosPrintf(MIL_TEXT("Payload corrupted in %d frames (%lld bytes)\n"),
+               (int)Summary.PayloadFramesCorrupted, (long long)Summary.PayloadBytesCorrupted);
+         }
+      else if(!HookData.Replay)
+         MosPrintf(MIL_TEXT("."));
+
+      /* Frames that are not bit-exact mean the delay is too small; smaller delays are
+         not tried again. */
+      if(Summary.PayloadFramesCorrupted > 0 && Info.DelayTickVal > Info.CorruptedDelayTickVal)
+         Info.CorruptedDelayTickVal = Info.DelayTickVal;
+
+      /* Validate if obtained frame rate matches reference frame rate and, optionally, if
+         the tail of the inter-frame intervals stays within bounds. If not, reduce the
+         inter packet delay and try another iteration. */
+      if(Summary.PayloadFramesCorrupted > 0 && IsEqual(Info.BaseFrameRate, Info.ProcessFrameRate))
+         {
+         /* The frame rate is kept but the payloads are corrupted; increase the delay
+            for next iteration. */
+         Info.EqualityCounter = 0;
+         Info.DelayInSeconds += (Info.DelayInSeconds / 50.0);
+         Info.DelayTickVal = max((MIL_INT)(Info.DelayInSeconds * Info.TickFreq), Info.DelayTickVal + MinTickStep);
+         if(Info.DelayTickVal <= Info.CorruptedDelayTickVal)
+            Info.DelayTickVal = Info.CorruptedDelayTickVal + 1;
+         Info.DelayInSeconds = (MIL_DOUBLE)Info.DelayTickVal / Info.TickFreq;
+         }
+      else if(IsEqual(Info.BaseFrameRate, Info.ProcessFrameRate) && IsTailWithinBounds(Info, Summary, Settings))
+         {
+         /* Frame rate inquired is equal to the base frame rate; we are converging on
+            the solution. */
+         Info.EqualityCounter++;
+
+         if(Info.DelayTickVal == 0)
+            {
+            Info.DelayInSeconds = 0.0;
+            Info.Error = true;
+            Done = true;
+            }
+         else if(Info.EqualityCounter == 3)
+            {
+            Done = true;
+            /* Found optimal solution, remove an additional 15%. */
+            ApplyDelayMargin(MilDigitizer, Info, HookData);
+            }
+         else
+            {
+            /* Reduce delay for next iteration, without reaching a delay that corrupted
+               frames. */
+            MIL_INT PreviousTickVal = Info.DelayTickVal;
+            Info.DelayInSeconds -= (Info.DelayInSeconds / 50.0);
+            Info.DelayTickVal = min((MIL_INT)(Info.DelayInSeconds * Info.TickFreq), PreviousTickVal - MinTickStep);
+            Info.DelayTickVal = max(Info.DelayTickVal, (MIL_INT)0);
+            Info.DelayInSeconds = (MIL_DOUBLE)Info.DelayTickVal / Info.TickFreq;
+            if(Info.DelayTickVal <= Info.CorruptedDelayTickVal)
+               {
+               Info.DelayTickVal = PreviousTickVal;
+               Info.DelayInSeconds = (MIL_DOUBLE)PreviousTickVal / Info.TickFreq;
+               }
+            }
+         }
+      else
+         {
+         /* We are still far from the reference frame rate, reduce delay for next
+            iteration. */
+         Info.EqualityCounter = 0;
+         Info.DelayInSeconds -= (Info.DelayInSeconds / 10.0);
+         Info.DelayTickVal = (MIL_UINT32)(Info.DelayInSeconds * Info.TickFreq);
+         if(Info.DelayTickVal == 0 || Info.DelayTickVal <= Info.CorruptedDelayTickVal)
+            {
+            Info.DelayInSeconds = 0.0;
+            Info.Error = true;
+            Done = true;
+            }
+         else if(Info.DelayInSeconds <= 0.0)
+            {
+            Info.DelayInSeconds = 0.0;
+            Done = true;
+            }
+         }
+
+      SetFormatState(Results, Info, FORMAT_STATE_SEARCH);
+      if(!HookData.Replay)
+         MosSleep(500);
+      }
+
+   /* Store solution in Results struct. This will get printed at the end of the example. */
+   if(Info.Error == false)
+      {
+      Results.InterPacketDelayInTicks[Results.Selection] = Info.DelayTickVal;
+      Results.InterPacketDelayInSec[Results.Selection] = Info.DelayInSeconds;
+      Results.ObtainedFrameRate[Results.Selection] = Info.ProcessFrameRate;
+      }
+   Results.Measurements[Results.Selection] = Info.Measurements;
+   }
+
+/* Configure the camera to send a burst of frames on each software trigger. The      */
+/* FrameBurstStart trigger is used when available; otherwise, one FrameStart trigger */
+/* is sent per frame. With external triggers, the configuration is left untouched.   */
+/* --------------------------------------------------------------------------------- */
+bool EnableBurstTrigger(MIL_ID MilDigitizer, PacketDelayResults& Results, const PacketDelaySettings& Settings)
+   {
+   MIL_STRING Selector, Mode;
+   MIL_INT64 BurstFrameCount = 0;
+
+   Results.BurstTriggerPerFrame = false;
+   if(!Settings.BurstSoftwareTrigger)
+      {
+      Results.BurstTriggerName = MIL_TEXT("external");
+      return true;
+      }
+
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   if(Results.OriginalTriggerSelector.empty())
+      {
+      /* Save the mode and source of each trigger that might be changed, and the burst
+         length. */
+      static const MIL_TEXT_CHAR* const Selectors[] = { MIL_TEXT("FrameBurstStart"), MIL_TEXT("FrameStart") };
+      MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerSelector"), M_TYPE_STRING, Results.OriginalTriggerSelector);
+      MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("AcquisitionBurstFrameCount"), M_TYPE_INT64, &Results.OriginalBurstFrameCount);
+      Results.OriginalTriggers.clear();
+      for(size_t i = 0; i < sizeof(Selectors) / sizeof(Selectors[0]); i++)
+         {
+         TriggerSettings Trigger;
+         MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerSelector"), M_TYPE_STRING, MIL_STRING(Selectors[i]));
+         MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerSelector"), M_TYPE_STRING, Trigger.Selector);
+         if(Trigger.Selector != Selectors[i])
+            continue;
+         MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerMode"), M_TYPE_STRING, Trigger.Mode);
+         MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerSource"), M_TYPE_STRING, Trigger.Source);
+         Results.OriginalTriggers.push_back(Trigger);
+         }
+      }
+
+   /* Try a single trigger per burst first. */
+   BurstFrameCount = Settings.BurstFrameCount;
+   MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerSelector"), M_TYPE_STRING, MIL_STRING(MIL_TEXT("FrameBurstStart")));
+   MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerSelector"), M_TYPE_STRING, Selector);
+   if(Selector != MIL_TEXT("FrameBurstStart") ||
+      !SetIntegerFeature(MilDigitizer, MIL_TEXT("AcquisitionBurstFrameCount"), BurstFrameCount))
+      {
+      Results.BurstTriggerPerFrame = true;
+      MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerSelector"), M_TYPE_STRING, MIL_STRING(MIL_TEXT("FrameStart")));
+      MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerSelector"), M_TYPE_STRING, Selector);
+      }
+   MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerMode"), M_TYPE_STRING, MIL_STRING(MIL_TEXT("On")));
+   MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerSource"), M_TYPE_STRING, MIL_STRING(MIL_TEXT("Software")));
+   MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerMode"), M_TYPE_STRING, Mode);
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+
+   if(Mode != MIL_TEXT("On"))
+      {
+      MosPrintf(MIL_TEXT("The camera does not support software triggers; burst calibration skipped.\n"));
+      Results.BurstTriggerName = MIL_TEXT("unsupported");
+      return false;
+      }
+
+   Results.BurstTriggerName = Selector + MIL_TEXT(" software trigger");
+   return true;
+   }
+
+/* Restore the camera's trigger configuration: the mode and source of each trigger */
+/* saved, the burst length and the selected trigger.                               */
+/* ------------------------------------------------------------------------------- */
+void RestoreBurstTrigger(MIL_ID MilDigitizer, PacketDelayResults& Results, const PacketDelaySettings& Settings)
+   {
+   if(!Settings.BurstSoftwareTrigger || Results.OriginalTriggerSelector.empty())
+      return;
+
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   for(size_t i = 0; i < Results.OriginalTriggers.size(); i++)
+      {
+      /* Some cameras only accept a new source while the trigger is off. */
+      const TriggerSettings& Trigger = Results.OriginalTriggers[i];
+      MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerSelector"), M_TYPE_STRING, Trigger.Selector);
+      MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerMode"), M_TYPE_STRING, MIL_STRING(MIL_TEXT("Off")));
+      if(!Trigger.Source.empty())
+         MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerSource"), M_TYPE_STRING, Trigger.Source);
+      if(!Trigger.Mode.empty())
+         MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerMode"), M_TYPE_STRING, Trigger.Mode);
+      }
+   if(Results.OriginalBurstFrameCount > 0)
+      SetIntegerFeature(MilDigitizer, MIL_TEXT("AcquisitionBurstFrameCount"), Results.OriginalBurstFrameCount);
+   MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TriggerSelector"), M_TYPE_STRING, Results.OriginalTriggerSelector);
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+   }
+
+/* Acquire BurstCount bursts with a delay and measure their delivery time and loss.  */
+/* Returns false if no frame was received, e.g. when no external trigger came.       */
+/* --------------------------------------------------------------------------------- */
+bool MeasureBursts(MIL_ID MilDigitizer, const PacketDelayResults& Results, HookDataStruct& HookData,
+                   MIL_INT DelayTickVal, SequenceSummary& Summary)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+   MIL_INT NbFrames = 0, NbDelivered = 0, NbBursts = 0;
+   MIL_DOUBLE BurstTimeSum = 0, BurstTimeMax = 0, SpanSum = 0;
+   MIL_INT SpanFrames = 0;
+
+   SetInterPacketDelay(MilDigitizer, HookData, DelayTickVal);
+   ResetHookData(HookData);
+
+   /* After a cancellation request, the bursts are skipped. */
+   if(IsCancelRequested(HookData))
+      {
+      SummarizeSequence(HookData, DelayTickVal, 0.0, Summary);
+      return false;
+      }
+
+   MdigProcess(MilDigitizer, HookData.GrabBufferList, HookData.GrabBufferListSize,
+      M_START, M_DEFAULT, ProcessingFunction, &HookData);
+
+   for(MIL_INT Burst = 0; Burst < Settings.BurstCount; Burst++)
+      {
+      MIL_DOUBLE TriggerTime = 0, Now = 0;
+      MIL_INT StartCount = 0, Count = 0;
+
+      /* Arm the burst; its first frame restarts the hook's burst timing. */
+      MosSleep(Settings.BurstIdleMs);
+      MdigInquire(MilDigitizer, M_PROCESS_FRAME_COUNT, &StartCount);
+      HookData.BurstFrames.store(0, memory_order_relaxed);
+      HookData.BurstArmed.store(true, memory_order_release);
+
+      MappTimer(M_DEFAULT, M_TIMER_READ, &TriggerTime);
+      if(Settings.BurstSoftwareTrigger)
+         {
+         MIL_INT NbTriggers = Results.BurstTriggerPerFrame ? Settings.BurstFrameCount : 1;
+         for(MIL_INT i = 0; i < NbTriggers; i++)
+            MdigControlFeature(MilDigitizer, M_FEATURE_EXECUTE, MIL_TEXT("TriggerSoftware"), M_DEFAULT, M_NULL);
+         }
+
+      /* Wait for the burst, or for the timeout if frames were lost. */
+      do
+         {
+         MosSleep(1);
+         MdigInquire(MilDigitizer, M_PROCESS_FRAME_COUNT, &Count);
+         MappTimer(M_DEFAULT, M_TIMER_READ, &Now);
+         }
+      while(Count - StartCount < Settings.BurstFrameCount && (Now - TriggerTime) * 1000.0 < Settings.BurstTimeoutMs);
+
+      /* Let the hook complete the last frame, then read the burst's snapshot. A burst
+         whose first frame never came leaves the hook armed; it is disarmed here. */
+      MosSleep(Settings.BurstIdleMs);
+      bool Started = !HookData.BurstArmed.exchange(false);
+      MIL_INT Delivered = Started ? min(HookData.BurstFrames.load(memory_order_acquire), (MIL_INT)Settings.BurstFrameCount) : 0;
+      MIL_DOUBLE FirstTime = HookData.BurstFirstTime.load(memory_order_relaxed);
+      MIL_DOUBLE LastTime = HookData.BurstLastTime.load(memory_order_relaxed);
+      NbFrames += Settings.BurstFrameCount;
+      NbDelivered += Delivered;
+      if(Delivered > 0)
+         {
+         MIL_DOUBLE Start = Settings.BurstSoftwareTrigger ? TriggerTime : FirstTime;
+         MIL_DOUBLE BurstTime = LastTime - Start;
+         BurstTimeSum += BurstTime;
+         NbBursts++;
+         BurstTimeMax = max(BurstTimeMax, BurstTime);
+         SpanSum += LastTime - FirstTime;
+         SpanFrames += Delivered - 1;
+         }
+      }
+
+   MdigProcess(MilDigitizer, HookData.GrabBufferList, HookData.GrabBufferListSize,
+      M_STOP, M_DEFAULT, ProcessingFunction, &HookData);
+   MdigInquire(MilDigitizer, M_PROCESS_FRAME_MISSED, &HookData.FramesMissed);
+   MdigInquire(MilDigitizer, M_PROCESS_FRAME_CORRUPTED, &HookData.FramesCorrupted);
+
+   /* The frame rate is the one within the bursts. */
+   SummarizeSequence(HookData, DelayTickVal, SpanSum > 0 ? SpanFrames / SpanSum : 0.0, Summary);
+   Summary.FramesNotDelivered = max(NbFrames - NbDelivered, (MIL_INT)0);
+   Summary.BurstTime = (NbBursts > 0) ? BurstTimeSum / NbBursts : 0.0;
+   Summary.BurstTimeMax = BurstTimeMax;
+   ReportProgress(HookData, Summary.FrameRate);
+   return NbDelivered > 0;
+   }
+
+/* Find the smallest delay at which all the bursts are delivered without loss. The    */
+/* burst delivery time grows with the delay, so this is the shortest delivery.        */
+/* ---------------------------------------------------------------------------------- */
+void FindBurstInterPacketDelay(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results,
+                               HookDataStruct& HookData)
+   {
+   SequenceSummary Summary;
+
+   /* The reference is the burst without delay. */
+   if(!MeasureBursts(MilDigitizer, Results, HookData, 0, Summary))
+      {
+      MosPrintf(MIL_TEXT("No frame received; check the trigger configuration.\n"));
+      Info.Error = true;
+      return;
+      }
+   Info.BaseFrameRate = Summary.FrameRate;
+   Info.ReferenceIntervals = Summary;
+   Results.ReferenceFrameRate[Results.Selection] = Info.BaseFrameRate;
+   Results.ReferenceIntervals[Results.Selection] = Summary;
+   HookData.ReferenceFrameRate = Info.BaseFrameRate;
+   MosPrintf(MIL_TEXT("."));
+
+   Info.DelayInSeconds = GetTheoreticalDelay(MilDigitizer, HookData);
+   Info.DelayTickVal = (MIL_UINT32)(Info.DelayInSeconds * Info.TickFreq);
+   if(!FindSmallestLossFreeDelay(MilDigitizer, Info, Results, HookData, MeasureBursts, Summary) && !HookData.Cancelled)
+      MosPrintf(MIL_TEXT("\nNo delay delivers the bursts without loss.\n"));
+   }
+
+/* Find the smallest delay at which the frames are delivered without loss, starting   */
+/* from the reference measurement without delay. The delay is bracketed from the      */
+/* theoretical delay in Info.DelayTickVal, then bisected down to 2%. Returns false,   */
+/* leaving the results untouched, when the calibration is cancelled.                  */
+/* ---------------------------------------------------------------------------------- */
+bool FindSmallestLossFreeDelay(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results,
+                               HookDataStruct& HookData, DelayMeasurementFunction Measure,
+                               const SequenceSummary& Reference)
+   {
+   /* Largest delay tried, relative to the theoretical delay. */
+   const MIL_INT MaxBracketFactor = 16;
+   SequenceSummary Summary = Reference;
+   MIL_INT LossyTickVal = -1, LossFreeTickVal = -1;
+
+   Info.Measurements.push_back(Reference);
+   if(GetLostFrameCount(Reference) == 0)
+      LossFreeTickVal = 0;
+   else
+      {
+      /* Bracket the smallest loss-free delay. */
+      MIL_INT TheoreticalTickVal = max(Info.DelayTickVal, (MIL_INT)1);
+      LossyTickVal = 0;
+      for(MIL_INT TickVal = TheoreticalTickVal; TickVal <= TheoreticalTickVal * MaxBracketFactor; TickVal *= 2)
+         {
+         Measure(MilDigitizer, Results, HookData, TickVal, Summary);
+         if(HookData.Cancelled)
+            break;
+         Info.Measurements.push_back(Summary);
+         MosPrintf(MIL_TEXT("."));
+         if(GetLostFrameCount(Summary) == 0)
+            {
+            LossFreeTickVal = TickVal;
+            break;
+            }
+         LossyTickVal = TickVal;
+         }
+
+      /* Bisect down to 2% of the delay, or to the smallest useful delay step. */
+      MIL_INT MinTickStep = GetMinTickStep(Info, HookData);
+      while(LossFreeTickVal > 0 && LossFreeTickVal - LossyTickVal > max(LossFreeTickVal / 50, MinTickStep) &&
+            !HookData.Cancelled)
+         {
+         MIL_INT TickVal = (LossyTickVal + LossFreeTickVal) / 2;
+         Measure(MilDigitizer, Results, HookData, TickVal, Summary);
+         if(HookData.Cancelled)
+            break;
+         Info.Measurements.push_back(Summary);
+         MosPrintf(MIL_TEXT("."));
+         if(GetLostFrameCount(Summary) == 0)
+            LossFreeTickVal = TickVal;
+         else
+            LossyTickVal = TickVal;
+         }
+      }
+
+   if(HookData.Cancelled)
+      {
+      Info.Error = true;
+      return false;
+      }
+
+   if(LossFreeTickVal < 0)
+      {
+      Info.Error = true;
+      Results.Measurements[Results.Selection] = Info.Measurements;
+      return false;
+      }
+
+   /* Keep the measurement of the solution last for the report. */
+   for(size_t i = 0; i < Info.Measurements.size(); i++)
+      {
+      if(Info.Measurements[i].DelayTickVal == LossFreeTickVal)
+         {
+         Summary = Info.Measurements[i];
+         Info.Measurements.erase(Info.Measurements.begin() + i);
+         Info.Measurements.push_back(Summary);
+         break;
+         }
+      }
+
+   Info.DelayTickVal = LossFreeTickVal;
+   Info.DelayInSeconds = (MIL_DOUBLE)LossFreeTickVal / Info.TickFreq;
+   Info.ProcessFrameRate = Summary.FrameRate;
+   SetInterPacketDelay(MilDigitizer, HookData, Info.DelayTickVal);
+
+   Results.InterPacketDelayInTicks[Results.Selection] = Info.DelayTickVal;
+   Results.InterPacketDelayInSec[Results.Selection] = Info.DelayInSeconds;
+   Results.ObtainedFrameRate[Results.Selection] = Info.ProcessFrameRate;
+   Results.Measurements[Results.Selection] = Info.Measurements;
+   return true;
+   }
+
+/* Allocate the per-frame timestamps of the latency measurement and read the        */
+/* exposure time, used to find the end of exposure from the camera's timestamp.     */
+/* --------------------------------------------------------------------------------- */
+void PrepareLatencyMeasurement(MIL_ID MilDigitizer, const PacketDelayInfo& Info, HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+
+   HookData.HostTimes.assign(Settings.SequenceFrameCount, 0.0);
+   HookData.CameraTimes.assign(Settings.SequenceFrameCount, 0);
+   HookData.CameraTickFreq = Info.TickFreq;
+   HookData.ExposureTime = 0;
+   HookData.FixedLatency = -1;
+
+   /* The clocks keep their relation across pixel formats; only the oldest samples are
+      dropped as new ones are added. */
+   if(HookData.LatchSamples.empty() && HookData.ArrivalSamples.empty())
+      HookData.Alignment = ClockAlignment();
+
+   if(Settings.CameraTimestampAtExposureStart)
+      {
+      MIL_DOUBLE ExposureTimeUsec = 0;
+      MappControl(M_ERROR, M_PRINT_DISABLE);
+      MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("ExposureTime"), M_TYPE_DOUBLE, &ExposureTimeUsec);
+      MappControl(M_ERROR, M_PRINT_ENABLE);
+      HookData.ExposureTime = ExposureTimeUsec / 1e6;
+      }
+   }
+
+/* Latch the camera's timestamp counter between two reads of the host's clock and    */
+/* keep the sample with the shortest round trip. Both the SFNC TimestampLatch and    */
+/* the older GevTimestampControlLatch are tried.                                     */
+/* --------------------------------------------------------------------------------- */
+bool LatchCameraClock(MIL_ID MilDigitizer, HookDataStruct& HookData)
+   {
+   const int NbSamples = 5;
+   const MIL_TEXT_CHAR* LatchFeature = MIL_TEXT("TimestampLatch");
+   const MIL_TEXT_CHAR* ValueFeature = MIL_TEXT("TimestampLatchValue");
+   MIL_BOOL Present = M_FALSE;
+   MIL_DOUBLE BestRoundTrip = -1;
+   ClockSample BestSample;
+
+   if(HookData.CameraTickFreq == 0)
+      return false;
+
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   MdigInquireFeature(MilDigitizer, M_FEATURE_PRESENT, LatchFeature, M_TYPE_BOOLEAN, &Present);
+   if(!Present)
+      {
+      LatchFeature = MIL_TEXT("GevTimestampControlLatch");
+      ValueFeature = MIL_TEXT("GevTimestampValue");
+      MdigInquireFeature(MilDigitizer, M_FEATURE_PRESENT, LatchFeature, M_TYPE_BOOLEAN, &Present);
+      }
+
+   for(int i = 0; Present && i < NbSamples; i++)
+      {
+      MIL_DOUBLE Before = 0, After = 0;
+      MIL_INT64 CameraTime = 0;
+      MappTimer(M_DEFAULT, M_TIMER_READ, &Before);
+      MdigControlFeature(MilDigitizer, M_FEATURE_EXECUTE, LatchFeature, M_DEFAULT, M_NULL);
+      MappTimer(M_DEFAULT, M_TIMER_READ, &After);
+      MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, ValueFeature, M_TYPE_INT64, &CameraTime);
+      if(CameraTime != 0 && (BestRoundTrip < 0 || After - Before < BestRoundTrip))
+         {
+         BestRoundTrip = After - Before;
+         BestSample = ClockSample((MIL_DOUBLE)CameraTime / HookData.CameraTickFreq, (Before + After) / 2.0);
+         }
+      }
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+
+   if(BestRoundTrip < 0)
+      return false;
+   AddClockSample(HookData.LatchSamples, BestSample);
+   return true;
+   }
+
+/* Add a clock sample, dropping the oldest ones beyond a fixed count. */
+/* ------------------------------------------------------------------ */
+void AddClockSample(vector<ClockSample>& Samples, const ClockSample& Sample)
+   {
+   const size_t MaxSamples = 1024;
+   if(Samples.size() >= MaxSamples)
+      Samples.erase(Samples.begin(), Samples.begin() + (Samples.size() - MaxSamples + 1));
+   Samples.push_back(Sample);
+   }
+
+/* Estimate the offset and drift between the camera's and the host's clocks, from   */
+/* the latched timestamps when available, else from the frame arrivals.            */
+/* -------------------------------------------------------------------------------- */
+void AlignCameraClock(HookDataStruct& HookData)
+   {
+   if(!HookData.LatchSamples.empty())
+      {
+      FitClockLine(HookData.LatchSamples, false, HookData.Alignment);
+      HookData.Alignment.Method = CLOCK_ALIGNMENT_LATCH;
+      }
+   else if(!HookData.ArrivalSamples.empty())
+      {
+      FitClockLine(HookData.ArrivalSamples, true, HookData.Alignment);
+      HookData.Alignment.Method = CLOCK_ALIGNMENT_ARRIVALS;
+      }
+   }
+
+/* Fit host time = HostReference + (camera time - CameraReference) * Rate by least   */
+/* squares. For the lower envelope, the fit is repeated on the samples below the     */
+/* line, then shifted so no sample is below it: the arrival delays are always        */
+/* positive, so the earliest arrivals best follow the clocks. The rate is kept to 1  */
+/* until the samples span a second.                                                  */
+/* --------------------------------------------------------------------------------- */
+void FitClockLine(const vector<ClockSample>& Samples, bool LowerEnvelope, ClockAlignment& Alignment)
+   {
+   const MIL_DOUBLE MinSpan = 1.0;
+   vector<bool> Used(Samples.size(), true);
+   MIL_DOUBLE CameraReference = Samples[0].CameraTime;
+   MIL_DOUBLE HostReference = Samples[0].HostTime;
+
+   Alignment.CameraReference = CameraReference;
+   Alignment.NbSamples = (MIL_INT)Samples.size();
+   for(int Iteration = 0; Iteration < (LowerEnvelope ? 4 : 1); Iteration++)
+      {
+      MIL_DOUBLE SumX = 0, SumY = 0, SumXX = 0, SumXY = 0, MinX = 0, MaxX = 0;
+      MIL_INT Count = 0;
+      for(size_t i = 0; i < Samples.size(); i++)
+         {
+         if(!Used[i])
+            continue;
+         MIL_DOUBLE X = Samples[i].CameraTime - CameraReference;
+         MIL_DOUBLE Y = Samples[i].HostTime - HostReference;
+         MinX = Count ? min(MinX, X) : X;
+         MaxX = Count ? max(MaxX, X) : X;
+         SumX += X;
+         SumY += Y;
+         SumXX += X * X;
+         SumXY += X * Y;
+         Count++;
+         }
+      if(Count == 0)
+         break;
+
+      MIL_DOUBLE Rate = 1.0;
+      MIL_DOUBLE Denominator = Count * SumXX - SumX * SumX;
+      if(MaxX - MinX >= MinSpan && Denominator > 0)
+         Rate = (Count * SumXY - SumX * SumY) / Denominator;
+      Alignment.Rate = Rate;
+      Alignment.HostReference = HostReference + (SumY - Rate * SumX) / Count;
+
+      /* Keep the samples on or below the line for the next iteration. */
+      if(LowerEnvelope)
+         {
+         MIL_INT NbBelow = 0;
+         for(size_t i = 0; i < Samples.size(); i++)
+            NbBelow += (Samples[i].HostTime <= CameraToHostTime(Alignment, Samples[i].CameraTime)) ? 1 : 0;
+         if(NbBelow < 2)
+            break;
+         for(size_t i = 0; i < Samples.size(); i++)
+            Used[i] = (Samples[i].HostTime <= CameraToHostTime(Alignment, Samples[i].CameraTime));
+         }
+      }
+
+   /* Shift the lower envelope under all the samples, and compute the residual. */
+   MIL_DOUBLE SumOfSquares = 0, MinResidual = 0;
+   for(size_t i = 0; i < Samples.size(); i++)
+      {
+      MIL_DOUBLE Residual = Samples[i].HostTime - CameraToHostTime(Alignment, Samples[i].CameraTime);
+      MinResidual = i ? min(MinResidual, Residual) : Residual;
+      }
+   if(LowerEnvelope)
+      Alignment.HostReference += MinResidual;
+   for(size_t i = 0; i < Samples.size(); i++)
+      {
+      MIL_DOUBLE Residual = Samples[i].HostTime - CameraToHostTime(Alignment, Samples[i].CameraTime);
+      SumOfSquares += Residual * Residual;
+      }
+   Alignment.Residual = sqrt(SumOfSquares / Samples.size());
+   }
+
+/* Convert a camera time to the host's clock. */
+/* ------------------------------------------ */
+MIL_DOUBLE CameraToHostTime(const ClockAlignment& Alignment, MIL_DOUBLE CameraTime)
+   {
+   return Alignment.HostReference + (CameraTime - Alignment.CameraReference) * Alignment.Rate;
+   }
+
+/* Print the clock alignment. */
+/* -------------------------- */
+void PrintClockAlignment(const ClockAlignment& Alignment)
+   {
+   static const MIL_TEXT_CHAR* const Methods[] = { MIL_TEXT("none"),
+                                                   MIL_TEXT("camera timestamp latch"),
+                                                   MIL_TEXT("frame arrivals (latencies are relative)") };
+   MosPrintf(MIL_TEXT("Clock alignment:      %s"), Methods[Alignment.Method]);
+   if(Alignment.Method != CLOCK_ALIGNMENT_NONE)
+      MosPrintf(MIL_TEXT(", %d samples, drift %+.2f ppm, residual %.1f usec"), (int)Alignment.NbSamples,
+         (Alignment.Rate - 1.0) * 1e6, Alignment.Residual * 1e6);
+   MosPrintf(MIL_TEXT("\n"));
+   }
+
+/* Compute the distribution of the latencies from the end of exposure to the         */
+/* completion of the buffer in the hook, and of the transfer durations: the latency  */
+/* minus the fixed latency measured without delay, which does not depend on the      */
+/* offset between the clocks. The transfer duration still includes the host's        */
+/* variable latency (interrupt moderation, hook scheduling), so only its median      */
+/* estimates the on-wire duration; its p99 and maximum add the host's jitter. The    */
+/* spread ratio compares the median time added by the delay to the time it should    */
+/* add.                                                                              */
+/* --------------------------------------------------------------------------------- */
+void SummarizeLatencies(const HookDataStruct& HookData, SequenceSummary& Summary)
+   {
+   /* The hook records the frames of the sequence, all of which are used; a shorter
+      sequence (e.g. a cancelled one) uses the frames received. */
+   MIL_INT NbFrames = min(HookData.FrameCount, (MIL_INT)HookData.HostTimes.size());
+   vector<MIL_DOUBLE> Latencies;
+   MIL_DOUBLE Sum = 0;
+
+   if(NbFrames <= 0 || HookData.CameraTickFreq == 0 || HookData.Alignment.Method == CLOCK_ALIGNMENT_NONE)
+      return;
+
+   Latencies.resize(NbFrames);
+   for(MIL_INT i = 0; i < NbFrames; i++)
+      {
+      MIL_DOUBLE ExposureEnd = (MIL_DOUBLE)HookData.CameraTimes[i] / HookData.CameraTickFreq + HookData.ExposureTime;
+      Latencies[i] = HookData.HostTimes[i] - CameraToHostTime(HookData.Alignment, ExposureEnd);
+      Sum += Latencies[i];
+      }
+
+   sort(Latencies.begin(), Latencies.end());
+   Summary.LatencyMean = Sum / NbFrames;
+   Summary.LatencyP50 = Latencies[(size_t)((NbFrames - 1) * 0.50)];
+   Summary.LatencyP99 = Latencies[(size_t)((NbFrames - 1) * 0.99)];
+   Summary.LatencyMax = Latencies[NbFrames - 1];
+
+   if(HookData.FixedLatency >= 0 && HookData.PacketsPerFrame > 1)
+      {
+      MIL_DOUBLE WireTime = HookData.PacketsPerFrame * HookData.PacketWireTime;
+      MIL_DOUBLE Delay = HookData.CameraTickFreq ? (MIL_DOUBLE)Summary.DelayTickVal / HookData.CameraTickFreq : 0.0;
+      Summary.TransferP50 = Summary.LatencyP50 - HookData.FixedLatency;
+      Summary.TransferP99 = Summary.LatencyP99 - HookData.FixedLatency;
+      Summary.TransferMax = Summary.LatencyMax - HookData.FixedLatency;
+      if(Delay > 0)
+         Summary.SpreadRatio = (Summary.TransferP50 - WireTime) / ((HookData.PacketsPerFrame - 1) * Delay);
+      }
+   }
+
+/* Acquire a sequence with a delay and measure its frame latencies. The results are  */
+/* not used; the parameter is part of the DelayMeasurementFunction signature.         */
+/* ---------------------------------------------------------------------------------- */
+bool MeasureLatencies(MIL_ID MilDigitizer, const PacketDelayResults& /*Results*/, HookDataStruct& HookData,
+                      MIL_INT DelayTickVal, SequenceSummary& Summary)
+   {
+   MIL_DOUBLE FrameRate = 0;
+
+   SetInterPacketDelay(MilDigitizer, HookData, DelayTickVal);
+   FrameRate = AcquireSequence(MilDigitizer, HookData);
+   SummarizeSequence(HookData, DelayTickVal, FrameRate, Summary);
+   return HookData.FrameCount > 0;
+   }
+
+/* Find the smallest delay at which the free-running camera delivers its frames      */
+/* without loss. Each frame then arrives as early as the FIFOs on its path allow.    */
+/* --------------------------------------------------------------------------------- */
+void FindLatencyInterPacketDelay(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results,
+                                 HookDataStruct& HookData)
+   {
+   /* Without delay, the frame is sent at line rate; the rest of the latency is spent in
+      the camera. */
+   SequenceSummary& Reference = Info.ReferenceIntervals;
+   HookData.FixedLatency = max(Reference.LatencyP50 - HookData.PacketsPerFrame * HookData.PacketWireTime, 0.0);
+   Reference.TransferP50 = Reference.LatencyP50 - HookData.FixedLatency;
+   Reference.TransferP99 = Reference.LatencyP99 - HookData.FixedLatency;
+   Reference.TransferMax = Reference.LatencyMax - HookData.FixedLatency;
+   Results.ReferenceIntervals[Results.Selection] = Reference;
+
+   if(!FindSmallestLossFreeDelay(MilDigitizer, Info, Results, HookData, MeasureLatencies, Info.ReferenceIntervals) &&
+      !HookData.Cancelled)
+      MosPrintf(MIL_TEXT("\nNo delay delivers the frames without loss.\n"));
+   }
+
+/* Remove an additional 15% from the optimal delay found. With payload verification, */
+/* stay above the delays that corrupted frames and check that the reduced delay      */
+/* still gives bit-exact frames.                                                     */
+/* --------------------------------------------------------------------------------- */
+void ApplyDelayMargin(MIL_ID MilDigitizer, PacketDelayInfo& Info, HookDataStruct& HookData)
+   {
+   MIL_INT OptimalTickVal = Info.DelayTickVal;
+   MIL_DOUBLE OptimalDelay = Info.DelayInSeconds;
+   Info.DelayInSeconds -= (Info.DelayInSeconds * 15.0 / 100.0);
+   if(Info.DelayInSeconds <= 0.0)
+      Info.DelayInSeconds = 0.0;
+
+   Info.DelayTickVal = (MIL_UINT32)(Info.DelayInSeconds * Info.TickFreq);
+   if(Info.DelayTickVal <= Info.CorruptedDelayTickVal)
+      {
+      Info.DelayTickVal = (Info.CorruptedDelayTickVal + OptimalTickVal + 1) / 2;
+      Info.DelayInSeconds = (MIL_DOUBLE)Info.DelayTickVal / Info.TickFreq;
+      }
+   SetInterPacketDelay(MilDigitizer, HookData, Info.DelayTickVal);
+
+   if(HookData.PayloadCompare)
+      {
+      SequenceSummary Summary;
+      Info.ProcessFrameRate = AcquireSequence(MilDigitizer, HookData);
+      SummarizeSequence(HookData, Info.DelayTickVal, Info.ProcessFrameRate, Summary);
+      Info.Measurements.push_back(Summary);
+      if(Summary.PayloadFramesCorrupted > 0)
+         {
+         Info.DelayTickVal = OptimalTickVal;
+         Info.DelayInSeconds = OptimalDelay;
+         SetInterPacketDelay(MilDigitizer, HookData, Info.DelayTickVal);
+         }
+      }
+   }
+
+/* Search the inter-packet delay with Bayesian optimization seeded with the          */
+/* observations of other units of the same camera model. The search maximizes the    */
+/* delay subject to the frame rate matching the reference: the next delay measured   */
+/* is the one with the highest feasibility-weighted gain, i.e. the gain over the     */
+/* largest delay measured to keep the frame rate times the probability that it does. */
+/* Unlike the expected improvement, the gain does not integrate over the predicted   */
+/* throughput; it only weighs a deterministic gain by the feasibility.               */
+/* --------------------------------------------------------------------------------- */
+void FindInterPacketDelayBayesian(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results,
+                                  HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+
+   /* Search range and resolution, relative to the theoretical delay. */
+   const MIL_DOUBLE MinRatio = 0.02;
+   const MIL_DOUBLE RatioStep = 0.005;
+   /* Stop when the weighted gain is below this fraction of the theoretical delay. */
+   const MIL_DOUBLE MinGain = 0.005;
+
+   MIL_STRING Model;
+   MIL_INT PacketSize = 0;
+   MdigInquire(MilDigitizer, M_CAMERA_MODEL, Model);
+   MdigInquire(MilDigitizer, M_GC_PACKET_SIZE, &PacketSize);
+   string ModelName = ToSingleWord(ToNarrowString(Model));
+   string PixelFormat = ToNarrowString(Results.PixelFormats[Results.Selection]);
+   MIL_DOUBLE TheoreticalDelay = Info.DelayInSeconds;
+
+   vector<DelayObservation> Observations;
+   LoadDelayPrior(ModelName, Observations, Settings);
+   size_t NbPriorObservations = Observations.size();
+
+   if((MIL_INT)NbPriorObservations < Settings.BayesianPriorMinPoints || TheoreticalDelay <= 0.0 || Info.BaseFrameRate <= 0.0)
+      {
+      MosPrintf(MIL_TEXT("%d prior observations for this camera model; using the iterative search.\n"),
+         (int)NbPriorObservations);
+      FindInterPacketDelay(MilDigitizer, Info, Results, HookData);
+      if(TheoreticalDelay > 0.0 && Info.BaseFrameRate > 0.0 && !HookData.Cancelled)
+         AppendDelayPrior(ModelName, PixelFormat, PacketSize, Info, TheoreticalDelay, Settings);
+      return;
+      }
+
+   /* The frame rate is kept when the throughput is within the IsEqual tolerance. */
+   const MIL_DOUBLE Threshold = 1.0 - 0.1 / Info.BaseFrameRate;
+   MIL_DOUBLE BestRatio = 0.0;
+   MIL_DOUBLE BestFrameRate = 0.0;
+   MIL_INT NbAcquisitions = 0;
+   vector<MIL_DOUBLE> Cholesky, Weights;
+
+   while(NbAcquisitions < Settings.BayesianMaxAcquisitions)
+      {
+      if(!FitGaussianProcess(Observations, Cholesky, Weights))
+         break;
+
+      /* Find the delay of highest weighted gain, up to the theoretical delay or
+         the largest delay observed. Delays below the largest one that corrupted
+         payloads are never candidates. */
+      MIL_DOUBLE MaxRatio = 1.0;
+      for(size_t i = 0; i < Observations.size(); i++)
+         MaxRatio = max(MaxRatio, Observations[i].DelayRatio);
+      MIL_DOUBLE MinCandidate = max(MinRatio, BestRatio + RatioStep);
+      if(Info.CorruptedDelayTickVal >= 0)
+         MinCandidate = max(MinCandidate, (Info.CorruptedDelayTickVal + 1) / (TheoreticalDelay * Info.TickFreq));
+
+      MIL_DOUBLE NextRatio = 0.0, MaxGain = 0.0;
+      for(MIL_DOUBLE Ratio = MinCandidate; Ratio <= MaxRatio; Ratio += RatioStep)
+         {
+         MIL_DOUBLE Mean, Variance;
+         PredictGaussianProcess(Observations, Cholesky, Weights, Ratio, Mean, Variance);
+         MIL_DOUBLE Feasibility = 0.5 * erfc(-(Mean - Threshold) / sqrt(2.0 * max(Variance, 1e-12)));
+         MIL_DOUBLE Gain = (Ratio - BestRatio) * Feasibility;
+         if(Gain > MaxGain)
+            {
+            MaxGain = Gain;
+            NextRatio = Ratio;
+            }
+         }
+      if(MaxGain < MinGain)
+         break;
+
+      /* Measure the frame rate at that delay. */
+      Info.DelayInSeconds = NextRatio * TheoreticalDelay;
+      Info.DelayTickVal = (MIL_UINT32)(Info.DelayInSeconds * Info.TickFreq);
+      SetInterPacketDelay(MilDigitizer, HookData, Info.DelayTickVal);
+      Info.ProcessFrameRate = AcquireSequence(MilDigitizer, HookData);
+      if(HookData.Cancelled)
+         break;
+      NbAcquisitions++;
+
+      SequenceSummary Summary;
+      SummarizeSequence(HookData, Info.DelayTickVal, Info.ProcessFrameRate, Summary);
+      Info.Measurements.push_back(Summary);
+      Observations.push_back(ObserveDelay(Info, Summary, TheoreticalDelay, Settings));
+
+      if(Settings.PrintDetails)
+         MosPrintf(MIL_TEXT("Programming delay of %d ticks (%.3f x theoretical, weighted gain %.3f); ")
+            MIL_TEXT("frame-rate obtained: %.2f\n"), (int)Info.DelayTickVal, NextRatio, MaxGain,
+            Info.ProcessFrameRate);
+      else
+         MosPrintf(MIL_TEXT("."));
+
+      if(Summary.PayloadFramesCorrupted > 0 && Info.DelayTickVal > Info.CorruptedDelayTickVal)
+         Info.CorruptedDelayTickVal = Info.DelayTickVal;
+      if(Observations.back().Throughput >= Threshold && IsTailWithinBounds(Info, Summary, Settings) &&
+         Summary.PayloadFramesCorrupted == 0)
+         {
+         BestRatio = NextRatio;
+         BestFrameRate = Info.ProcessFrameRate;
+         }
+      }
+
+   MosPrintf(MIL_TEXT("\nBayesian search: %d acquisitions with %d prior observations.\n"),
+      (int)NbAcquisitions, (int)NbPriorObservations);
+
+   /* A cancelled search leaves the results and the prior untouched. */
+   if(HookData.Cancelled)
+      {
+      Info.Error = true;
+      return;
+      }
+
+   if(BestRatio > 0.0)
+      {
+      /* Keep the largest delay measured to keep the frame rate, minus the usual margin. */
+      Info.DelayInSeconds = BestRatio * TheoreticalDelay;
+      Info.DelayTickVal = (MIL_UINT32)(Info.DelayInSeconds * Info.TickFreq);
+      Info.ProcessFrameRate = BestFrameRate;
+      ApplyDelayMargin(MilDigitizer, Info, HookData);
+
+      Results.InterPacketDelayInTicks[Results.Selection] = Info.DelayTickVal;
+      Results.InterPacketDelayInSec[Results.Selection] = Info.DelayInSeconds;
+      Results.ObtainedFrameRate[Results.Selection] = Info.ProcessFrameRate;
+      Results.Measurements[Results.Selection] = Info.Measurements;
+      }
+   else
+      {
+      /* The prior does not fit this unit; restart from the theoretical delay. */
+      MosPrintf(MIL_TEXT("No delay kept the frame rate; using the iterative search.\n"));
+      Info.DelayInSeconds = TheoreticalDelay;
+      Info.DelayTickVal = (MIL_UINT32)(Info.DelayInSeconds * Info.TickFreq);
+      Info.EqualityCounter = 0;
+      FindInterPacketDelay(MilDigitizer, Info, Results, HookData);
+      }
+
+   if(!HookData.Cancelled)
+      AppendDelayPrior(ModelName, PixelFormat, PacketSize, Info, TheoreticalDelay, Settings);
+   }
+
+/* Convert a measurement to an observation of the Bayesian search. */
+/* --------------------------------------------------------------- */
+DelayObservation ObserveDelay(const PacketDelayInfo& Info, const SequenceSummary& Summary,
+                              MIL_DOUBLE TheoreticalDelay, const PacketDelaySettings& Settings)
+   {
+   /* Measurement noise of a sequence, as a fraction of the reference frame rate. */
+   const MIL_DOUBLE NoiseVariance = 0.01 * 0.01;
+
+   MIL_DOUBLE DelayRatio = (MIL_DOUBLE)Summary.DelayTickVal / (TheoreticalDelay * Info.TickFreq);
+   MIL_DOUBLE Throughput = Summary.FrameRate / Info.BaseFrameRate -
+      (MIL_DOUBLE)GetLostFrameCount(Summary) / Settings.SequenceFrameCount;
+   return DelayObservation(DelayRatio, min(Throughput, 1.0), NoiseVariance);
+   }
+
+/* Squared exponential kernel of the Gaussian process, over delay ratios. */
+/* ---------------------------------------------------------------------- */
+static const MIL_DOUBLE GpSignalVariance = 0.3 * 0.3;
+static const MIL_DOUBLE GpLengthScale = 0.15;
+
+static MIL_DOUBLE GpKernel(MIL_DOUBLE A, MIL_DOUBLE B)
+   {
+   MIL_DOUBLE Distance = (A - B) / GpLengthScale;
+   return GpSignalVariance * exp(-0.5 * Distance * Distance);
+   }
+
+/* Fit a Gaussian process with a constant mean of 1 (the frame rate is kept). The    */
+/* Cholesky factor of the kernel matrix and the weights of the posterior mean are     */
+/* returned.                                                                          */
+/* ---------------------------------------------------------------------------------- */
+bool FitGaussianProcess(const vector<DelayObservation>& Observations, vector<MIL_DOUBLE>& Cholesky,
+                        vector<MIL_DOUBLE>& Weights)
+   {
+   size_t n = Observations.size();
+   Cholesky.assign(n * n, 0.0);
+   Weights.assign(n, 0.0);
+
+   for(size_t i = 0; i < n; i++)
+      {
+      for(size_t j = 0; j <= i; j++)
+         {
+         MIL_DOUBLE Sum = GpKernel(Observations[i].DelayRatio, Observations[j].DelayRatio);
+         if(i == j)
+            Sum += Observations[i].NoiseVariance;
+         for(size_t k = 0; k < j; k++)
+            Sum -= Cholesky[i * n + k] * Cholesky[j * n + k];
+         if(i == j)
+            {
+            if(Sum <= 0.0)
+               return false;
+            Cholesky[i * n + i] = sqrt(Sum);
+            }
+         else
+            Cholesky[i * n + j] = Sum / Cholesky[j * n + j];
+         }
+      }
+
+   /* Solve L L' w = y - 1. */
+   for(size_t i = 0; i < n; i++)
+      {
+      MIL_DOUBLE Sum = Observations[i].Throughput - 1.0;
+      for(size_t k = 0; k < i; k++)
+         Sum -= Cholesky[i * n + k] * Weights[k];
+      Weights[i] = Sum / Cholesky[i * n + i];
+      }
+   for(size_t i = n; i-- > 0; )
+      {
+      MIL_DOUBLE Sum = Weights[i];
+      for(size_t k = i + 1; k < n; k++)
+         Sum -= Cholesky[k * n + i] * Weights[k];
+      Weights[i] = Sum / Cholesky[i * n + i];
+      }
+   return true;
+   }
+
+/* Return the posterior mean and variance of the throughput at a delay. */
+/* -------------------------------------------------------------------- */
+void PredictGaussianProcess(const vector<DelayObservation>& Observations, const vector<MIL_DOUBLE>& Cholesky,
+                            const vector<MIL_DOUBLE>& Weights, MIL_DOUBLE DelayRatio,
+                            MIL_DOUBLE& Mean, MIL_DOUBLE& Variance)
+   {
+   size_t n = Observations.size();
+   vector<MIL_DOUBLE> Solved(n);
+
+   Mean = 1.0;
+   Variance = GpSignalVariance;
+   for(size_t i = 0; i < n; i++)
+      {
+      MIL_DOUBLE Covariance = GpKernel(DelayRatio, Observations[i].DelayRatio);
+      Mean += Covariance * Weights[i];
+
+      /* Forward substitution of L v = k. */
+      MIL_DOUBLE Sum = Covariance;
+      for(size_t k = 0; k < i; k++)
+         Sum -= Cholesky[i * n + k] * Solved[k];
+      Solved[i] = Sum / Cholesky[i * n + i];
+      Variance -= Solved[i] * Solved[i];
+      }
+   }
+
+/* Read the most recent observations stored for a camera model. */
+/* ------------------------------------------------------------ */
+void LoadDelayPrior(const string& Model, vector<DelayObservation>& Observations, const PacketDelaySettings& Settings)
+   {
+   /* Other units of the model, or other configurations, deviate more than the
+      measurement noise. */
+   const MIL_DOUBLE PriorNoiseVariance = 0.05 * 0.05;
+
+   FILE* File = fopen(Settings.BayesianPriorFile.c_str(), "r");
+   if(!File)
+      return;
+
+   char Line[512];
+   while(fgets(Line, sizeof(Line), File))
+      {
+      char LineModel[128], PixelFormat[128];
+      int PacketSize;
+      double DelayRatio, Throughput;
+      if(sscanf(Line, "%127s %127s %d %lf %lf", LineModel, PixelFormat, &PacketSize, &DelayRatio, &Throughput) == 5 &&
+         Model == LineModel)
+         Observations.push_back(DelayObservation(DelayRatio, Throughput, PriorNoiseVariance));
+      }
+   fclose(File);
+
+   if((MIL_INT)Observations.size() > Settings.BayesianPriorMaxPoints)
+      Observations.erase(Observations.begin(), Observations.end() - Settings.BayesianPriorMaxPoints);
+   }
+
+/* Add the observations of a calibration to the prior file. An observation replaces */
+/* an older one of the same configuration and delay, and only the most recent       */
+/* BayesianPriorMaxPoints observations of the model are kept.                       */
+/* -------------------------------------------------------------------------------- */
+void AppendDelayPrior(const string& Model, const string& PixelFormat, MIL_INT PacketSize,
+                      const PacketDelayInfo& Info, MIL_DOUBLE TheoreticalDelay, const PacketDelaySettings& Settings)
+   {
+   vector<string> Lines, Keys;
+   vector<bool> IsModel;
+   char Line[512];
+
+   /* The file is shared by the tuners of every camera; hold its lock from the read to
+      the replacement, so the observations of a tuner updating it at the same time are
+      not lost. */
+   string LockFileName = Settings.BayesianPriorFile + ".lock";
+   FileLock Lock;
+   if(!AcquireFileLock(LockFileName.c_str(), Lock))
+      {
+      MosPrintf(MIL_TEXT("Unable to lock %s.\n"), ToMilString(Settings.BayesianPriorFile.c_str()).c_str());
+      return;
+      }
+
+   /* Read the current observations with their configuration and delay. */
+   FILE* File = fopen(Settings.BayesianPriorFile.c_str(), "r");
+   if(File)
+      {
+      while(fgets(Line, sizeof(Line), File))
+         {
+         char LineModel[128], LinePixelFormat[128], Key[320];
+         int LinePacketSize;
+         double DelayRatio, Throughput;
+         if(sscanf(Line, "%127s %127s %d %lf %lf", LineModel, LinePixelFormat, &LinePacketSize,
+            &DelayRatio, &Throughput) != 5)
+            continue;
+         snprintf(Key, sizeof(Key), "%s %s %d %.4f", LineModel, LinePixelFormat, LinePacketSize, DelayRatio);
+         Lines.push_back(Line);
+         Keys.push_back(Key);
+         IsModel.push_back(Model == LineModel);
+         }
+      fclose(File);
+      }
+
+   /* Append the new observations, dropping the older ones they replace. */
+   for(size_t i = 0; i < Info.Measurements.size(); i++)
+      {
+      DelayObservation Observation = ObserveDelay(Info, Info.Measurements[i], TheoreticalDelay, Settings);
+      char Key[320];
+      snprintf(Key, sizeof(Key), "%s %s %d %.4f", Model.c_str(), PixelFormat.c_str(), (int)PacketSize,
+         Observation.DelayRatio);
+      snprintf(Line, sizeof(Line), "%s %.4f\n", Key, Observation.Throughput);
+      for(size_t j = Keys.size(); j-- > 0; )
+         {
+         if(Keys[j] == Key)
+            {
+            Lines.erase(Lines.begin() + j);
+            Keys.erase(Keys.begin() + j);
+            IsModel.erase(IsModel.begin() + j);
+            }
+         }
+      Lines.push_back(Line);
+      Keys.push_back(Key);
+      IsModel.push_back(true);
+      }
+
+   /* Drop the oldest observations of the model beyond the maximum. */
+   size_t NbModelLines = (size_t)count(IsModel.begin(), IsModel.end(), true);
+   for(size_t j = 0; j < Lines.size() && (MIL_INT)NbModelLines > Settings.BayesianPriorMaxPoints; )
+      {
+      if(IsModel[j])
+         {
+         Lines.erase(Lines.begin() + j);
+         IsModel.erase(IsModel.begin() + j);
+         NbModelLines--;
+         }
+      else
+         j++;
+      }
+
+   /* Replace the file atomically. */
+   string TempFileName = Settings.BayesianPriorFile + ".tmp";
+   File = fopen(TempFileName.c_str(), "w");
+   if(!File)
+      {
+      MosPrintf(MIL_TEXT("Unable to write %s.\n"), ToMilString(Settings.BayesianPriorFile.c_str()).c_str());
+      ReleaseFileLock(Lock);
+      return;
+      }
+   for(size_t j = 0; j < Lines.size(); j++)
+      fputs(Lines[j].c_str(), File);
+   bool Written = (fclose(File) == 0);
+#if M_MIL_USE_WINDOWS
+   if(Written)
+      remove(Settings.BayesianPriorFile.c_str());
+#endif
+   if(!Written || rename(TempFileName.c_str(), Settings.BayesianPriorFile.c_str()) != 0)
+      {
+      MosPrintf(MIL_TEXT("Unable to write %s.\n"), ToMilString(Settings.BayesianPriorFile.c_str()).c_str());
+      remove(TempFileName.c_str());
+      }
+   ReleaseFileLock(Lock);
+   }
+
+/* Open a lock file, creating it if needed, and wait for its exclusive lock. */
+/* ------------------------------------------------------------------------- */
+bool AcquireFileLock(const char* FileName, FileLock& Lock)
+   {
+#if M_MIL_USE_WINDOWS
+   Lock.File = CreateFileA(FileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                           OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+   if(Lock.File == INVALID_HANDLE_VALUE)
+      return false;
+   OVERLAPPED Overlapped = {0};
+   if(!LockFileEx(Lock.File, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &Overlapped))
+      {
+      ReleaseFileLock(Lock);
+      return false;
+      }
+#else
+   Lock.File = open(FileName, O_RDWR | O_CREAT, 0644);
+   if(Lock.File < 0)
+      return false;
+   int Result;
+   do
+      Result = flock(Lock.File, LOCK_EX);
+   while(Result != 0 && errno == EINTR);
+   if(Result != 0)
+      {
+      ReleaseFileLock(Lock);
+      return false;
+      }
+#endif
+   return true;
+   }
+
+/* Release the lock by closing its file. */
+/* ------------------------------------- */
+void ReleaseFileLock(FileLock& Lock)
+   {
+#if M_MIL_USE_WINDOWS
+   if(Lock.File != INVALID_HANDLE_VALUE)
+      CloseHandle(Lock.File);
+   Lock.File = INVALID_HANDLE_VALUE;
+#else
+   if(Lock.File >= 0)
+      close(Lock.File);
+   Lock.File = -1;
+#endif
+   }
+
+/* Return a string with blanks replaced so it is read back as a single word. */
+/* ------------------------------------------------------------------------- */
+string ToSingleWord(const string& Str)
+   {
+   string Result = Str.empty() ? string("unknown") : Str;
+   for(size_t i = 0; i < Result.size(); i++)
+      {
+      if(Result[i] == ' ' || Result[i] == '\t')
+         Result[i] = '_';
+      }
+   return Result;
+   }
+
+/* Validate that the tail of the inter-frame intervals obtained with a delay stays   */
+/* within TailIntervalLimit times the median interval of the reference.              */
+/* --------------------------------------------------------------------------------- */
+bool IsTailWithinBounds(const PacketDelayInfo& Info, const SequenceSummary& Summary, const PacketDelaySettings& Settings)
+   {
+   if(Settings.TailIntervalLimit <= 0.0 || Info.ReferenceIntervals.P50 <= 0.0)
+      return true;
+
+   return Summary.P999 <= Info.ReferenceIntervals.P50 * Settings.TailIntervalLimit;
+   }
+
+/* Print the results for each pixel format. */
+/* ---------------------------------------- */
+void PrintResults(MIL_ID MilDigitizer, PacketDelayResults& Results, const PacketDelaySettings& Settings)
+   {
+   MIL_STRING Model, Vendor;
+   MIL_INT PacketSize = 0;
+
+   /* Found optimal solution, print results. */
+   MdigInquire(MilDigitizer, M_CAMERA_VENDOR, Vendor);
+   MdigInquire(MilDigitizer, M_CAMERA_MODEL, Model);
+   MdigInquire(MilDigitizer, M_GC_PACKET_SIZE, &PacketSize);
+
+#if M_MIL_USE_WINDOWS
+   system("cls");
+#endif
+   MosPrintf(MIL_TEXT("Inter-packet delay report summary for %s %s:\n\n"), Vendor.c_str(), Model.c_str());
+   MosPrintf(MIL_TEXT("Camera parameters:\n"));
+   MosPrintf(MIL_TEXT("Camera SizeX:         %lld\n"), (long long)(MdigInquire(MilDigitizer, M_SIZE_X, M_NULL)));
+   MosPrintf(MIL_TEXT("Camera SizeY:         %lld\n"), (long long)(MdigInquire(MilDigitizer, M_SIZE_Y, M_NULL)));
+   MosPrintf(MIL_TEXT("Camera Packet size:   %d\n\n"), (int)PacketSize);
+
+   for (size_t i = 0; i < Results.PixelFormats.size(); i++)
+      {
+      MosPrintf(MIL_TEXT("Camera Pixel format:  %s\n"), Results.PixelFormats[i].c_str());
+      MosPrintf(MIL_TEXT("Inter-packet delay of %d ticks (%.3f usec) calculated.\n"),
+         (int)Results.InterPacketDelayInTicks[i], Results.InterPacketDelayInSec[i]*1e6);
+      MosPrintf(MIL_TEXT("Reference frame rate: %.1f\n"), Results.ReferenceFrameRate[i]);
+      MosPrintf(MIL_TEXT("Obtained frame rate:  %.1f\n"), Results.ObtainedFrameRate[i]);
+      MosPrintf(MIL_TEXT("Grab buffers:         %d (%.1f MB)\n"), (int)Results.GrabBufferCount[i],
+         (MIL_DOUBLE)Results.GrabBufferSizeByte[i] / (1024.0 * 1024.0));
+      MosPrintf(MIL_TEXT("Link speed:           %d Mbit/s (%s)\n"), (int)Results.LinkSpeedMbps[i],
+         GetLinkSpeedSourceName(Results.LinkSpeedSource[i]));
+      if(Results.ThroughputLimit[i] > 0)
+         MosPrintf(MIL_TEXT("Throughput limit:     %lld bytes/s (%.1f Mbit/s)\n"), (long long)Results.ThroughputLimit[i],
+            Results.ThroughputLimit[i] * 8.0 / 1e6);
+      if(Settings.TimeBudgetSec > 0 && Results.DelayUpperBound[i] >= 0)
+         MosPrintf(MIL_TEXT("Optimal delay bounds: %d to %d ticks\n"), (int)Results.DelayLowerBound[i],
+            (int)Results.DelayUpperBound[i]);
+      else if(Settings.TimeBudgetSec > 0 && Results.DelayLowerBound[i] > 0)
+         MosPrintf(MIL_TEXT("Optimal delay bounds: above %d ticks\n"), (int)Results.DelayLowerBound[i]);
+      MosPrintf(MIL_TEXT("Reference intervals:  p50 %.3f, p99 %.3f, p99.9 %.3f, max %.3f msec\n"),
+         Results.ReferenceIntervals[i].P50*1e3, Results.ReferenceIntervals[i].P99*1e3,
+         Results.ReferenceIntervals[i].P999*1e3, Results.ReferenceIntervals[i].Max*1e3);
+      if(!Settings.TargetFrameRates.empty())
+         PrintTargetFrameRates(Results.TargetRates[i]);
+      else if(Settings.StreamChannelCalibration)
+         PrintStreamChannels(Results.StreamChannels[i], Settings);
+      if(Results.Validations[i].Validated)
+         PrintValidation(Results.Validations[i]);
+      if(Settings.CalibrationMode == CALIBRATION_MODE_LATENCY)
+         MosPrintf(MIL_TEXT("Reference latency:    mean %.3f, p50 %.3f, p99 %.3f, max %.3f msec\n"),
+            Results.ReferenceIntervals[i].LatencyMean*1e3, Results.ReferenceIntervals[i].LatencyP50*1e3,
+            Results.ReferenceIntervals[i].LatencyP99*1e3, Results.ReferenceIntervals[i].LatencyMax*1e3);
+      for (size_t j = 0; j < Results.Measurements[i].size(); j++)
+         {
+         const SequenceSummary& Summary = Results.Measurements[i][j];
+         /* Only print the measurement of the calculated delay. */
+         if(!Settings.PrintDetails && j + 1 < Results.Measurements[i].size())
+            continue;
+         MosPrintf(MIL_TEXT("%6d ticks intervals: p50 %.3f, p99 %.3f, p99.9 %.3f, max %.3f msec (%.1f fps)\n"),
+            (int)Summary.DelayTickVal, Summary.P50*1e3, Summary.P99*1e3, Summary.P999*1e3,
+            Summary.Max*1e3, Summary.FrameRate);
+         if(Settings.MissingPacketScan)
+            MosPrintf(MIL_TEXT("%6d ticks scan:      %d packets missing in %d frames\n"),
+               (int)Summary.DelayTickVal, (int)Summary.PacketsMissing, (int)Summary.FramesIncomplete);
+         if(Settings.PayloadVerification != PAYLOAD_VERIFICATION_NONE)
+            MosPrintf(MIL_TEXT("%6d ticks payload:   %d frames corrupted (%lld bytes)\n"),
+               (int)Summary.DelayTickVal, (int)Summary.PayloadFramesCorrupted,
+               (long long)Summary.PayloadBytesCorrupted);
+         if(Settings.CalibrationMode == CALIBRATION_MODE_LATENCY)
+            {
+            MosPrintf(MIL_TEXT("%6d ticks latency:   mean %.3f, p50 %.3f, p99 %.3f, max %.3f msec\n"),
+               (int)Summary.DelayTickVal, Summary.LatencyMean*1e3, Summary.LatencyP50*1e3,
+               Summary.LatencyP99*1e3, Summary.LatencyMax*1e3);
+            MosPrintf(MIL_TEXT("%6d ticks transfer:  p50 %.3f, p99 %.3f, max %.3f msec, ")
+               MIL_TEXT("%.0f%% of the intended spread (p50)\n"),
+               (int)Summary.DelayTickVal, Summary.TransferP50*1e3, Summary.TransferP99*1e3,
+               Summary.TransferMax*1e3, Summary.SpreadRatio*100.0);
+            }
+         if(Settings.CalibrationMode == CALIBRATION_MODE_BURST)
+            MosPrintf(MIL_TEXT("%6d ticks burst:     %.3f msec, max %.3f msec, %d frames not delivered\n"),
+               (int)Summary.DelayTickVal, Summary.BurstTime*1e3, Summary.BurstTimeMax*1e3,
+               (int)Summary.FramesNotDelivered);
+         }
+      MosPrintf(MIL_TEXT("----------------------------------------------------------\n"));
+      }
+
+   PrintThreadPlacement(Results.Placement, Settings);
+   MosPrintf(MIL_TEXT("Missing packet scan:  %s\n"), Results.MissingPacketScanName);
+   MosPrintf(MIL_TEXT("Payload verification: %s\n"), Results.PayloadVerificationName.c_str());
+   MosPrintf(MIL_TEXT("Bandwidth control:    %s\n"), Results.BandwidthControlName.c_str());
+   if(Settings.CalibrationMode == CALIBRATION_MODE_LATENCY)
+      PrintClockAlignment(Results.Alignment);
+   if(Settings.CalibrationMode == CALIBRATION_MODE_BURST)
+      MosPrintf(MIL_TEXT("Burst trigger:        %s, %d bursts of %d frames\n"), Results.BurstTriggerName.c_str(),
+         Settings.BurstCount, Settings.BurstFrameCount);
+
+   MosPrintf(MIL_TEXT("\nPrinted inter-packet delay results are valid only for ")
+      MIL_TEXT("the above parameters and thread placement\n"));
+   }
+
+/* User's processing function called every time a grab buffer is modified. */
+/* ----------------------------------------------------------------------- */
+MIL_INT MFTYPE ProcessingFunction(MIL_INT HookType,
+                                  MIL_ID HookId,
+                                  void* HookDataPtr)
+   {
+   HookDataStruct* HookData = (HookDataStruct*)HookDataPtr;
+   MIL_ID ModifiedBufferId;
+   MIL_DOUBLE FrameTime = 0, EndTime = 0;
+
+   MappTimer(M_DEFAULT, M_TIMER_READ, &FrameTime);
+
+   /* Pin the hook thread and raise its priority on the first frame of the sequence. */
+   if(!HookData->Placement->Configured)
+      ApplyHookThreadPlacement(*HookData->Placement);
+   HookData->Placement->ObservedCpu = GetCurrentCpu();
+
+   /* Accumulate the interval between two frames, except across the idle time that
+      precedes a burst. */
+   bool BurstStart = false;
+   if(HookData->Settings->CalibrationMode == CALIBRATION_MODE_BURST)
+      {
+      BurstStart = HookData->BurstArmed.load(memory_order_acquire) && HookData->BurstArmed.exchange(false);
+      if(BurstStart)
+         {
+         HookData->BurstFirstTime.store(FrameTime, memory_order_relaxed);
+         HookData->BurstFrames.store(0, memory_order_relaxed);
+         }
+      HookData->BurstLastTime.store(FrameTime, memory_order_relaxed);
+      HookData->BurstFrames.fetch_add(1, memory_order_release);
+      }
+   if(!BurstStart && HookData->FrameCount > 0)
+      {
+      MIL_DOUBLE Interval = FrameTime - HookData->PreviousFrameTime;
+      if(Interval > HookData->MaxFrameInterval)
+         HookData->MaxFrameInterval = Interval;
+      AddToHistogram(HookData->Intervals, Interval);
+      }
+   HookData->PreviousFrameTime = FrameTime;
+
+   /* Record the frame's host time and camera timestamp for the latency measurement. */
+   if(HookData->FrameCount < (MIL_INT)HookData->HostTimes.size())
+      {
+      HookData->HostTimes[HookData->FrameCount] = FrameTime;
+      MdigGetHookInfo(HookId, M_GC_CAMERA_TIME_STAMP, &HookData->CameraTimes[HookData->FrameCount]);
+      }
+   if(HookData->FrameCount < (MIL_INT)HookData->FrameTimes.size())
+      HookData->FrameTimes[HookData->FrameCount] = FrameTime;
+   HookData->FrameCount++;
+
+   /* Retrieve the MIL_ID of the grabbed buffer. */
+   MdigGetHookInfo(HookId, M_MODIFIED_BUFFER+M_BUFFER_ID, &ModifiedBufferId);
+
+   /* Compare the payload with the expected test pattern. This must be done before the
+      missing packet scan fills the buffer with the sentinel again. */
+   MIL_INT PayloadFramesCorrupted = HookData->PayloadFramesCorrupted;
+   if(HookData->PayloadCompare)
+      VerifyPayload(*HookData, ModifiedBufferId);
+
+   /* Look for packets that left the sentinel untouched. */
+   MIL_INT Missing = 0;
+   if(HookData->IsSentinel)
+      {
+      Missing = ScanMissingPackets(*HookData, ModifiedBufferId);
+      if(Missing > 0)
+         {
+         HookData->FramesIncomplete++;
+         HookData->PacketsMissing += Missing;
+         HookData->LastIncompleteMap = HookData->MissingPacketMap;
+         }
+      }
+
+   /* Append the frame to the frame log. */
+   if(HookData->FrameLog)
+      {
+      FrameLogRecordData Record;
+      Record.HostTime = FrameTime;
+      Record.CameraTime = 0;
+      MdigGetHookInfo(HookId, M_GC_CAMERA_TIME_STAMP, &Record.CameraTime);
+      Record.DelayTickVal = (MIL_INT32)HookData->DelayTickVal;
+      Record.FrameIndex = (MIL_UINT32)(HookData->FrameCount - 1);
+      Record.PacketsMissing = (MIL_UINT32)Missing;
+      Record.Digitizer = HookData->FrameLogDigitizer;
+      Record.Status = (HookData->FrameCount == 1) ? FRAME_STATUS_FIRST : 0;
+      if(Missing > 0)
+         Record.Status |= FRAME_STATUS_INCOMPLETE;
+      if(HookData->PayloadFramesCorrupted > PayloadFramesCorrupted)
+         Record.Status |= FRAME_STATUS_CORRUPTED;
+      AppendFrameLog(*HookData->FrameLog, Record);
+      }
+
+   /* Update the statistics of the validation run. */
+   if(HookData->Validation)
+      RecordValidationFrame(*HookData->Validation, FrameTime, Missing,
+                            HookData->PayloadFramesCorrupted > PayloadFramesCorrupted);
+
+   /* Keep track of the longest time spent in the hook. */
+   MappTimer(M_DEFAULT, M_TIMER_READ, &EndTime);
+   if(EndTime - FrameTime > HookData->MaxHookDuration)
+      HookData->MaxHookDuration = EndTime - FrameTime;
+
+   return 0;
+   }
+ 
+/* Get the MIL buffer attributes that matches the camera's pixel format. */
+/* --------------------------------------------------------------------- */
+void GetMilBufferInfoFromPixelFormat(MIL_ID MilDigitizer, MIL_INT& SizeBand,
+                                     MIL_INT& BufType, MIL_INT64& Attribute)
+   {
+   MdigInquire(MilDigitizer, M_SIZE_BAND, &SizeBand);
+   MdigInquire(MilDigitizer, M_TYPE, &BufType);
+   MdigInquire(MilDigitizer, M_SOURCE_DATA_FORMAT, &Attribute);
+   }
+ 
+
+/* Parse a list of CPU cores such as "0,2,4-7". */
+/* -------------------------------------------- */
+void ParseCpuList(const char* CpuListStr, vector<int>& CpuList)
+   {
+   const char* Ptr = CpuListStr;
+   CpuList.clear();
+
+   while(*Ptr)
+      {
+      char* End = NULL;
+      long First = strtol(Ptr, &End, 10);
+      long Last = First;
+      if(End == Ptr)
+         {
+         /* Skip separators and invalid characters. */
+         Ptr++;
+         continue;
+         }
+      Ptr = End;
+      if(*Ptr == '-')
+         {
+         Last = strtol(Ptr + 1, &End, 10);
+         Ptr = End;
+         }
+      for(long Cpu = First; Cpu <= Last; Cpu++)
+         {
+         if(Cpu >= 0)
+            CpuList.push_back((int)Cpu);
+         }
+      }
+   }
+
+/* Apply the requested affinity and real-time priority to the calling (hook) thread. */
+/* --------------------------------------------------------------------------------- */
+void ApplyHookThreadPlacement(HookThreadPlacement& Placement)
+   {
+   Placement.Configured = true;
+   Placement.AffinityError = 0;
+   Placement.PriorityError = 0;
+
+#if M_MIL_USE_WINDOWS
+   if(!Placement.CpuList.empty())
+      {
+      DWORD_PTR Mask = 0;
+      for(size_t i = 0; i < Placement.CpuList.size(); i++)
+         {
+         if(Placement.CpuList[i] < (int)(sizeof(DWORD_PTR) * 8))
+            Mask |= ((DWORD_PTR)1 << Placement.CpuList[i]);
+         }
+      if(SetThreadAffinityMask(GetCurrentThread(), Mask) == 0)
+         Placement.AffinityError = (int)GetLastError();
+      }
+
+   if(Placement.RtPriority > 0)
+      {
+      if(!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+         Placement.PriorityError = (int)GetLastError();
+      }
+#else
+   if(!Placement.CpuList.empty())
+      {
+      cpu_set_t CpuSet;
+      CPU_ZERO(&CpuSet);
+      for(size_t i = 0; i < Placement.CpuList.size(); i++)
+         {
+         if(Placement.CpuList[i] < CPU_SETSIZE)
+            CPU_SET(Placement.CpuList[i], &CpuSet);
+         }
+      Placement.AffinityError = pthread_setaffinity_np(pthread_self(), sizeof(CpuSet), &CpuSet);
+      }
+
+   if(Placement.RtPriority > 0)
+      {
+      struct sched_param Param;
+      Param.sched_priority = Placement.RtPriority;
+      Placement.PriorityError = pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param);
+      }
+#endif
+   }
+
+/* Return the CPU core the calling thread is running on, or -1 if unknown. */
+/* ----------------------------------------------------------------------- */
+int GetCurrentCpu()
+   {
+#if M_MIL_USE_WINDOWS
+   return (int)GetCurrentProcessorNumber();
+#else
+   return sched_getcpu();
+#endif
+   }
+
+/* Return the NUMA node of a CPU core, or -1 if unknown. */
+/* ----------------------------------------------------- */
+int GetCpuNumaNode(int Cpu)
+   {
+   if(Cpu < 0)
+      return -1;
+
+#if M_MIL_USE_WINDOWS
+   UCHAR Node = 0;
+   if(Cpu < 256 && GetNumaProcessorNode((UCHAR)Cpu, &Node))
+      return (int)Node;
+   return -1;
+#else
+   /* The CPU's sysfs directory holds a "nodeN" link for its NUMA node. */
+   for(int Node = 0; Node < 1024; Node++)
+      {
+      char Path[128];
+      snprintf(Path, sizeof(Path), "/sys/devices/system/cpu/cpu%d/node%d", Cpu, Node);
+      if(access(Path, F_OK) == 0)
+         return Node;
+      }
+   return -1;
+#endif
+   }
+
+/* Return the NUMA node servicing a network interface, or -1 if unknown. */
+/* --------------------------------------------------------------------- */
+int GetNetworkInterfaceNumaNode(const char* InterfaceName)
+   {
+   int Node = -1;
+
+#if !M_MIL_USE_WINDOWS
+   if(InterfaceName[0] != '\0')
+      {
+      char Path[256];
+      snprintf(Path, sizeof(Path), "/sys/class/net/%s/device/numa_node", InterfaceName);
+      FILE* File = fopen(Path, "r");
+      if(File)
+         {
+         if(fscanf(File, "%d", &Node) != 1)
+            Node = -1;
+         fclose(File);
+         }
+      }
+#endif
+
+   return Node;
+   }
+
+/* Print the topology used by the hook thread during the measurements. */
+/* ------------------------------------------------------------------- */
+void PrintThreadPlacement(const HookThreadPlacement& Placement, const PacketDelaySettings& Settings)
+   {
+   MosPrintf(MIL_TEXT("\nHook thread placement:\n"));
+
+   MosPrintf(MIL_TEXT("Requested cores:      "));
+   if(Placement.CpuList.empty())
+      MosPrintf(MIL_TEXT("operating system default"));
+   for(size_t i = 0; i < Placement.CpuList.size(); i++)
+      MosPrintf(MIL_TEXT("%s%d"), i ? MIL_TEXT(",") : MIL_TEXT(""), Placement.CpuList[i]);
+   if(Placement.AffinityError)
+      MosPrintf(MIL_TEXT(" (not applied, error %d)"), Placement.AffinityError);
+   MosPrintf(MIL_TEXT("\n"));
+
+   if(Placement.RtPriority > 0)
+      {
+#if M_MIL_USE_WINDOWS
+      MosPrintf(MIL_TEXT("Scheduling:           THREAD_PRIORITY_TIME_CRITICAL"));
+#else
+      MosPrintf(MIL_TEXT("Scheduling:           SCHED_FIFO priority %d"), Placement.RtPriority);
+#endif
+      if(Placement.PriorityError)
+         MosPrintf(MIL_TEXT(" (not applied, error %d)"), Placement.PriorityError);
+      MosPrintf(MIL_TEXT("\n"));
+      }
+   else
+      MosPrintf(MIL_TEXT("Scheduling:           operating system default\n"));
+
+   MosPrintf(MIL_TEXT("Observed core:        %d (NUMA node %d)\n"),
+      Placement.ObservedCpu, GetCpuNumaNode(Placement.ObservedCpu));
+
+   if(!Settings.NetworkInterfaceName.empty())
+      MosPrintf(MIL_TEXT("NIC NUMA node:        %d (%s)\n"),
+         GetNetworkInterfaceNumaNode(Settings.NetworkInterfaceName.c_str()), ToMilString(Settings.NetworkInterfaceName.c_str()).c_str());
+   }
+
+/* Convert a narrow (ASCII) string to a MIL string. */
+/* ------------------------------------------------ */
+MIL_STRING ToMilString(const char* Str)
+   {
+   return MIL_STRING(Str, Str + strlen(Str));
+   }
+
+/* Clear the interval histogram. */
+/* ----------------------------- */
+void ResetHistogram(IntervalHistogram& Histogram)
+   {
+   memset(Histogram.Counts, 0, sizeof(Histogram.Counts));
+   Histogram.Count = 0;
+   Histogram.MaxInterval = 0;
+   Histogram.Sum = 0;
+   Histogram.SumOfSquares = 0;
+   }
+
+/* Add an interval to the histogram. Allocation-free; safe to call from the hook. */
+/* ------------------------------------------------------------------------------ */
+void AddToHistogram(IntervalHistogram& Histogram, MIL_DOUBLE IntervalInSec)
+   {
+   const MIL_UINT64 SubBuckets = (MIL_UINT64)1 << INTERVAL_HISTOGRAM_SUB_BITS;
+   MIL_UINT64 Value = IntervalInSec > 0 ? (MIL_UINT64)(IntervalInSec * 1e6) : 0;
+   MIL_UINT64 Index = Value;
+
+   if(Value >= SubBuckets)
+      {
+      /* Locate the most significant bit and keep the next INTERVAL_HISTOGRAM_SUB_BITS bits. */
+      int Exponent = 0;
+      while((Value >> (Exponent + 1)) != 0)
+         Exponent++;
+      MIL_UINT64 Mantissa = Value >> (Exponent - INTERVAL_HISTOGRAM_SUB_BITS);
+      Index = SubBuckets + (Exponent - INTERVAL_HISTOGRAM_SUB_BITS) * SubBuckets + (Mantissa - SubBuckets);
+      }
+   if(Index >= INTERVAL_HISTOGRAM_SIZE)
+      Index = INTERVAL_HISTOGRAM_SIZE - 1;
+
+   Histogram.Counts[Index]++;
+   Histogram.Count++;
+   Histogram.Sum += IntervalInSec;
+   Histogram.SumOfSquares += IntervalInSec * IntervalInSec;
+   if(IntervalInSec > Histogram.MaxInterval)
+      Histogram.MaxInterval = IntervalInSec;
+   }
+
+/* Return the interval, in seconds, below which the given fraction of intervals lie. */
+/* --------------------------------------------------------------------------------- */
+MIL_DOUBLE GetHistogramPercentile(const IntervalHistogram& Histogram, MIL_DOUBLE Percentile)
+   {
+   const MIL_UINT64 SubBuckets = (MIL_UINT64)1 << INTERVAL_HISTOGRAM_SUB_BITS;
+   MIL_UINT64 Target = (MIL_UINT64)(Percentile * Histogram.Count + 0.5);
+   MIL_UINT64 Accumulated = 0;
+
+   if(Histogram.Count == 0)
+      return 0;
+   if(Target < 1)
+      Target = 1;
+
+   for(MIL_UINT64 Index = 0; Index < INTERVAL_HISTOGRAM_SIZE; Index++)
+      {
+      Accumulated += Histogram.Counts[Index];
+      if(Accumulated >= Target)
+         {
+         /* Return the middle of the bucket, bounded by the maximum interval seen. */
+         MIL_DOUBLE Lower = (MIL_DOUBLE)Index, Width = 1.0;
+         if(Index >= SubBuckets)
+            {
+            MIL_UINT64 Shift = (Index - SubBuckets) / SubBuckets;
+            MIL_UINT64 Mantissa = (Index - SubBuckets) % SubBuckets + SubBuckets;
+            Lower = (MIL_DOUBLE)(Mantissa << Shift);
+            Width = (MIL_DOUBLE)((MIL_UINT64)1 << Shift);
+            }
+         MIL_DOUBLE Interval = (Lower + Width / 2.0) * 1e-6;
+         return Interval < Histogram.MaxInterval ? Interval : Histogram.MaxInterval;
+         }
+      }
+   return Histogram.MaxInterval;
+   }
+
+/* Summarize the frame rate, losses and interval histogram of an acquisition. */
+/* -------------------------------------------------------------------------- */
+void SummarizeSequence(const HookDataStruct& HookData, MIL_INT DelayTickVal, MIL_DOUBLE FrameRate,
+                       SequenceSummary& Summary)
+   {
+   const IntervalHistogram& Histogram = HookData.Intervals;
+
+   Summary.DelayTickVal = DelayTickVal;
+   Summary.FrameRate = FrameRate;
+   Summary.FramesMissed = HookData.FramesMissed;
+   Summary.FramesCorrupted = HookData.FramesCorrupted;
+   Summary.FramesIncomplete = HookData.FramesIncomplete;
+   Summary.PacketsMissing = HookData.PacketsMissing;
+   Summary.PayloadFramesCorrupted = HookData.PayloadFramesCorrupted;
+   Summary.PayloadBytesCorrupted = HookData.PayloadBytesCorrupted;
+   Summary.Mean = 0;
+   Summary.StdDev = 0;
+   if(Histogram.Count > 0)
+      {
+      MIL_DOUBLE Variance = 0;
+      Summary.Mean = Histogram.Sum / Histogram.Count;
+      Variance = Histogram.SumOfSquares / Histogram.Count - Summary.Mean * Summary.Mean;
+      Summary.StdDev = Variance > 0 ? sqrt(Variance) : 0;
+      }
+   Summary.P50 = GetHistogramPercentile(Histogram, 0.50);
+   Summary.P99 = GetHistogramPercentile(Histogram, 0.99);
+   Summary.P999 = GetHistogramPercentile(Histogram, 0.999);
+   Summary.Max = Histogram.MaxInterval;
+
+   if(!HookData.HostTimes.empty())
+      SummarizeLatencies(HookData, Summary);
+   }
+
+/* Sample the frame rate, loss and jitter against the inter-packet delay, from zero  */
+/* to the delay at which the frame rate collapses. Coarse geometric samples are      */
+/* taken first; the intervals where the curve changes most are then bisected.        */
+/* --------------------------------------------------------------------------------- */
+void SweepInterPacketDelay(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results,
+                           HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+   vector<SequenceSummary>& Curve = Results.DelayCurves[Results.Selection];
+   MIL_DOUBLE TheoreticalDelay = 0;
+   MIL_INT DelayTickVal = 0;
+
+   MosPrintf(MIL_TEXT("\nSweeping the inter-packet delay curve"));
+
+   /* The reference acquisition is the zero-delay point. */
+   Curve.clear();
+   Curve.push_back(Info.ReferenceIntervals);
+
+   /* Coarse pass: double the delay, starting from a fraction of the theoretical delay,
+      until the frame rate collapses. */
+   TheoreticalDelay = GetTheoreticalDelay(MilDigitizer, HookData);
+   DelayTickVal = (MIL_INT)(TheoreticalDelay * Info.TickFreq / 8.0);
+   if(DelayTickVal < 1)
+      DelayTickVal = 1;
+   while((MIL_INT)Curve.size() < Settings.DelaySweepMaxPoints / 2 && !HookData.Cancelled)
+      {
+      MeasureDelayCurvePoint(MilDigitizer, HookData, DelayTickVal, Curve, Results.ResumeCurve);
+      SetFormatState(Results, Info, FORMAT_STATE_SWEEP);
+      if(Curve.back().FrameRate < Info.BaseFrameRate * Settings.DelaySweepCollapseRatio)
+         break;
+      DelayTickVal *= 2;
+      }
+
+   /* Refinement pass: bisect the interval with the largest change of frame rate and
+      loss, which concentrates the samples around the knees. */
+   while((MIL_INT)Curve.size() < Settings.DelaySweepMaxPoints && !HookData.Cancelled)
+      {
+      MIL_DOUBLE LargestChange = 0;
+      size_t Largest = 0;
+      for(size_t i = 1; i < Curve.size(); i++)
+         {
+         MIL_DOUBLE Change = fabs(Curve[i].FrameRate - Curve[i-1].FrameRate) / Info.BaseFrameRate;
+         if((GetLostFrameCount(Curve[i]) > 0) != (GetLostFrameCount(Curve[i-1]) > 0))
+            Change += 1.0;
+         if(Curve[i].DelayTickVal - Curve[i-1].DelayTickVal > 1 && Change > LargestChange)
+            {
+            LargestChange = Change;
+            Largest = i;
+            }
+         }
+
+      /* Stop when the curve is flat at the sampled resolution. */
+      if(Largest == 0 || LargestChange < 0.01)
+         break;
+
+      MeasureDelayCurvePoint(MilDigitizer, HookData,
+         (Curve[Largest-1].DelayTickVal + Curve[Largest].DelayTickVal) / 2, Curve, Results.ResumeCurve);
+      SetFormatState(Results, Info, FORMAT_STATE_SWEEP);
+      }
+
+   MosPrintf(MIL_TEXT("\n"));
+   ExportDelayCurve(MilDigitizer, Info, Results, Settings);
+
+   /* Restore the calculated inter-packet delay. */
+   SetInterPacketDelay(MilDigitizer, HookData, Info.DelayTickVal);
+   }
+
+/* Measure one point of the delay curve and insert it in delay order. A point of    */
+/* the same delay measured before an interruption of the run is reused.              */
+/* --------------------------------------------------------------------------------- */
+void MeasureDelayCurvePoint(MIL_ID MilDigitizer, HookDataStruct& HookData,
+                            MIL_INT DelayTickVal, vector<SequenceSummary>& Curve,
+                            vector<SequenceSummary>& ResumeCurve)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+   SequenceSummary Point;
+   MIL_DOUBLE FrameRate = 0;
+   size_t Position = 0;
+
+   while(Position < ResumeCurve.size() && ResumeCurve[Position].DelayTickVal != DelayTickVal)
+      Position++;
+   if(Position < ResumeCurve.size())
+      {
+      Point = ResumeCurve[Position];
+      FrameRate = Point.FrameRate;
+      ResumeCurve.erase(ResumeCurve.begin() + Position);
+      }
+   else
+      {
+      SetInterPacketDelay(MilDigitizer, HookData, DelayTickVal);
+      FrameRate = AcquireSequence(MilDigitizer, HookData);
+      if(HookData.Cancelled)
+         return;
+      SummarizeSequence(HookData, DelayTickVal, FrameRate, Point);
+      }
+
+   Position = 0;
+
+   while(Position < Curve.size() && Curve[Position].DelayTickVal < DelayTickVal)
+      Position++;
+   Curve.insert(Curve.begin() + Position, Point);
+
+   if(Settings.PrintDetails)
+      MosPrintf(MIL_TEXT("\nDelay of %d ticks: %.2f fps, %d missed, %d corrupted, jitter %.3f msec"),
+         (int)DelayTickVal, FrameRate, (int)Point.FramesMissed, (int)Point.FramesCorrupted,
+         Point.StdDev * 1e3);
+   else
+      MosPrintf(MIL_TEXT("."));
+   }
+
+/* Write the delay curve of the current pixel format in a columnar text file: one    */
+/* line per column, preceded by comment lines describing the camera parameters.      */
+/* --------------------------------------------------------------------------------- */
+void ExportDelayCurve(MIL_ID MilDigitizer, PacketDelayInfo& Info, PacketDelayResults& Results, const PacketDelaySettings& Settings)
+   {
+   const vector<SequenceSummary>& Curve = Results.DelayCurves[Results.Selection];
+   MIL_STRING Model, Vendor;
+   MIL_INT PacketSize = 0;
+   string FileName = Settings.DelayCurveFilePrefix +
+      ToNarrowString(Results.PixelFormats[Results.Selection]) + ".txt";
+
+   FILE* File = fopen(FileName.c_str(), "w");
+   if(!File)
+      {
+      MosPrintf(MIL_TEXT("Unable to write the delay curve file %s.\n"), ToMilString(FileName.c_str()).c_str());
+      return;
+      }
+
+   MdigInquire(MilDigitizer, M_CAMERA_VENDOR, Vendor);
+   MdigInquire(MilDigitizer, M_CAMERA_MODEL, Model);
+   MdigInquire(MilDigitizer, M_GC_PACKET_SIZE, &PacketSize);
+
+   fprintf(File, "# Camera: %s %s\n", ToNarrowString(Vendor).c_str(), ToNarrowString(Model).c_str());
+   fprintf(File, "# PixelFormat: %s\n", ToNarrowString(Results.PixelFormats[Results.Selection]).c_str());
+   fprintf(File, "# SizeX: %lld\n", (long long)MdigInquire(MilDigitizer, M_SIZE_X, M_NULL));
+   fprintf(File, "# SizeY: %lld\n", (long long)MdigInquire(MilDigitizer, M_SIZE_Y, M_NULL));
+   fprintf(File, "# PacketSize: %d\n", (int)PacketSize);
+   fprintf(File, "# TickFrequency: %llu\n", (unsigned long long)Info.TickFreq);
+   fprintf(File, "# ReferenceFrameRate: %.3f\n", Info.BaseFrameRate);
+   fprintf(File, "# CalculatedDelayTicks: %d\n", (int)Results.InterPacketDelayInTicks[Results.Selection]);
+
+   fprintf(File, "delay_ticks");
+   for(size_t i = 0; i < Curve.size(); i++)
+      fprintf(File, " %d", (int)Curve[i].DelayTickVal);
+   fprintf(File, "\ndelay_usec");
+   for(size_t i = 0; i < Curve.size(); i++)
+      fprintf(File, " %.3f", Info.TickFreq ? Curve[i].DelayTickVal * 1e6 / Info.TickFreq : 0.0);
+   fprintf(File, "\nframe_rate");
+   for(size_t i = 0; i < Curve.size(); i++)
+      fprintf(File, " %.3f", Curve[i].FrameRate);
+   fprintf(File, "\nframes_missed");
+   for(size_t i = 0; i < Curve.size(); i++)
+      fprintf(File, " %d", (int)Curve[i].FramesMissed);
+   fprintf(File, "\nframes_corrupted");
+   for(size_t i = 0; i < Curve.size(); i++)
+      fprintf(File, " %d", (int)Curve[i].FramesCorrupted);
+   fprintf(File, "\nframes_incomplete");
+   for(size_t i = 0; i < Curve.size(); i++)
+      fprintf(File, " %d", (int)Curve[i].FramesIncomplete);
+   fprintf(File, "\npackets_missing");
+   for(size_t i = 0; i < Curve.size(); i++)
+      fprintf(File, " %d", (int)Curve[i].PacketsMissing);
+   fprintf(File, "\npayload_frames_corrupted");
+   for(size_t i = 0; i < Curve.size(); i++)
+      fprintf(File, " %d", (int)Curve[i].PayloadFramesCorrupted);
+   fprintf(File, "\npayload_bytes_corrupted");
+   for(size_t i = 0; i < Curve.size(); i++)
+      fprintf(File, " %lld", (long long)Curve[i].PayloadBytesCorrupted);
+   fprintf(File, "\njitter_usec");
+   for(size_t i = 0; i < Curve.size(); i++)
+      fprintf(File, " %.1f", Curve[i].StdDev * 1e6);
+   fprintf(File, "\ninterval_p99_usec");
+   for(size_t i = 0; i < Curve.size(); i++)
+      fprintf(File, " %.1f", Curve[i].P99 * 1e6);
+   fprintf(File, "\ninterval_max_usec");
+   for(size_t i = 0; i < Curve.size(); i++)
+      fprintf(File, " %.1f", Curve[i].Max * 1e6);
+   fprintf(File, "\n");
+   fclose(File);
+
+   MosPrintf(MIL_TEXT("Delay curve (%d points) written to %s.\n"), (int)Curve.size(),
+      ToMilString(FileName.c_str()).c_str());
+   }
+
+/* Convert a MIL string to a narrow string. Only meant for ASCII content such as */
+/* GenICam feature values and camera names.                                       */
+/* ------------------------------------------------------------------------------ */
+string ToNarrowString(const MIL_STRING& Str)
+   {
+   string Narrow;
+   for(size_t i = 0; i < Str.size(); i++)
+      Narrow += (Str[i] > 0 && (unsigned)Str[i] < 128) ? (char)Str[i] : '?';
+   return Narrow;
+   }
+
+/* Return the number of frames lost or damaged during a sequence. */
+/* -------------------------------------------------------------- */
+MIL_INT GetLostFrameCount(const SequenceSummary& Summary)
+   {
+   /* Incomplete frames found by the scan are usually also reported as corrupted, and
+      missed frames are also not delivered. */
+   return max(Summary.FramesMissed, Summary.FramesNotDelivered) +
+      max(max(Summary.FramesCorrupted, Summary.FramesIncomplete), Summary.PayloadFramesCorrupted);
+   }
+
+/* Compute the packet layout of the grab buffers and allocate the missing packet    */
+/* maps and expected frame, so that the hook does not allocate.                     */
+/* -------------------------------------------------------------------------------- */
+void PrepareFrameChecks(MIL_ID MilDigitizer, MIL_ID MilGrabBuffer, HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+   MIL_INT PacketSize = 0, SizeX = 0, SizeY = 0, SizeBand = 0, SizeBit = 0;
+
+   HookData.IsSentinel = M_NULL;
+   HookData.PayloadCompare = M_NULL;
+   HookData.ExpectedFrameValid = false;
+   MdigInquire(MilDigitizer, M_GC_PACKET_SIZE, &PacketSize);
+   MbufInquire(MilGrabBuffer, M_SIZE_X, &SizeX);
+   MbufInquire(MilGrabBuffer, M_SIZE_Y, &SizeY);
+   MbufInquire(MilGrabBuffer, M_SIZE_BAND, &SizeBand);
+   MbufInquire(MilGrabBuffer, M_SIZE_BIT, &SizeBit);
+   MbufInquire(MilGrabBuffer, M_PITCH_BYTE, &HookData.PitchByte);
+
+   HookData.PacketPayloadSize = PacketSize - GetGvspPacketOverhead(MilDigitizer);
+   HookData.RowSizeByte = (SizeX * SizeBand * SizeBit + 7) / 8;
+   HookData.FrameSizeByte = HookData.RowSizeByte * SizeY;
+   if(HookData.PacketPayloadSize <= 0 || HookData.RowSizeByte <= 0 || HookData.PitchByte < HookData.RowSizeByte)
+      return;
+
+   /* Without line padding, the whole frame is processed as a single row. */
+   if(HookData.PitchByte == HookData.RowSizeByte)
+      {
+      HookData.RowSizeByte = HookData.FrameSizeByte;
+      HookData.PitchByte = HookData.FrameSizeByte;
+      }
+
+   HookData.PacketsPerFrame = (HookData.FrameSizeByte + HookData.PacketPayloadSize - 1) / HookData.PacketPayloadSize;
+   HookData.PacketWireTime = GetPacketWireTime(PacketSize, HookData.LinkSpeedMbps);
+   if(Settings.MissingPacketScan)
+      {
+      HookData.MissingPacketMap.assign(HookData.PacketsPerFrame, 0);
+      HookData.LastIncompleteMap.assign(HookData.PacketsPerFrame, 0);
+      HookData.IsSentinel = GetSentinelScanFunction();
+      }
+
+   if(HookData.VerifyPayloads)
+      {
+      HookData.ExpectedFrame.assign(HookData.FrameSizeByte, 0);
+      HookData.PayloadCompare = GetPayloadCompareFunction();
+
+      /* The simulated pattern is known in advance; the camera pattern is taken from the
+         first frame of the reference acquisition. */
+      if(Settings.PayloadVerification == PAYLOAD_VERIFICATION_SIMULATED)
+         {
+         if(GenerateRampPattern(MilGrabBuffer, GetPixelFormatBitDepth(MilDigitizer, SizeBit), HookData))
+            HookData.ExpectedFrameValid = true;
+         else
+            HookData.PayloadCompare = M_NULL;
+         }
+      }
+   }
+
+/* Fill the missing packet map of a grabbed buffer and return the number of missing */
+/* packets. The received packets are filled with the sentinel again for the next    */
+/* grab; missing packets and the line padding still hold it.                        */
+/* -------------------------------------------------------------------------------- */
+MIL_INT ScanMissingPackets(HookDataStruct& HookData, MIL_ID MilGrabBuffer)
+   {
+   MIL_UINT8* Data = M_NULL;
+   MIL_INT Missing = 0;
+
+   MbufInquire(MilGrabBuffer, M_HOST_ADDRESS, &Data);
+   if(!Data)
+      return 0;
+
+   for(MIL_INT Packet = 0; Packet < HookData.PacketsPerFrame; Packet++)
+      {
+      MIL_INT Start = Packet * HookData.PacketPayloadSize;
+      MIL_INT End = min(Start + HookData.PacketPayloadSize, HookData.FrameSizeByte);
+      bool IsMissing = true;
+
+      /* A packet spanning several rows is checked one row segment at a time. */
+      for(MIL_INT Offset = Start; IsMissing && Offset < End; )
+         {
+         MIL_INT Row = Offset / HookData.RowSizeByte;
+         MIL_INT Column = Offset % HookData.RowSizeByte;
+         MIL_INT Size = min(End - Offset, HookData.RowSizeByte - Column);
+         IsMissing = HookData.IsSentinel(Data + Row * HookData.PitchByte + Column, (size_t)Size);
+         Offset += Size;
+         }
+
+      HookData.MissingPacketMap[Packet] = IsMissing ? 1 : 0;
+      if(IsMissing)
+         {
+         Missing++;
+         continue;
+         }
+
+      for(MIL_INT Offset = Start; Offset < End; )
+         {
+         MIL_INT Row = Offset / HookData.RowSizeByte;
+         MIL_INT Column = Offset % HookData.RowSizeByte;
+         MIL_INT Size = min(End - Offset, HookData.RowSizeByte - Column);
+         memset(Data + Row * HookData.PitchByte + Column, 0xFF, (size_t)Size);
+         Offset += Size;
+         }
+      }
+
+   return Missing;
+   }
+
+/* Return the size of the IP, UDP and GVSP headers of the camera's stream packets. */
+/* ------------------------------------------------------------------------------- */
+MIL_INT GetGvspPacketOverhead(MIL_ID MilDigitizer)
+   {
+   MIL_STRING ExtendedIdMode;
+
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("GevGVSPExtendedIDMode"), M_TYPE_STRING, ExtendedIdMode);
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+
+   return GVSP_IP_UDP_HEADER_SIZE +
+      (ExtendedIdMode == MIL_TEXT("On") ? GVSP_EXTENDED_HEADER_SIZE : GVSP_HEADER_SIZE);
+   }
+
+/* Print the ranges of missing packets of a map, e.g. "12-15 80". */
+/* -------------------------------------------------------------- */
+void PrintMissingPacketMap(const vector<MIL_UINT8>& Map)
+   {
+   size_t Packet = 0;
+   while(Packet < Map.size())
+      {
+      if(Map[Packet])
+         {
+         size_t First = Packet;
+         while(Packet + 1 < Map.size() && Map[Packet + 1])
+            Packet++;
+         if(First == Packet)
+            MosPrintf(MIL_TEXT("%d "), (int)First);
+         else
+            MosPrintf(MIL_TEXT("%d-%d "), (int)First, (int)Packet);
+         }
+      Packet++;
+      }
+   MosPrintf(MIL_TEXT("\n"));
+   }
+
+/* Return the most capable instruction set supported by the CPU for the frame checks. */
+/* ---------------------------------------------------------------------------------- */
+int GetSimdLevel()
+   {
+   int SimdLevel = SIMD_LEVEL_SCALAR;
+
+#if SENTINEL_SCAN_X86
+   bool HasSse2 = false, HasAvx2 = false;
+#if defined(_MSC_VER)
+   int CpuInfo[4];
+   __cpuid(CpuInfo, 1);
+   HasSse2 = (CpuInfo[3] & (1 << 26)) != 0;
+   /* AVX2 also requires the operating system to save the YMM registers. */
+   bool OsSavesYmm = (CpuInfo[2] & (1 << 27)) && (CpuInfo[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+   __cpuidex(CpuInfo, 7, 0);
+   HasAvx2 = OsSavesYmm && (CpuInfo[1] & (1 << 5)) != 0;
+#else
+   __builtin_cpu_init();
+   HasSse2 = __builtin_cpu_supports("sse2") != 0;
+   HasAvx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+   if(HasAvx2)
+      SimdLevel = SIMD_LEVEL_AVX2;
+   else if(HasSse2)
+      SimdLevel = SIMD_LEVEL_SSE2;
+#endif
+
+   return SimdLevel;
+   }
+
+/* Return the name of an instruction set. */
+/* -------------------------------------- */
+const MIL_TEXT_CHAR* GetSimdLevelName(int SimdLevel)
+   {
+   switch(SimdLevel)
+      {
+      case SIMD_LEVEL_AVX2: return MIL_TEXT("AVX2");
+      case SIMD_LEVEL_SSE2: return MIL_TEXT("SSE2");
+      default:              return MIL_TEXT("scalar");
+      }
+   }
+
+/* Select the fastest sentinel scan supported by the CPU. */
+/* ------------------------------------------------------ */
+SentinelScanFunction GetSentinelScanFunction()
+   {
+#if SENTINEL_SCAN_X86
+   switch(GetSimdLevel())
+      {
+      case SIMD_LEVEL_AVX2: return IsSentinelAvx2;
+      case SIMD_LEVEL_SSE2: return IsSentinelSse2;
+      }
+#endif
+   return IsSentinelScalar;
+   }
+
+/* Select the fastest payload comparison supported by the CPU. */
+/* ----------------------------------------------------------- */
+PayloadCompareFunction GetPayloadCompareFunction()
+   {
+#if SENTINEL_SCAN_X86
+   switch(GetSimdLevel())
+      {
+      case SIMD_LEVEL_AVX2: return ComparePayloadAvx2;
+      case SIMD_LEVEL_SSE2: return ComparePayloadSse2;
+      }
+#endif
+   return ComparePayloadScalar;
+   }
+
+/* Sentinel scan, scalar version. */
+/* ------------------------------ */
+bool IsSentinelScalar(const MIL_UINT8* Data, size_t Size)
+   {
+   size_t i = 0;
+   for(; i + sizeof(MIL_UINT64) <= Size; i += sizeof(MIL_UINT64))
+      {
+      MIL_UINT64 Word;
+      memcpy(&Word, Data + i, sizeof(Word));
+      if(Word != ~(MIL_UINT64)0)
+         return false;
+      }
+   for(; i < Size; i++)
+      {
+      if(Data[i] != 0xFF)
+         return false;
+      }
+   return true;
+   }
+
+/* Payload comparison, scalar version. */
+/* ----------------------------------- */
+MIL_INT ComparePayloadScalar(const MIL_UINT8* Data, const MIL_UINT8* Expected, size_t Size)
+   {
+   MIL_INT Differences = 0;
+   size_t i = 0;
+   for(; i + sizeof(MIL_UINT64) <= Size; i += sizeof(MIL_UINT64))
+      {
+      MIL_UINT64 Word, ExpectedWord;
+      memcpy(&Word, Data + i, sizeof(Word));
+      memcpy(&ExpectedWord, Expected + i, sizeof(ExpectedWord));
+      if(Word != ExpectedWord)
+         {
+         for(size_t j = i; j < i + sizeof(MIL_UINT64); j++)
+            Differences += (Data[j] != Expected[j]) ? 1 : 0;
+         }
+      }
+   for(; i < Size; i++)
+      Differences += (Data[i] != Expected[i]) ? 1 : 0;
+   return Differences;
+   }
+
+/* Return the number of bits set in a 32-bit value. */
+/* ------------------------------------------------ */
+int CountBits(MIL_UINT32 Value)
+   {
+   Value = Value - ((Value >> 1) & 0x55555555);
+   Value = (Value & 0x33333333) + ((Value >> 2) & 0x33333333);
+   return (int)((((Value + (Value >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+   }
+
+#if SENTINEL_SCAN_X86
+/* Sentinel scan, SSE2 version. Image data normally fails on the first block, so     */
+/* only missing packets are read completely.                                         */
+/* --------------------------------------------------------------------------------- */
+SIMD_TARGET_SSE2 bool IsSentinelSse2(const MIL_UINT8* Data, size_t Size)
+   {
+   const __m128i Sentinel = _mm_set1_epi8((char)0xFF);
+   size_t i = 0;
+
+   for(; i + 64 <= Size; i += 64)
+      {
+      __m128i Block = _mm_and_si128(
+         _mm_and_si128(_mm_loadu_si128((const __m128i*)(Data + i)),
+                       _mm_loadu_si128((const __m128i*)(Data + i + 16))),
+         _mm_and_si128(_mm_loadu_si128((const __m128i*)(Data + i + 32)),
+                       _mm_loadu_si128((const __m128i*)(Data + i + 48))));
+      if(_mm_movemask_epi8(_mm_cmpeq_epi8(Block, Sentinel)) != 0xFFFF)
+         return false;
+      }
+   for(; i + 16 <= Size; i += 16)
+      {
+      if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(Data + i)), Sentinel)) != 0xFFFF)
+         return false;
+      }
+   return IsSentinelScalar(Data + i, Size - i);
+   }
+
+/* Sentinel scan, AVX2 version. */
+/* ---------------------------- */
+SIMD_TARGET_AVX2 bool IsSentinelAvx2(const MIL_UINT8* Data, size_t Size)
+   {
+   const __m256i Sentinel = _mm256_set1_epi8((char)0xFF);
+   size_t i = 0;
+
+   for(; i + 128 <= Size; i += 128)
+      {
+      __m256i Block = _mm256_and_si256(
+         _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(Data + i)),
+                          _mm256_loadu_si256((const __m256i*)(Data + i + 32))),
+         _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(Data + i + 64)),
+                          _mm256_loadu_si256((const __m256i*)(Data + i + 96))));
+      if(_mm256_movemask_epi8(_mm256_cmpeq_epi8(Block, Sentinel)) != -1)
+         return false;
+      }
+   for(; i + 32 <= Size; i += 32)
+      {
+      if(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(Data + i)), Sentinel)) != -1)
+         return false;
+      }
+   return IsSentinelScalar(Data + i, Size - i);
+   }
+
+/* Payload comparison, SSE2 version. Equal blocks, the common case, cost one compare */
+/* and one movemask per 16 bytes.                                                    */
+/* --------------------------------------------------------------------------------- */
+SIMD_TARGET_SSE2 MIL_INT ComparePayloadSse2(const MIL_UINT8* Data, const MIL_UINT8* Expected, size_t Size)
+   {
+   MIL_INT Differences = 0;
+   size_t i = 0;
+
+   for(; i + 16 <= Size; i += 16)
+      {
+      int EqualMask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(Data + i)),
+                                                       _mm_loadu_si128((const __m128i*)(Expected + i))));
+      if(EqualMask != 0xFFFF)
+         Differences += 16 - CountBits((MIL_UINT32)EqualMask);
+      }
+   return Differences + ComparePayloadScalar(Data + i, Expected + i, Size - i);
+   }
+
+/* Payload comparison, AVX2 version. */
+/* --------------------------------- */
+SIMD_TARGET_AVX2 MIL_INT ComparePayloadAvx2(const MIL_UINT8* Data, const MIL_UINT8* Expected, size_t Size)
+   {
+   MIL_INT Differences = 0;
+   size_t i = 0;
+
+   for(; i + 32 <= Size; i += 32)
+      {
+      int EqualMask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(Data + i)),
+                                                             _mm256_loadu_si256((const __m256i*)(Expected + i))));
+      if(EqualMask != -1)
+         Differences += 32 - CountBits((MIL_UINT32)EqualMask);
+      }
+   return Differences + ComparePayloadScalar(Data + i, Expected + i, Size - i);
+   }
+#endif
+
+/* Enable a static test pattern in the camera. The current pattern is saved so it    */
+/* can be restored at the end of the example.                                        */
+/* --------------------------------------------------------------------------------- */
+bool EnableTestPattern(MIL_ID MilDigitizer, PacketDelayResults& Results, const PacketDelaySettings& Settings)
+   {
+   /* Patterns that do not change from frame to frame, in order of preference. */
+   static const MIL_TEXT_CHAR* const Patterns[] = { MIL_TEXT("GreyHorizontalRamp"),
+                                                    MIL_TEXT("GreyVerticalRamp"),
+                                                    MIL_TEXT("GreyDiagonalRamp") };
+   const size_t NbPatterns = (Settings.PayloadVerification == PAYLOAD_VERIFICATION_SIMULATED) ? 1 :
+      sizeof(Patterns) / sizeof(Patterns[0]);
+   bool Enabled = false;
+
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   if(Results.OriginalTestPattern.empty())
+      MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TestPattern"), M_TYPE_STRING, Results.OriginalTestPattern);
+
+   for(size_t i = 0; i < NbPatterns && !Enabled; i++)
+      {
+      MIL_STRING Pattern;
+      MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TestPattern"), M_TYPE_STRING, MIL_STRING(Patterns[i]));
+      MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TestPattern"), M_TYPE_STRING, Pattern);
+      if(Pattern == Patterns[i])
+         {
+         Enabled = true;
+         Results.PayloadVerificationName = MIL_STRING(MIL_TEXT("test pattern ")) + Patterns[i] +
+            MIL_TEXT(" (") + GetSimdLevelName(GetSimdLevel()) + MIL_TEXT(")");
+         }
+      }
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+
+   if(!Enabled)
+      {
+      MosPrintf(MIL_TEXT("The camera does not provide a static test pattern; payload verification disabled.\n"));
+      Results.PayloadVerificationName = MIL_TEXT("disabled (no static test pattern)");
+      }
+   return Enabled;
+   }
+
+/* Restore the camera's original test pattern. */
+/* ------------------------------------------- */
+void RestoreTestPattern(MIL_ID MilDigitizer, PacketDelayResults& Results)
+   {
+   if(Results.OriginalTestPattern.empty())
+      return;
+
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("TestPattern"), M_TYPE_STRING, Results.OriginalTestPattern);
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+   }
+
+/* Generate the expected GreyHorizontalRamp frame: each pixel component holds its   */
+/* column modulo the range of the pixel format's bit depth. Only 8 and 16-bit        */
+/* containers are supported.                                                         */
+/* --------------------------------------------------------------------------------- */
+bool GenerateRampPattern(MIL_ID MilGrabBuffer, MIL_INT BitDepth, HookDataStruct& HookData)
+   {
+   const MIL_INT Mask = ((MIL_INT)1 << BitDepth) - 1;
+   MIL_INT SizeX = 0, SizeY = 0, SizeBand = 0, SizeBit = 0;
+
+   MbufInquire(MilGrabBuffer, M_SIZE_X, &SizeX);
+   MbufInquire(MilGrabBuffer, M_SIZE_Y, &SizeY);
+   MbufInquire(MilGrabBuffer, M_SIZE_BAND, &SizeBand);
+   MbufInquire(MilGrabBuffer, M_SIZE_BIT, &SizeBit);
+   if((SizeBit != 8 && SizeBit != 16) || (MIL_INT)HookData.ExpectedFrame.size() != SizeX * SizeY * SizeBand * SizeBit / 8)
+      {
+      MosPrintf(MIL_TEXT("No simulated pattern for this pixel format; payload verification disabled.\n"));
+      return false;
+      }
+
+   MIL_UINT8* Pattern = &HookData.ExpectedFrame[0];
+   for(MIL_INT y = 0; y < SizeY; y++)
+      {
+      for(MIL_INT x = 0; x < SizeX; x++)
+         {
+         for(MIL_INT b = 0; b < SizeBand; b++)
+            {
+            if(SizeBit == 8)
+               *Pattern++ = (MIL_UINT8)(x & Mask);
+            else
+               {
+               /* Little-endian 16-bit container, e.g. Mono12 ramps wrap at 4096. */
+               *Pattern++ = (MIL_UINT8)((x & Mask) & 0xFF);
+               *Pattern++ = (MIL_UINT8)(((x & Mask) >> 8) & 0xFF);
+               }
+            }
+         }
+      }
+   return true;
+   }
+
+/* Return the number of significant bits per component of the camera's pixel format, */
+/* e.g. 12 for Mono12 in a 16-bit container, taken from the format's name. The       */
+/* buffer's bit depth is returned if the name does not tell.                          */
+/* ---------------------------------------------------------------------------------- */
+MIL_INT GetPixelFormatBitDepth(MIL_ID MilDigitizer, MIL_INT SizeBit)
+   {
+   MIL_STRING PixelFormat;
+   MIL_INT BitDepth = SizeBit;
+
+   MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("PixelFormat"), M_TYPE_STRING, PixelFormat);
+
+   /* Keep the last number of the name within the container, e.g. 8 in YUV422_8. */
+   for(size_t i = 0; i < PixelFormat.size(); )
+      {
+      MIL_INT Number = 0;
+      size_t Start = i;
+      while(i < PixelFormat.size() && PixelFormat[i] >= '0' && PixelFormat[i] <= '9')
+         Number = Number * 10 + (PixelFormat[i++] - '0');
+      if(i == Start)
+         i++;
+      else if(Number >= 8 && Number <= SizeBit)
+         BitDepth = Number;
+      }
+   return BitDepth;
+   }
+
+/* Compare a grabbed buffer with the expected frame. The first frame checked becomes */
+/* the expected frame when the pattern is not known in advance.                      */
+/* --------------------------------------------------------------------------------- */
+void VerifyPayload(HookDataStruct& HookData, MIL_ID MilGrabBuffer)
+   {
+   MIL_UINT8* Data = M_NULL;
+   MIL_INT64 Differences = 0;
+
+   MbufInquire(MilGrabBuffer, M_HOST_ADDRESS, &Data);
+   if(!Data || HookData.ExpectedFrame.empty())
+      return;
+
+   for(MIL_INT Offset = 0, Row = 0; Offset < HookData.FrameSizeByte; Offset += HookData.RowSizeByte, Row++)
+      {
+      MIL_UINT8* RowData = Data + Row * HookData.PitchByte;
+      if(HookData.ExpectedFrameValid)
+         Differences += HookData.PayloadCompare(RowData, &HookData.ExpectedFrame[Offset], (size_t)HookData.RowSizeByte);
+      else
+         memcpy(&HookData.ExpectedFrame[Offset], RowData, (size_t)HookData.RowSizeByte);
+      }
+
+   if(!HookData.ExpectedFrameValid)
+      {
+      HookData.ExpectedFrameValid = true;
+      return;
+      }
+
+   HookData.PayloadFramesChecked++;
+   if(Differences > 0)
+      {
+      HookData.PayloadFramesCorrupted++;
+      HookData.PayloadBytesCorrupted += Differences;
+      }
+   }
+
+#if !M_MIL_USE_WINDOWS
+/* Set by SIGINT and SIGTERM to stop the calibration service. */
+static volatile sig_atomic_t CalibrationServiceStopRequested = 0;
+
+static void RequestCalibrationServiceStop(int)
+   {
+   CalibrationServiceStopRequested = 1;
+   }
+
+/* Create a directory accessible only to the current user and, if Group is not -1,  */
+/* readable by the members of the group. An existing directory is only reused if it */
+/* is a real directory owned by the current user.                                   */
+/* -------------------------------------------------------------------------------- */
+static bool CreatePrivateDirectory(const char* Path, gid_t Group)
+   {
+   struct stat Status;
+   mode_t Mode = (Group != (gid_t)-1) ? 0750 : 0700;
+
+   if(mkdir(Path, Mode) != 0 && errno != EEXIST)
+      return false;
+   if(lstat(Path, &Status) != 0 || !S_ISDIR(Status.st_mode) || Status.st_uid != geteuid())
+      return false;
+   if(Group != (gid_t)-1 && chown(Path, (uid_t)-1, Group) != 0)
+      return false;
+   return chmod(Path, Mode) == 0;
+   }
+#endif
+
+/* Answer the delay queries received on the service's Unix domain socket until the  */
+/* process is interrupted. Calibrations run one at a time on a separate thread, so   */
+/* cached answers are never delayed by an acquisition.                               */
+/* --------------------------------------------------------------------------------- */
+void RunCalibrationService(MIL_ID MilSystem, MIL_ID MilDigitizer, MIL_INT BoardType,
+                           PacketDelayResults& Results, HookDataStruct& HookData)
+   {
+   const PacketDelaySettings& Settings = *HookData.Settings;
+
+#if M_MIL_USE_WINDOWS
+   MosPrintf(MIL_TEXT("The calibration service is only available on Linux.\n"));
+#else
+   CalibrationService Service;
+   Service.MilSystem = MilSystem;
+   Service.MilDigitizer = MilDigitizer;
+   Service.BoardType = BoardType;
+   Service.Results = &Results;
+   Service.HookData = &HookData;
+   Service.SerialNumber = GetCameraSerialNumber(MilDigitizer);
+   LoadCalibrationCache(Service);
+
+   /* The socket lives in a private directory; only the service's user, and the
+      members of the configured group, can reach it. */
+   gid_t Group = (gid_t)-1;
+   if(!Settings.CalibrationServiceGroup.empty())
+      {
+      struct group* GroupEntry = getgrnam(Settings.CalibrationServiceGroup.c_str());
+      if(!GroupEntry)
+         {
+         MosPrintf(MIL_TEXT("Unknown group %s.\n"), ToMilString(Settings.CalibrationServiceGroup.c_str()).c_str());
+         return;
+         }
+      Group = GroupEntry->gr_gid;
+      }
+   if(!CreatePrivateDirectory(Settings.CalibrationServiceDir.c_str(), Group))
+      {
+      MosPrintf(MIL_TEXT("Unable to create the private directory %s (errno %d).\n"),
+         ToMilString(Settings.CalibrationServiceDir.c_str()).c_str(), errno);
+      return;
+      }
+   string SocketPath = Settings.CalibrationServiceDir + "/" + Settings.CalibrationServiceSocket;
+
+   /* Create the listening socket. */
+   sockaddr_un Address;
+   memset(&Address, 0, sizeof(Address));
+   Address.sun_family = AF_UNIX;
+   strncpy(Address.sun_path, SocketPath.c_str(), sizeof(Address.sun_path) - 1);
+
+   int ListenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+   unlink(SocketPath.c_str());
+   if(ListenSocket < 0 ||
+      bind(ListenSocket, (sockaddr*)&Address, sizeof(Address)) != 0 ||
+      chmod(SocketPath.c_str(), (Group != (gid_t)-1) ? 0660 : 0600) != 0 ||
+      (Group != (gid_t)-1 && chown(SocketPath.c_str(), (uid_t)-1, Group) != 0) ||
+      listen(ListenSocket, Settings.CalibrationServiceClients) != 0)
+      {
+      MosPrintf(MIL_TEXT("Unable to listen on %s (errno %d).\n"), ToMilString(SocketPath.c_str()).c_str(), errno);
+      if(ListenSocket >= 0)
+         close(ListenSocket);
+      unlink(SocketPath.c_str());
+      return;
+      }
+
+   struct sigaction Action;
+   memset(&Action, 0, sizeof(Action));
+   Action.sa_handler = RequestCalibrationServiceStop;
+   sigaction(SIGINT, &Action, NULL);
+   sigaction(SIGTERM, &Action, NULL);
+
+   MosPrintf(MIL_TEXT("Calibration service for camera %s listening on %s (%d cached entries).\n"),
+      ToMilString(Service.SerialNumber.c_str()).c_str(), ToMilString(SocketPath.c_str()).c_str(),
+      (int)Service.Cache.size());
+   MosPrintf(MIL_TEXT("Press <Ctrl+C> to stop.\n\n"));
+
+   thread CalibrationThread(CalibrationServiceThread, &Service);
+
+   /* Serve the clients. Index 0 of the poll list is the listening socket. */
+   vector<pollfd> PollList(1);
+   vector<string> PendingInput(1);
+   PollList[0].fd = ListenSocket;
+   PollList[0].events = POLLIN;
+   while(!CalibrationServiceStopRequested)
+      {
+      if(poll(&PollList[0], PollList.size(), 200) <= 0)
+         continue;
+
+      for(size_t i = PollList.size(); i-- > 1; )
+         {
+         if(!(PollList[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+
+         char Buffer[512];
+         ssize_t Size = recv(PollList[i].fd, Buffer, sizeof(Buffer), 0);
+         bool Closed = (Size <= 0);
+         if(!Closed)
+            {
+            /* Answer each complete line. */
+            PendingInput[i].append(Buffer, (size_t)Size);
+            size_t End;
+            while((End = PendingInput[i].find('\n')) != string::npos)
+               {
+               string Answer = HandleServiceRequest(Service, PendingInput[i].substr(0, End)) + "\n";
+               PendingInput[i].erase(0, End + 1);
+               if(send(PollList[i].fd, Answer.c_str(), Answer.size(), MSG_NOSIGNAL) < 0)
+                  Closed = true;
+               }
+            if(PendingInput[i].size() > sizeof(Buffer))
+               Closed = true;
+            }
+
+         if(Closed)
+            {
+            close(PollList[i].fd);
+            PollList.erase(PollList.begin() + i);
+            PendingInput.erase(PendingInput.begin() + i);
+            }
+         }
+
+      if(PollList[0].revents & POLLIN)
+         {
+         int ClientSocket = accept(ListenSocket, NULL, NULL);
+         if(ClientSocket >= 0 && (MIL_INT)PollList.size() > Settings.CalibrationServiceClients)
+            close(ClientSocket);
+         else if(ClientSocket >= 0)
+            {
+            pollfd Client;
+            Client.fd = ClientSocket;
+            Client.events = POLLIN;
+            Client.revents = 0;
+            PollList.push_back(Client);
+            PendingInput.push_back(string());
+            }
+         }
+      }
+
+   /* Let the current calibration complete, then stop. */
+   MosPrintf(MIL_TEXT("\nStopping the calibration service.\n"));
+   {
+   lock_guard<mutex> Guard(Service.Lock);
+   Service.Stop = true;
+   }
+   Service.JobAvailable.notify_one();
+   CalibrationThread.join();
+
+   for(size_t i = 0; i < PollList.size(); i++)
+      close(PollList[i].fd);
+   unlink(SocketPath.c_str());
+#endif
+   }
+
+/* Run the queued calibrations one at a time and store their results in the cache. */
+/* A failed calibration is not cached, so the next query of the configuration       */
+/* queues it again.                                                                 */
+/* -------------------------------------------------------------------------------- */
+void CalibrationServiceThread(CalibrationService* Service)
+   {
+   while(true)
+      {
+      CalibrationQuery Query;
+      {
+      unique_lock<mutex> Guard(Service->Lock);
+      while(Service->Jobs.empty() && !Service->Stop)
+         Service->JobAvailable.wait(Guard);
+      if(Service->Stop)
+         return;
+      Query = Service->Jobs.front();
+      }
+
+      CalibrationCacheEntry Entry;
+      bool Calibrated = RunCalibrationJob(*Service, Query, Entry);
+      if(Calibrated)
+         AppendCalibrationCache(Query, Entry, *Service->HookData->Settings);
+
+      lock_guard<mutex> Guard(Service->Lock);
+      if(Calibrated)
+         Service->Cache[GetCalibrationKey(Query)] = Entry;
+      Service->Jobs.pop_front();
+      }
+   }
+
+/* Configure the camera as queried and calculate its inter-packet delay. The camera's */
+/* region, packet size, pixel format, test pattern and delay are restored afterwards, */
+/* since other processes use the camera between calibrations.                         */
+/* ---------------------------------------------------------------------------------- */
+bool RunCalibrationJob(CalibrationService& Service, const CalibrationQuery& Query, CalibrationCacheEntry& Entry)
+   {
+   const PacketDelaySettings& Settings = *Service.HookData->Settings;
+   PacketDelayResults& Results = *Service.Results;
+   PacketDelayInfo Info;
+   CameraConfiguration Configuration;
+   MIL_STRING PixelFormat = ToMilString(Query.PixelFormat.c_str());
+   MIL_STRING AppliedPixelFormat;
+   MIL_INT SizeBand = 0, BufType = 0;
+   MIL_INT64 Attribute = 0;
+   bool Applied = true;
+
+   MosPrintf(MIL_TEXT("Calibrating %s %dx%d+%d+%d, packet size %d.\n"), PixelFormat.c_str(),
+      (int)Query.Width, (int)Query.Height, (int)Query.OffsetX, (int)Query.OffsetY, (int)Query.PacketSize);
+
+   SaveCameraConfiguration(Service.MilDigitizer, *Service.HookData, Configuration);
+
+   /* Apply the region; offsets are cleared first so that any size is accepted. */
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   Applied = SetIntegerFeature(Service.MilDigitizer, MIL_TEXT("OffsetX"), 0) && Applied;
+   Applied = SetIntegerFeature(Service.MilDigitizer, MIL_TEXT("OffsetY"), 0) && Applied;
+   Applied = SetIntegerFeature(Service.MilDigitizer, MIL_TEXT("Width"), Query.Width) && Applied;
+   Applied = SetIntegerFeature(Service.MilDigitizer, MIL_TEXT("Height"), Query.Height) && Applied;
+   Applied = SetIntegerFeature(Service.MilDigitizer, MIL_TEXT("OffsetX"), Query.OffsetX) && Applied;
+   Applied = SetIntegerFeature(Service.MilDigitizer, MIL_TEXT("OffsetY"), Query.OffsetY) && Applied;
+   Applied = SetIntegerFeature(Service.MilDigitizer, MIL_TEXT("GevSCPSPacketSize"), Query.PacketSize) && Applied;
+
+   /* Apply the pixel format. */
+   ResizeResults(Results, 1);
+   Results.PixelFormats.assign(1, PixelFormat);
+   Results.Selection = 0;
+   if(Applied)
+      {
+      ApplyPixelFormat(Service.MilDigitizer, Results);
+      MdigInquireFeature(Service.MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("PixelFormat"), M_TYPE_STRING, AppliedPixelFormat);
+      GetMilBufferInfoFromPixelFormat(Service.MilDigitizer, SizeBand, BufType, Attribute);
+      Applied = (AppliedPixelFormat == PixelFormat) && SizeBand && BufType && Attribute;
+      }
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+
+   if(Applied)
+      {
+      CalibratePixelFormat(Service.MilSystem, Service.MilDigitizer, Service.BoardType, Info, Results, *Service.HookData);
+      Entry.DelayTickVal = Results.InterPacketDelayInTicks[0];
+      Entry.DelayInSeconds = Results.InterPacketDelayInSec[0];
+      Entry.FrameRate = Results.ObtainedFrameRate[0];
+      MosPrintf(MIL_TEXT("Inter-packet delay: %d ticks (%.2f usec).\n\n"), (int)Entry.DelayTickVal,
+         Entry.DelayInSeconds * 1e6);
+      }
+   else
+      MosPrintf(MIL_TEXT("The camera does not support this configuration.\n\n"));
+
+   if(Settings.PayloadVerification != PAYLOAD_VERIFICATION_NONE)
+      RestoreTestPattern(Service.MilDigitizer, Results);
+   RestoreCameraConfiguration(Service.MilDigitizer, *Service.HookData, Configuration);
+
+   return Applied && !Info.Error;
+   }
+
+/* Save the camera configuration that a calibration job changes. */
+/* ------------------------------------------------------------- */
+void SaveCameraConfiguration(MIL_ID MilDigitizer, const HookDataStruct& HookData, CameraConfiguration& Configuration)
+   {
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("OffsetX"), M_TYPE_INT64, &Configuration.OffsetX);
+   MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("OffsetY"), M_TYPE_INT64, &Configuration.OffsetY);
+   MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("Width"), M_TYPE_INT64, &Configuration.Width);
+   MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("Height"), M_TYPE_INT64, &Configuration.Height);
+   MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("GevSCPSPacketSize"), M_TYPE_INT64, &Configuration.PacketSize);
+   MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("PixelFormat"), M_TYPE_STRING, Configuration.PixelFormat);
+   if(HookData.ThroughputControl)
+      MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("DeviceLinkThroughputLimit"), M_TYPE_INT64, &Configuration.ThroughputLimit);
+   else
+      MdigInquire(MilDigitizer, M_GC_INTER_PACKET_DELAY, &Configuration.DelayTickVal);
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+   }
+
+/* Restore the camera configuration saved before a calibration job. */
+/* ---------------------------------------------------------------- */
+void RestoreCameraConfiguration(MIL_ID MilDigitizer, HookDataStruct& HookData, const CameraConfiguration& Configuration)
+   {
+   MIL_STRING PixelFormat = Configuration.PixelFormat;
+   MIL_INT64 ThroughputLimit = Configuration.ThroughputLimit;
+
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   SetIntegerFeature(MilDigitizer, MIL_TEXT("OffsetX"), 0);
+   SetIntegerFeature(MilDigitizer, MIL_TEXT("OffsetY"), 0);
+   SetIntegerFeature(MilDigitizer, MIL_TEXT("Width"), Configuration.Width);
+   SetIntegerFeature(MilDigitizer, MIL_TEXT("Height"), Configuration.Height);
+   SetIntegerFeature(MilDigitizer, MIL_TEXT("OffsetX"), Configuration.OffsetX);
+   SetIntegerFeature(MilDigitizer, MIL_TEXT("OffsetY"), Configuration.OffsetY);
+   SetIntegerFeature(MilDigitizer, MIL_TEXT("GevSCPSPacketSize"), Configuration.PacketSize);
+   if(!PixelFormat.empty())
+      MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("PixelFormat"), M_TYPE_STRING, PixelFormat);
+   if(HookData.ThroughputControl)
+      MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("DeviceLinkThroughputLimit"), M_TYPE_INT64, &ThroughputLimit);
+   else
+      MdigControl(MilDigitizer, M_GC_INTER_PACKET_DELAY, Configuration.DelayTickVal);
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+   HookData.DelayTickVal = 0;
+   }
+
+/* Answer one request line of a client. */
+/* ------------------------------------ */
+string HandleServiceRequest(CalibrationService& Service, const string& Request)
+   {
+   CalibrationQuery Query;
+   char Answer[128];
+
+   if(Request.compare(0, 6, "STATUS") == 0)
+      {
+      lock_guard<mutex> Guard(Service.Lock);
+      snprintf(Answer, sizeof(Answer), "STATUS %d %d", (int)Service.Cache.size(), (int)Service.Jobs.size());
+      return Answer;
+      }
+
+   if(!ParseCalibrationQuery(Request, Query))
+      return "ERROR invalid request";
+
+   string Key = GetCalibrationKey(Query);
+   lock_guard<mutex> Guard(Service.Lock);
+   map<string, CalibrationCacheEntry>::const_iterator Cached = Service.Cache.find(Key);
+   if(Cached != Service.Cache.end())
+      {
+      snprintf(Answer, sizeof(Answer), "DELAY %d %.3f %.2f", (int)Cached->second.DelayTickVal,
+         Cached->second.DelayInSeconds * 1e6, Cached->second.FrameRate);
+      return Answer;
+      }
+
+   /* Only the attached camera can be calibrated. */
+   if(Query.SerialNumber != Service.SerialNumber)
+      return "ERROR camera not attached";
+
+   size_t Position = 0;
+   while(Position < Service.Jobs.size() && GetCalibrationKey(Service.Jobs[Position]) != Key)
+      Position++;
+   if(Position == Service.Jobs.size())
+      {
+      Service.Jobs.push_back(Query);
+      Service.JobAvailable.notify_one();
+      }
+   snprintf(Answer, sizeof(Answer), "QUEUED %d", (int)Position);
+   return Answer;
+   }
+
+/* Parse a QUERY request. */
+/* ---------------------- */
+bool ParseCalibrationQuery(const string& Request, CalibrationQuery& Query)
+   {
+   char SerialNumber[128], PixelFormat[128];
+   long long OffsetX, OffsetY, Width, Height, PacketSize;
+
+   if(sscanf(Request.c_str(), "QUERY %127s %127s %lld %lld %lld %lld %lld", SerialNumber, PixelFormat,
+      &OffsetX, &OffsetY, &Width, &Height, &PacketSize) != 7)
+      return false;
+   if(OffsetX < 0 || OffsetY < 0 || Width <= 0 || Height <= 0 || PacketSize <= GVSP_IP_UDP_HEADER_SIZE + GVSP_EXTENDED_HEADER_SIZE)
+      return false;
+
+   Query.SerialNumber = SerialNumber;
+   Query.PixelFormat = PixelFormat;
+   Query.OffsetX = OffsetX;
+   Query.OffsetY = OffsetY;
+   Query.Width = Width;
+   Query.Height = Height;
+   Query.PacketSize = PacketSize;
+   return true;
+   }
+
+/* Return the cache key of a query. */
+/* -------------------------------- */
+string GetCalibrationKey(const CalibrationQuery& Query)
+   {
+   char Key[320];
+   snprintf(Key, sizeof(Key), "%s %s %lld %lld %lld %lld %lld", Query.SerialNumber.c_str(),
+      Query.PixelFormat.c_str(), (long long)Query.OffsetX, (long long)Query.OffsetY,
+      (long long)Query.Width, (long long)Query.Height, (long long)Query.PacketSize);
+   return Key;
+   }
+
+/* Read the calibrations stored by previous runs of the service. Later lines replace */
+/* earlier ones; a line without exactly the fields written is skipped.               */
+/* --------------------------------------------------------------------------------- */
+void LoadCalibrationCache(CalibrationService& Service)
+   {
+   const PacketDelaySettings& Settings = *Service.HookData->Settings;
+   FILE* File = fopen(Settings.CalibrationCacheFile.c_str(), "r");
+   if(!File)
+      return;
+
+   char Line[512];
+   while(fgets(Line, sizeof(Line), File))
+      {
+      char SerialNumber[128], PixelFormat[128];
+      long long OffsetX, OffsetY, Width, Height, PacketSize, DelayTickVal;
+      double DelayInUsec, FrameRate;
+      int End = 0;
+      if(sscanf(Line, "%127s %127s %lld %lld %lld %lld %lld %lld %lf %lf %n", SerialNumber, PixelFormat,
+         &OffsetX, &OffsetY, &Width, &Height, &PacketSize, &DelayTickVal, &DelayInUsec, &FrameRate, &End) != 10 ||
+         End == 0 || Line[End] != '\0')
+         continue;
+
+      CalibrationQuery Query;
+      CalibrationCacheEntry Entry;
+      Query.SerialNumber = SerialNumber;
+      Query.PixelFormat = PixelFormat;
+      Query.OffsetX = OffsetX;
+      Query.OffsetY = OffsetY;
+      Query.Width = Width;
+      Query.Height = Height;
+      Query.PacketSize = PacketSize;
+      Entry.DelayTickVal = (MIL_INT)DelayTickVal;
+      Entry.DelayInSeconds = DelayInUsec / 1e6;
+      Entry.FrameRate = FrameRate;
+      Service.Cache[GetCalibrationKey(Query)] = Entry;
+      }
+   fclose(File);
+   }
+
+/* Append a calibration to the cache file. */
+/* --------------------------------------- */
+void AppendCalibrationCache(const CalibrationQuery& Query, const CalibrationCacheEntry& Entry, const PacketDelaySettings& Settings)
+   {
+   FILE* File = fopen(Settings.CalibrationCacheFile.c_str(), "a");
+   if(!File)
+      {
+      MosPrintf(MIL_TEXT("Unable to write %s.\n"), ToMilString(Settings.CalibrationCacheFile.c_str()).c_str());
+      return;
+      }
+
+   fprintf(File, "%s %lld %.3f %.3f\n", GetCalibrationKey(Query).c_str(), (long long)Entry.DelayTickVal,
+      Entry.DelayInSeconds * 1e6, Entry.FrameRate);
+   fclose(File);
+   }
+
+/* Return the camera's serial number, with blanks replaced so it is a single word. */
+/* ------------------------------------------------------------------------------- */
+string GetCameraSerialNumber(MIL_ID MilDigitizer)
+   {
+   MIL_STRING SerialNumber;
+
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+   MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, MIL_TEXT("DeviceSerialNumber"), M_TYPE_STRING, SerialNumber);
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+
+   return ToSingleWord(ToNarrowString(SerialNumber));
+   }
+
+/* Return the name of a tuner's file: the configured name with the camera's serial  */
+/* number inserted before the extension. Without a serial number, the name is kept. */
+/* -------------------------------------------------------------------------------- */
+string GetTunerFileName(const char* FileName, const char* SerialNumber)
+   {
+   string Name = FileName;
+   if(SerialNumber[0] == '\0')
+      return Name;
+
+   size_t Extension = Name.find_last_of('.');
+   size_t Directory = Name.find_last_of("/\\");
+   if(Extension == string::npos || (Directory != string::npos && Extension < Directory))
+      Extension = Name.size();
+   return Name.insert(Extension, string("_") + SerialNumber);
+   }
+
+/* Set an integer feature and return true if the camera kept the value. */
+/* --------------------------------------------------------------------- */
+bool SetIntegerFeature(MIL_ID MilDigitizer, const MIL_TEXT_CHAR* FeatureName, MIL_INT64 Value)
+   {
+   MIL_INT64 AppliedValue = -1;
+   MdigControlFeature(MilDigitizer, M_FEATURE_VALUE, FeatureName, M_TYPE_INT64, &Value);
+   MdigInquireFeature(MilDigitizer, M_FEATURE_VALUE, FeatureName, M_TYPE_INT64, &AppliedValue);
+   return AppliedValue == Value;
+   }